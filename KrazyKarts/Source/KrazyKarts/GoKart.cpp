@@ -2,11 +2,34 @@
 
 
 #include "GoKart.h"
+#include "GoKartRaceInstances.h"
+#include "GoKartSpectatorStream.h"
+#include "GoKartRaceProgress.h"
+#include "GoKartAllocations.h"
+#include "GoKartActivity.h"
+#include "KrazyKarts.h"
 #include "Components/InputComponent.h"
 #include "Engine/World.h"
 #include "DrawDebugHelpers.h"
 #include "Misc/DateTime.h"
 #include "GameFramework/GameStateBase.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<int32> CVarKartInputScript(
+	TEXT("Kart.InputScript"),
+	0,
+	TEXT("Drive locally controlled karts with a fixed input script instead of player input.\n")
+	TEXT("0: off, 1: straight, 2: slalom, 3: circle, 4: stop and go"),
+	ECVF_Cheat);
+
+#if !UE_BUILD_SHIPPING
+static TAutoConsoleVariable<int32> CVarKartDrawRoles(
+	TEXT("Kart.DrawRoles"),
+	0,
+	TEXT("Draw each kart's local network role above it.\n")
+	TEXT("0: off, 1: on"),
+	ECVF_Cheat);
+#endif
 
 // Constructor; Sets default values
 AGoKart::AGoKart()
@@ -27,29 +50,135 @@ void AGoKart::BeginPlay()
 	if (MovementComponent == nullptr) return;
 	
 	if (HasAuthority()){ NetUpdateFrequency = 1;}
+
+	UGoKartRaceProgressSubsystem* RaceProgress = GetWorld()->GetSubsystem<UGoKartRaceProgressSubsystem>();
+	if (HasAuthority() && RaceProgress != nullptr)
+	{
+		RaceProgress->AddKart(this);
+	}
 }
 
-FString GetEnumText(ENetRole Role) 
+const FString& GetEnumText(ENetRole Role) 
 {
+	//built once, the label is drawn over every kart every frame
+	static const FString None = TEXT("None");
+	static const FString SimulatedProxy = TEXT("SimulatedProxy");
+	static const FString AutonomousProxy = TEXT("AutonomousProxy");
+	static const FString Authority = TEXT("Authority");
+	static const FString Error = TEXT("ERROR");
+
 	switch (Role) {
 	case ROLE_None:
-		return "None";
+		return None;
 	case ROLE_SimulatedProxy:
-		return "SimulatedProxy";
+		return SimulatedProxy;
 	case ROLE_AutonomousProxy:
-		return "AutonomousProxy";
+		return AutonomousProxy;
 	case ROLE_Authority:
-		return "Authority";
+		return Authority;
 	default:
-		return "ERROR";
+		return Error;
 	}
 }
 
 // Called every frame
 void AGoKart::Tick(float DeltaTime)
 {	
+	LLM_SCOPE_BYTAG(KrazyKarts_Simulation);
+	FGoKartAllocationScope AllocationScope;
+
 	Super::Tick(DeltaTime);
-	DrawDebugString(GetWorld(), FVector(0,0,100), GetEnumText(GetLocalRole()), this, FColor::White, DeltaTime);
+	ApplyInputScript();
+
+#if !UE_BUILD_SHIPPING
+	//debug only, the engine copies the label into its own debug text list every frame
+	if (CVarKartDrawRoles.GetValueOnGameThread() != 0)
+	{
+		DrawDebugString(GetWorld(), FVector(0,0,100), GetEnumText(GetLocalRole()), this, FColor::White, DeltaTime);
+	}
+#endif
+}
+
+void AGoKart::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	UGoKartRaceInstanceSubsystem* Instances = GetWorld()->GetSubsystem<UGoKartRaceInstanceSubsystem>();
+	if (Instances != nullptr)
+	{
+		Instances->RemoveKart(this);
+	}
+	UGoKartRaceProgressSubsystem* RaceProgress = GetWorld()->GetSubsystem<UGoKartRaceProgressSubsystem>();
+	if (RaceProgress != nullptr)
+	{
+		RaceProgress->RemoveKart(this);
+	}
+	Super::EndPlay(EndPlayReason);
+}
+
+bool AGoKart::IsNetRelevantFor(const AActor* RealViewer, const AActor* ViewTarget, const FVector& SrcLocation) const
+{
+	//karts outside any instance, such as replay playback, are placed in world space and left to distance culling
+	const AGoKart* ViewerKart = Cast<AGoKart>(ViewTarget);
+	if (ViewerKart != nullptr && RaceInstance != INDEX_NONE && ViewerKart->RaceInstance != RaceInstance)
+	{
+		return false;
+	}
+	//spectators get the whole race through the spectator stream instead
+	if (UGoKartSpectatorStreamSubsystem::IsStreamEnabled() && UGoKartSpectatorStreamSubsystem::IsSpectator(RealViewer))
+	{
+		return false;
+	}
+	return Super::IsNetRelevantFor(RealViewer, ViewTarget, SrcLocation);
+}
+
+void AGoKart::SetKartTickEnabled(bool bEnabled)
+{
+	SetActorTickEnabled(bEnabled);
+	if (MovementComponent != nullptr) MovementComponent->SetComponentTickEnabled(bEnabled);
+	if (MovementReplicator != nullptr) MovementReplicator->SetComponentTickEnabled(bEnabled);
+}
+
+void AGoKart::SetKartTickInterval(float Interval)
+{
+	SetActorTickInterval(Interval);
+	if (MovementComponent != nullptr) MovementComponent->SetComponentTickInterval(Interval);
+	if (MovementReplicator != nullptr) MovementReplicator->SetComponentTickInterval(Interval);
+}
+
+void AGoKart::OnReleasedToPool()
+{
+	UGoKartRaceInstanceSubsystem* Instances = GetWorld()->GetSubsystem<UGoKartRaceInstanceSubsystem>();
+	if (Instances != nullptr)
+	{
+		Instances->RemoveKart(this);
+	}
+	RaceInstance = INDEX_NONE;
+
+	SetKartTickEnabled(false);
+	SetActorHiddenInGame(true);
+	SetActorEnableCollision(false);
+	if (MovementComponent != nullptr) MovementComponent->SetPooled(true);
+	if (MovementComponent != nullptr) MovementComponent->ResetState();
+	if (MovementReplicator != nullptr) MovementReplicator->ResetState();
+}
+
+void AGoKart::OnAcquiredFromPool(const FTransform& Transform)
+{
+	SetActorTransform(Transform, false, nullptr, ETeleportType::ResetPhysics);
+	if (MovementComponent != nullptr) MovementComponent->ResetState();
+	if (MovementReplicator != nullptr) MovementReplicator->ResetState();
+	if (MovementComponent != nullptr) MovementComponent->SetPooled(false);
+
+	SetActorEnableCollision(true);
+	SetActorHiddenInGame(false);
+	SetKartTickInterval(0);
+	SetKartTickEnabled(true);
+	ForceNetUpdate();
+
+	UGoKartRaceProgressSubsystem* RaceProgress = GetWorld()->GetSubsystem<UGoKartRaceProgressSubsystem>();
+	if (RaceProgress != nullptr)
+	{
+		RaceProgress->ResetKart(this);
+	}
 }
 
 // Called to bind functionality to input
@@ -66,6 +195,7 @@ void AGoKart::MoveForward(float Value)
 	if (MovementComponent == nullptr) return;
 
 	MovementComponent->SetForce(Value);
+	NoteLocalInput(Value);
 }
 
 void AGoKart::MoveRight(float Value)
@@ -74,4 +204,42 @@ void AGoKart::MoveRight(float Value)
 	if (MovementComponent == nullptr) return;
 
 	MovementComponent->SetSteeringCrank(Value);
+	NoteLocalInput(Value);
+}
+
+void AGoKart::NoteLocalInput(float Value)
+{
+	//the listen server host's input never goes through a move RPC, and its kart may be ticking slowly in an idle instance
+	if (Value == 0 || !HasAuthority()) return;
+
+	UGoKartActivitySubsystem* Activity = GetWorld()->GetSubsystem<UGoKartActivitySubsystem>();
+	if (Activity == nullptr) return;
+	Activity->NoteInput(this, MovementComponent->GetForce(), MovementComponent->GetSteeringCrank());
+}
+
+void AGoKart::ApplyInputScript()
+{
+	int32 Script = CVarKartInputScript.GetValueOnGameThread();
+	if (Script == 0 || MovementComponent == nullptr || !IsLocallyControlled()) return;
+
+	//scripts are a pure function of world time so every run drives the same inputs
+	float Time = GetWorld()->GetTimeSeconds();
+	float Force = 1;
+	float SteeringCrank = 0;
+
+	switch (Script) {
+	case 2:
+		SteeringCrank = FMath::Sin(Time * PI * 0.5f);
+		break;
+	case 3:
+		SteeringCrank = 0.6f;
+		break;
+	case 4:
+		Force = FMath::Fmod(Time, 6) < 4 ? 1 : -1;
+		break;
+	default:
+		break;
+	}
+	MovementComponent->SetForce(Force);
+	MovementComponent->SetSteeringCrank(SteeringCrank);
 }
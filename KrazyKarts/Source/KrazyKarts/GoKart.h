@@ -26,6 +26,21 @@ public:
 	virtual void Tick(float DeltaTime) override;
 	// Called to bind functionality to input
 	virtual void SetupPlayerInputComponent(class UInputComponent* PlayerInputComponent) override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	//karts are only relevant to viewers in the same race instance
+	virtual bool IsNetRelevantFor(const AActor* RealViewer, const AActor* ViewTarget, const FVector& SrcLocation) const override;
+
+	int32 GetRaceInstance() const { return RaceInstance; }
+	void SetRaceInstance(int32 Instance) { RaceInstance = Instance; }
+	//switch the kart and both movement components' ticks together
+	void SetKartTickEnabled(bool bEnabled);
+	//seconds between ticks of the kart and both its components, 0 ticks every frame
+	void SetKartTickInterval(float Interval);
+
+	//park the kart out of play: hidden, no collision, no ticks and not relevant to any client
+	void OnReleasedToPool();
+	//bring a parked kart back into play at Transform with fresh movement state
+	void OnAcquiredFromPool(const FTransform& Transform);
 
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
 	UGoKartMovementComponent* MovementComponent;
@@ -36,6 +51,14 @@ private:
 
 	void MoveForward(float Value);
 	void MoveRight(float Value);
+	//wake the race instance on input to a kart the server drives itself
+	void NoteLocalInput(float Value);
+
+	//overrides player input when Kart.InputScript is set
+	void ApplyInputScript();
+
+	//race instance this kart belongs to on the server, INDEX_NONE when the server only hosts one race
+	int32 RaceInstance = INDEX_NONE;
 
 
 
@@ -0,0 +1,156 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartActivity.h"
+#include "KrazyKarts.h"
+#include "GoKart.h"
+#include "GoKartMovementComponent.h"
+#include "GoKartRaceInstances.h"
+#include "Engine/NetDriver.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Idle Race Instances"), STAT_KartIdleInstances, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Hibernating Race Instances"), STAT_KartHibernatingInstances, STATGROUP_KrazyKarts);
+
+static TAutoConsoleVariable<float> CVarKartIdleDelay(
+	TEXT("Kart.IdleDelay"),
+	2,
+	TEXT("Seconds without input or movement before a race instance counts as idle"));
+
+static TAutoConsoleVariable<float> CVarKartIdleTickInterval(
+	TEXT("Kart.IdleTickInterval"),
+	0.25f,
+	TEXT("Seconds between kart ticks in an idle race instance"));
+
+static TAutoConsoleVariable<int32> CVarKartIdleServerTickRate(
+	TEXT("Kart.IdleServerTickRate"),
+	10,
+	TEXT("Dedicated server tick rate while every race instance is idle or empty"));
+
+namespace
+{
+	//slower than this in m/s counts as parked
+	const float IdleSpeed = 0.1f;
+}
+
+bool UGoKartActivitySubsystem::IsTickable() const
+{
+	return !IsTemplate() && GetWorld() != nullptr && GetWorld()->GetNetMode() != NM_Client;
+}
+
+TStatId UGoKartActivitySubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartActivitySubsystem, STATGROUP_Tickables);
+}
+
+void UGoKartActivitySubsystem::NoteMove(AGoKart* Kart, const FGoKartMove& Move)
+{
+	NoteInput(Kart, Move.Force, Move.SteeringCrank);
+}
+
+void UGoKartActivitySubsystem::NoteInput(AGoKart* Kart, float Force, float SteeringCrank)
+{
+	if (Kart == nullptr || (Force == 0 && SteeringCrank == 0)) return;
+
+	UGoKartRaceInstanceSubsystem* Instances = GetWorld()->GetSubsystem<UGoKartRaceInstanceSubsystem>();
+	FGoKartRaceInstance* Instance = Instances != nullptr ? Instances->FindInstance(Kart->GetRaceInstance()) : nullptr;
+	if (Instance != nullptr)
+	{
+		Instance->LastActiveTime = GetWorld()->TimeSeconds;
+		Instances->SetInstanceIdle(Instance->Id, false, 0);
+	}
+	SetServerIdle(false);
+}
+
+bool UGoKartActivitySubsystem::IsInstanceMoving(const FGoKartRaceInstance& Instance) const
+{
+	for (const TWeakObjectPtr<AGoKart>& Kart : Instance.Karts)
+	{
+		UGoKartMovementComponent* MovementComponent = Kart.IsValid() ? Kart->FindComponentByClass<UGoKartMovementComponent>() : nullptr;
+		if (MovementComponent == nullptr) continue;
+
+		//catches a kart still rolling or steering after its last input, input itself arrives through NoteMove and NoteInput
+		const FGoKartMove& LastMove = MovementComponent->GetLastMove();
+		if (LastMove.Force != 0 || LastMove.SteeringCrank != 0) return true;
+		if (MovementComponent->GetVelocity().SizeSquared() > IdleSpeed * IdleSpeed) return true;
+	}
+	return false;
+}
+
+void UGoKartActivitySubsystem::Tick(float DeltaTime)
+{
+	UGoKartRaceInstanceSubsystem* Instances = GetWorld()->GetSubsystem<UGoKartRaceInstanceSubsystem>();
+	if (Instances == nullptr) return;
+
+	float Now = GetWorld()->TimeSeconds;
+	float IdleDelay = CVarKartIdleDelay.GetValueOnGameThread();
+	float IdleInterval = CVarKartIdleTickInterval.GetValueOnGameThread();
+	int32 NumIdle = 0, NumHibernating = 0;
+	bool bAnyActive = false;
+
+	for (int32 Id = 0; Id < Instances->GetInstances().Num(); ++Id)
+	{
+		FGoKartRaceInstance* Instance = Instances->FindInstance(Id);
+
+		//nobody connected, the karts stop ticking altogether until a player is assigned again
+		if (Instance->Players.Num() == 0)
+		{
+			Instances->SetInstanceTickEnabled(Id, false);
+			NumHibernating++;
+			continue;
+		}
+		Instances->SetInstanceTickEnabled(Id, true);
+
+		if (IsInstanceMoving(*Instance))
+		{
+			Instance->LastActiveTime = Now;
+		}
+		bool bIdle = Now - Instance->LastActiveTime > IdleDelay;
+		Instances->SetInstanceIdle(Id, bIdle, IdleInterval);
+
+		NumIdle += bIdle ? 1 : 0;
+		bAnyActive |= !bIdle;
+	}
+
+	SET_DWORD_STAT(STAT_KartIdleInstances, NumIdle);
+	SET_DWORD_STAT(STAT_KartHibernatingInstances, NumHibernating);
+	SetServerIdle(!bAnyActive);
+}
+
+void UGoKartActivitySubsystem::SetServerIdle(bool bIdle)
+{
+	//a listen server renders for its own player, only dedicated servers drop their rate
+	UNetDriver* NetDriver = GetWorld()->GetNetDriver();
+	if (NetDriver == nullptr || GetWorld()->GetNetMode() != NM_DedicatedServer || bServerIdle == bIdle) return;
+
+	if (!bServerIdle)
+	{
+		ActiveServerTickRate = NetDriver->NetServerMaxTickRate;
+	}
+	bServerIdle = bIdle;
+	NetDriver->NetServerMaxTickRate = bIdle ? CVarKartIdleServerTickRate.GetValueOnGameThread() : ActiveServerTickRate;
+	UE_LOG(LogTemp, Log, TEXT("Server %s, ticking at %d Hz"), bIdle ? TEXT("idle") : TEXT("active"), NetDriver->NetServerMaxTickRate);
+}
+
+void UGoKartActivitySubsystem::LogStatus() const
+{
+	UNetDriver* NetDriver = GetWorld()->GetNetDriver();
+	UE_LOG(LogTemp, Log, TEXT("Server %s, max tick rate %d Hz"), bServerIdle ? TEXT("idle") : TEXT("active"), NetDriver != nullptr ? NetDriver->NetServerMaxTickRate : 0);
+
+	UGoKartRaceInstanceSubsystem* Instances = GetWorld()->GetSubsystem<UGoKartRaceInstanceSubsystem>();
+	if (Instances != nullptr)
+	{
+		UE_LOG(LogTemp, Log, TEXT("%s"), *Instances->Describe());
+	}
+}
+
+static FAutoConsoleCommandWithWorld KartActivityCommand(
+	TEXT("Kart.Activity"),
+	TEXT("Log whether the server and each race instance are active, idle or hibernating"),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		UGoKartActivitySubsystem* Activity = World != nullptr ? World->GetSubsystem<UGoKartActivitySubsystem>() : nullptr;
+		if (Activity == nullptr) return;
+		Activity->LogStatus();
+	}));
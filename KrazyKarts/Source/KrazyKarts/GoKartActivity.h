@@ -0,0 +1,41 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "GoKartActivity.generated.h"
+
+class AGoKart;
+struct FGoKartMove;
+
+//slows idle race instances and the server's own tick rate down, hibernates empty instances and wakes them on the first input
+UCLASS()
+class KRAZYKARTS_API UGoKartActivitySubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	//called for every move the server receives, a move with input wakes the kart's instance and the server straight away
+	void NoteMove(AGoKart* Kart, const FGoKartMove& Move);
+	//input on a kart the server drives itself, such as the listen server host's or a bot's, wakes it the same way
+	void NoteInput(AGoKart* Kart, float Force, float SteeringCrank);
+
+	void LogStatus() const;
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End FTickableGameObject interface
+
+private:
+	bool IsInstanceMoving(const struct FGoKartRaceInstance& Instance) const;
+	void SetServerIdle(bool bIdle);
+
+	bool bServerIdle = false;
+	//the net driver's configured rate, restored when the server wakes
+	int32 ActiveServerTickRate = 0;
+};
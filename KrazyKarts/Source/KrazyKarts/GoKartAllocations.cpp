@@ -0,0 +1,172 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartAllocations.h"
+#include "KrazyKarts.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/MemoryBase.h"
+#include "Misc/CommandLine.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Kart Pipeline Allocations"), STAT_KartPipelineAllocations, STATGROUP_KrazyKarts);
+
+int32 FGoKartAllocationScope::Depth = 0;
+
+namespace
+{
+	//forwards everything to the allocator it wraps and counts what is allocated inside a kart scope on the game thread
+	class FGoKartCountingMalloc : public FMalloc
+	{
+	public:
+		explicit FGoKartCountingMalloc(FMalloc* InInner) : Inner(InInner) {}
+
+		uint64 GetCount() const { return Count; }
+
+		virtual void* Malloc(SIZE_T Size, uint32 Alignment) override
+		{
+			Note();
+			return Inner->Malloc(Size, Alignment);
+		}
+		virtual void* TryMalloc(SIZE_T Size, uint32 Alignment) override
+		{
+			Note();
+			return Inner->TryMalloc(Size, Alignment);
+		}
+		virtual void* Realloc(void* Original, SIZE_T Size, uint32 Alignment) override
+		{
+			if (Size > 0) Note();
+			return Inner->Realloc(Original, Size, Alignment);
+		}
+		virtual void* TryRealloc(void* Original, SIZE_T Size, uint32 Alignment) override
+		{
+			if (Size > 0) Note();
+			return Inner->TryRealloc(Original, Size, Alignment);
+		}
+		virtual void Free(void* Original) override { Inner->Free(Original); }
+		virtual SIZE_T QuantizeSize(SIZE_T Size, uint32 Alignment) override { return Inner->QuantizeSize(Size, Alignment); }
+		virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return Inner->GetAllocationSize(Original, SizeOut); }
+		virtual void Trim(bool bTrimThreadCaches) override { Inner->Trim(bTrimThreadCaches); }
+		virtual void SetupTLSCachesOnCurrentThread() override { Inner->SetupTLSCachesOnCurrentThread(); }
+		virtual void ClearAndDisableTLSCachesOnCurrentThread() override { Inner->ClearAndDisableTLSCachesOnCurrentThread(); }
+		virtual void InitializeStatsMetadata() override { Inner->InitializeStatsMetadata(); }
+		virtual void UpdateStats() override { Inner->UpdateStats(); }
+		virtual void GetAllocatorStats(FGenericMemoryStats& OutStats) override { Inner->GetAllocatorStats(OutStats); }
+		virtual void DumpAllocatorStats(FOutputDevice& Ar) override { Inner->DumpAllocatorStats(Ar); }
+		virtual bool IsInternallyThreadSafe() const override { return Inner->IsInternallyThreadSafe(); }
+		virtual bool ValidateHeap() override { return Inner->ValidateHeap(); }
+		virtual const TCHAR* GetDescriptiveName() override { return Inner->GetDescriptiveName(); }
+
+	private:
+		void Note()
+		{
+			//the scope depth is only ever changed on the game thread
+			if (FGoKartAllocationScope::IsActive() && IsInGameThread())
+			{
+				++Count;
+			}
+		}
+
+		FMalloc* Inner;
+		uint64 Count = 0;
+	};
+
+	FGoKartCountingMalloc* CountingMalloc = nullptr;
+
+	//installed once and left in place, frees of blocks allocated before it go straight through to the same allocator
+	FGoKartCountingMalloc& GetCountingMalloc()
+	{
+		if (CountingMalloc == nullptr)
+		{
+			CountingMalloc = new FGoKartCountingMalloc(GMalloc);
+			GMalloc = CountingMalloc;
+		}
+		return *CountingMalloc;
+	}
+}
+
+void UGoKartAllocationCheckSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	int32 Frames = 0;
+	if (InWorld.IsGameWorld() && FParse::Value(FCommandLine::Get(), TEXT("KartAllocCheck="), Frames))
+	{
+		StartCheck(300, Frames, true);
+	}
+}
+
+void UGoKartAllocationCheckSubsystem::StartCheck(int32 WarmupFrames, int32 Frames, bool bInExitWhenDone)
+{
+	bChecking = true;
+	bExitWhenDone = bInExitWhenDone;
+	WarmupFramesLeft = FMath::Max(WarmupFrames, 0);
+	FramesLeft = FMath::Max(Frames, 1);
+	FramesChecked = 0;
+	WorstFrameAllocations = 0;
+	CountAtStart = LastCount = GetCountingMalloc().GetCount();
+	UE_LOG(LogTemp, Log, TEXT("Kart allocation check: %d warmup frames, then %d checked frames"), WarmupFramesLeft, FramesLeft);
+}
+
+bool UGoKartAllocationCheckSubsystem::IsTickable() const
+{
+	return !IsTemplate() && bChecking;
+}
+
+TStatId UGoKartAllocationCheckSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartAllocationCheckSubsystem, STATGROUP_Tickables);
+}
+
+void UGoKartAllocationCheckSubsystem::Tick(float DeltaTime)
+{
+	uint64 Count = GetCountingMalloc().GetCount();
+	int32 FrameAllocations = (int32)(Count - LastCount);
+	LastCount = Count;
+	SET_DWORD_STAT(STAT_KartPipelineAllocations, FrameAllocations);
+
+	if (WarmupFramesLeft > 0)
+	{
+		if (--WarmupFramesLeft == 0)
+		{
+			CountAtStart = Count;
+		}
+		return;
+	}
+
+	FramesChecked++;
+	WorstFrameAllocations = FMath::Max(WorstFrameAllocations, FrameAllocations);
+	if (--FramesLeft <= 0)
+	{
+		FinishCheck();
+	}
+}
+
+void UGoKartAllocationCheckSubsystem::FinishCheck()
+{
+	bChecking = false;
+	uint64 Total = LastCount - CountAtStart;
+	bool bPassed = Total == 0;
+	if (bPassed)
+	{
+		UE_LOG(LogTemp, Log, TEXT("Kart allocation check passed: no allocations in %d frames"), FramesChecked);
+	}
+	else
+	{
+		UE_LOG(LogTemp, Error, TEXT("Kart allocation check failed: %llu allocations in %d frames, worst frame %d"), Total, FramesChecked, WorstFrameAllocations);
+	}
+
+	if (bExitWhenDone)
+	{
+		FPlatformMisc::RequestExitWithStatus(false, bPassed ? 0 : 1);
+	}
+}
+
+static FAutoConsoleCommandWithWorldAndArgs KartAllocCheckCommand(
+	TEXT("Kart.AllocCheck"),
+	TEXT("Fail if the kart tick pipeline allocates during the next <Frames> frames (default 600) after a short warmup"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UGoKartAllocationCheckSubsystem* AllocationCheck = World != nullptr ? World->GetSubsystem<UGoKartAllocationCheckSubsystem>() : nullptr;
+		if (AllocationCheck == nullptr) return;
+		AllocationCheck->StartCheck(60, Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 600, false);
+	}));
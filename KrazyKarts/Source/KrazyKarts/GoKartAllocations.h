@@ -0,0 +1,52 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "GoKartAllocations.generated.h"
+
+//marks game thread code that must not touch the heap once the race is running, counted while the allocation check is installed
+struct KRAZYKARTS_API FGoKartAllocationScope
+{
+	FGoKartAllocationScope() { ++Depth; }
+	~FGoKartAllocationScope() { --Depth; }
+
+	static bool IsActive() { return Depth > 0; }
+
+private:
+	static int32 Depth;
+};
+
+//checks that the kart tick pipeline makes no heap allocations in steady state
+UCLASS()
+class KRAZYKARTS_API UGoKartAllocationCheckSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+
+	//skip WarmupFrames while pools and queues settle, then fail on any allocation inside a kart scope over the next Frames
+	void StartCheck(int32 WarmupFrames, int32 Frames, bool bExitWhenDone);
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End FTickableGameObject interface
+
+private:
+	void FinishCheck();
+
+	bool bChecking = false;
+	bool bExitWhenDone = false;
+	int32 WarmupFramesLeft = 0;
+	int32 FramesLeft = 0;
+	int32 FramesChecked = 0;
+	uint64 CountAtStart = 0;
+	uint64 LastCount = 0;
+	int32 WorstFrameAllocations = 0;
+};
@@ -0,0 +1,159 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartAssetPreload.h"
+#include "KrazyKartsPawn.h"
+#include "KrazyKartsHud.h"
+#include "CoreGlobals.h"
+#include "Engine/GameInstance.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/CommandLine.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+namespace
+{
+	//assets that had to be loaded on the game thread when first used, the stalls the preload is there to remove
+	int32 NumOnDemandLoads = 0;
+}
+
+void UGoKartAssetPreloadSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	TArray<FSoftObjectPath> Assets;
+	GatherAssets(Assets);
+	NumPreloadAssets = Assets.Num();
+	if (NumPreloadAssets == 0) return;
+
+	//started before the first map loads, so it overlaps the map instead of the first race start
+	PreloadStartTime = FPlatformTime::Seconds();
+	PreloadHandle = Streamable.RequestAsyncLoad(Assets, FStreamableDelegate::CreateUObject(this, &UGoKartAssetPreloadSubsystem::OnPreloadComplete), FStreamableManager::AsyncLoadHighPriority);
+}
+
+void UGoKartAssetPreloadSubsystem::Deinitialize()
+{
+	if (PreloadHandle.IsValid())
+	{
+		PreloadHandle->ReleaseHandle();
+		PreloadHandle.Reset();
+	}
+	Super::Deinitialize();
+}
+
+void UGoKartAssetPreloadSubsystem::GatherAssets(TArray<FSoftObjectPath>& OutAssets) const
+{
+	GetDefault<AKrazyKartsPawn>()->GetPreloadAssets(OutAssets);
+	GetDefault<AKrazyKartsHud>()->GetPreloadAssets(OutAssets);
+	for (const FSoftObjectPath& Path : ExtraAssets)
+	{
+		if (!Path.IsNull())
+		{
+			OutAssets.AddUnique(Path);
+		}
+	}
+}
+
+void UGoKartAssetPreloadSubsystem::OnPreloadComplete()
+{
+	PreloadSeconds = FPlatformTime::Seconds() - PreloadStartTime;
+	UE_LOG(LogTemp, Log, TEXT("Preloaded %d kart assets in %.1f ms"), NumPreloadAssets, PreloadSeconds * 1000);
+}
+
+UObject* UGoKartAssetPreloadSubsystem::ResolveAsset(const FSoftObjectPath& Path)
+{
+	if (Path.IsNull()) return nullptr;
+
+	UObject* Object = Path.ResolveObject();
+	if (Object != nullptr) return Object;
+
+	//still in flight or never requested, loading it now waits for the package on the game thread
+	NumOnDemandLoads++;
+	if (!GIsEditor)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s was not preloaded, loading it on demand"), *Path.ToString());
+	}
+	return Path.TryLoad();
+}
+
+bool UGoKartAssetPreloadSubsystem::IsTickable() const
+{
+	return !IsTemplate() && !bReportedPlayable;
+}
+
+TStatId UGoKartAssetPreloadSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartAssetPreloadSubsystem, STATGROUP_Tickables);
+}
+
+bool UGoKartAssetPreloadSubsystem::IsFirstKartPlayable() const
+{
+	UGameInstance* GameInstance = GetGameInstance();
+	UWorld* World = GameInstance != nullptr ? GameInstance->GetWorld() : nullptr;
+	if (World == nullptr || !World->HasBegunPlay()) return false;
+
+	//a dedicated server has no kart of its own, it is ready once the map is running
+	if (World->GetNetMode() == NM_DedicatedServer) return true;
+
+	APlayerController* Controller = GameInstance->GetFirstLocalPlayerController(World);
+	return Controller != nullptr && Controller->GetPawn() != nullptr;
+}
+
+void UGoKartAssetPreloadSubsystem::Tick(float DeltaTime)
+{
+	if (!IsFirstKartPlayable()) return;
+
+	bReportedPlayable = true;
+	PlayableSeconds = FPlatformTime::Seconds() - GStartTime;
+	FPlatformMemoryStats MemoryStats = FPlatformMemory::GetStats();
+	PeakUsedPhysical = MemoryStats.PeakUsedPhysical;
+	PeakUsedVirtual = MemoryStats.PeakUsedVirtual;
+	LogStartupReport();
+
+	//-KartStartupReport=<file> turns a headless run into a startup benchmark that writes its numbers and quits
+	FString ReportFile;
+	if (FParse::Value(FCommandLine::Get(), TEXT("KartStartupReport="), ReportFile))
+	{
+		WriteReport(ReportFile);
+		FPlatformMisc::RequestExit(false);
+	}
+}
+
+void UGoKartAssetPreloadSubsystem::LogStartupReport() const
+{
+	UE_LOG(LogTemp, Log, TEXT("Startup: first playable kart after %.2f s, preload %s, %d on demand loads, peak memory %.1f MB physical %.1f MB virtual"),
+		PlayableSeconds,
+		PreloadSeconds < 0 ? TEXT("unfinished") : *FString::Printf(TEXT("%.1f ms"), PreloadSeconds * 1000),
+		NumOnDemandLoads, PeakUsedPhysical / (1024.0 * 1024.0), PeakUsedVirtual / (1024.0 * 1024.0));
+}
+
+FString UGoKartAssetPreloadSubsystem::ToJson() const
+{
+	return FString::Printf(TEXT("{\"playableSeconds\":%.4f,\"preloadSeconds\":%.4f,\"preloadAssets\":%d,\"onDemandLoads\":%d,\"peakUsedPhysicalBytes\":%llu,\"peakUsedVirtualBytes\":%llu}"),
+		PlayableSeconds, PreloadSeconds, NumPreloadAssets, NumOnDemandLoads, PeakUsedPhysical, PeakUsedVirtual);
+}
+
+bool UGoKartAssetPreloadSubsystem::WriteReport(const FString& FileName) const
+{
+	FString Path = FPaths::IsRelative(FileName) ? FPaths::ProjectSavedDir() / TEXT("Startup") / FileName : FileName;
+	if (!FFileHelper::SaveStringToFile(ToJson(), *Path))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not write startup report to %s"), *Path);
+		return false;
+	}
+	UE_LOG(LogTemp, Log, TEXT("Wrote startup report to %s"), *Path);
+	return true;
+}
+
+static FAutoConsoleCommandWithWorld KartStartupCommand(
+	TEXT("Kart.Startup"),
+	TEXT("Log time to the first playable kart, asset preload time and peak memory for this run"),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		UGameInstance* GameInstance = World != nullptr ? World->GetGameInstance() : nullptr;
+		UGoKartAssetPreloadSubsystem* Preload = GameInstance != nullptr ? GameInstance->GetSubsystem<UGoKartAssetPreloadSubsystem>() : nullptr;
+		if (Preload == nullptr) return;
+		Preload->LogStartupReport();
+	}));
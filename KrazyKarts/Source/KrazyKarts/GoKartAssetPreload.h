@@ -0,0 +1,55 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/GameInstanceSubsystem.h"
+#include "Tickable.h"
+#include "Engine/StreamableManager.h"
+#include "GoKartAssetPreload.generated.h"
+
+//loads the karts' and hud's soft referenced assets in the background from game start, and reports how long startup took
+UCLASS(config = Game)
+class KRAZYKARTS_API UGoKartAssetPreloadSubsystem : public UGameInstanceSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	//the asset if it is already in memory, otherwise loaded on the spot and counted as a preload miss
+	static UObject* ResolveAsset(const FSoftObjectPath& Path);
+
+	void LogStartupReport() const;
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	// End FTickableGameObject interface
+
+private:
+	void GatherAssets(TArray<FSoftObjectPath>& OutAssets) const;
+	void OnPreloadComplete();
+	bool IsFirstKartPlayable() const;
+	FString ToJson() const;
+	bool WriteReport(const FString& FileName) const;
+
+	//anything else to load up front, e.g. the Blueprint kart's meshes, set in DefaultGame.ini
+	UPROPERTY(Config)
+	TArray<FSoftObjectPath> ExtraAssets;
+
+	FStreamableManager Streamable;
+	TSharedPtr<FStreamableHandle> PreloadHandle;
+
+	int32 NumPreloadAssets = 0;
+	double PreloadStartTime = 0;
+	double PreloadSeconds = -1;
+
+	bool bReportedPlayable = false;
+	//seconds from process start until the first kart could be driven
+	double PlayableSeconds = 0;
+	uint64 PeakUsedPhysical = 0;
+	uint64 PeakUsedVirtual = 0;
+};
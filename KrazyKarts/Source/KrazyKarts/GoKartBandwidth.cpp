@@ -0,0 +1,230 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartBandwidth.h"
+#include "Engine/World.h"
+#include "Engine/NetDriver.h"
+#include "Engine/NetConnection.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "UObject/CoreNet.h"
+
+void FGoKartBandwidthCounter::Add(int32 Bits, double Now)
+{
+	int64 Second = FMath::FloorToInt(Now);
+	int32 Bucket = Second % WindowSeconds;
+	if (BucketSeconds[Bucket] != Second)
+	{
+		BucketSeconds[Bucket] = Second;
+		Buckets[Bucket] = 0;
+	}
+	Buckets[Bucket] += Bits;
+	TotalBits += Bits;
+	TotalMessages++;
+}
+
+float FGoKartBandwidthCounter::GetBitsPerSecond(int32 Seconds, double Now) const
+{
+	Seconds = FMath::Clamp(Seconds, 1, WindowSeconds);
+
+	//the current second is still filling, so the window ends at the last complete one
+	int64 LastSecond = FMath::FloorToInt(Now) - 1;
+	int64 Sum = 0;
+	for (int64 Second = LastSecond - Seconds + 1; Second <= LastSecond; ++Second)
+	{
+		int32 Bucket = ((Second % WindowSeconds) + WindowSeconds) % WindowSeconds;
+		if (BucketSeconds[Bucket] == Second)
+		{
+			Sum += Buckets[Bucket];
+		}
+	}
+	return float(Sum) / Seconds;
+}
+
+void UGoKartBandwidthSubsystem::Record(const AActor* Kart, FName Channel, int32 Bits, bool bOutgoing, const UNetConnection* Connection)
+{
+	if (Kart == nullptr) return;
+
+	FGoKartBandwidthKey Key { Kart->GetFName(), Channel, bOutgoing, Connection != nullptr ? Connection->GetFName() : NAME_None };
+	Counters.FindOrAdd(Key).Add(Bits, GetWorld()->GetRealTimeSeconds());
+}
+
+namespace
+{
+	//serialize every field the way property replication and RPC parameters do
+	//structs without a native NetSerialize are flattened into their fields, FStructProperty::NetSerializeItem is fatal for them
+	void SerializeNetFields(FNetBitWriter& Writer, const UStruct* Struct, const void* Data)
+	{
+		for (TFieldIterator<FProperty> It(Struct); It; ++It)
+		{
+			if (It->HasAnyPropertyFlags(CPF_RepSkip)) continue;
+
+			for (int32 Index = 0; Index < It->ArrayDim; ++Index)
+			{
+				void* Value = const_cast<void*>(It->ContainerPtrToValuePtr<void>(Data, Index));
+				if (FStructProperty* StructProperty = CastField<FStructProperty>(*It))
+				{
+					if ((StructProperty->Struct->StructFlags & STRUCT_NetSerializeNative) == 0)
+					{
+						SerializeNetFields(Writer, StructProperty->Struct, Value);
+						continue;
+					}
+				}
+				if (FArrayProperty* ArrayProperty = CastField<FArrayProperty>(*It))
+				{
+					//the element count goes first, then every element like a field of its own
+					FScriptArrayHelper Array(ArrayProperty, Value);
+					uint16 Num = Array.Num();
+					Writer << Num;
+					for (int32 Element = 0; Element < Array.Num(); ++Element)
+					{
+						FStructProperty* InnerStruct = CastField<FStructProperty>(ArrayProperty->Inner);
+						if (InnerStruct != nullptr && (InnerStruct->Struct->StructFlags & STRUCT_NetSerializeNative) == 0)
+						{
+							SerializeNetFields(Writer, InnerStruct->Struct, Array.GetRawPtr(Element));
+						}
+						else
+						{
+							ArrayProperty->Inner->NetSerializeItem(Writer, nullptr, Array.GetRawPtr(Element));
+						}
+					}
+					continue;
+				}
+				if (It->IsA<FObjectPropertyBase>())
+				{
+					//object references go out as a NetGUID, which needs the connection's package map, so count a typical one
+					uint32 NetGUID = 0;
+					Writer << NetGUID;
+					continue;
+				}
+				It->NetSerializeItem(Writer, nullptr, Value);
+			}
+		}
+	}
+}
+
+int32 UGoKartBandwidthSubsystem::GetPayloadBits(const UScriptStruct* Struct, const void* Data)
+{
+	if (const int32* Cached = PayloadBits.Find(Struct))
+	{
+		return *Cached;
+	}
+
+	FNetBitWriter Writer(nullptr, 1024);
+	SerializeNetFields(Writer, Struct, Data);
+	int32 Bits = Writer.GetNumBits();
+	PayloadBits.Add(Struct, Bits);
+	return Bits;
+}
+
+namespace
+{
+	//messages that aren't tracked per connection go wherever the kart's RPCs or the whole relevancy set take them
+	FString GetConnectionLabel(const FGoKartBandwidthKey& Key)
+	{
+		return Key.Connection.IsNone() ? FString(TEXT("all")) : Key.Connection.ToString();
+	}
+}
+
+FString UGoKartBandwidthSubsystem::ToCsv() const
+{
+	double Now = GetWorld()->GetRealTimeSeconds();
+	FString Csv = TEXT("kart,channel,direction,connection,messages,total_bits,bps_1s,bps_5s,bps_30s\n");
+	for (const TPair<FGoKartBandwidthKey, FGoKartBandwidthCounter>& Pair : Counters)
+	{
+		const FGoKartBandwidthCounter& Counter = Pair.Value;
+		Csv += FString::Printf(TEXT("%s,%s,%s,%s,%lld,%lld,%.0f,%.0f,%.0f\n"),
+			*Pair.Key.Kart.ToString(), *Pair.Key.Channel.ToString(), Pair.Key.bOutgoing ? TEXT("out") : TEXT("in"), *GetConnectionLabel(Pair.Key),
+			Counter.TotalMessages, Counter.TotalBits,
+			Counter.GetBitsPerSecond(1, Now), Counter.GetBitsPerSecond(5, Now), Counter.GetBitsPerSecond(30, Now));
+	}
+	return Csv;
+}
+
+FString UGoKartBandwidthSubsystem::ToJson() const
+{
+	double Now = GetWorld()->GetRealTimeSeconds();
+	TArray<FString> Entries;
+	for (const TPair<FGoKartBandwidthKey, FGoKartBandwidthCounter>& Pair : Counters)
+	{
+		const FGoKartBandwidthCounter& Counter = Pair.Value;
+		Entries.Add(FString::Printf(TEXT("{\"kart\":\"%s\",\"channel\":\"%s\",\"direction\":\"%s\",\"connection\":\"%s\",\"messages\":%lld,\"totalBits\":%lld,\"bps1s\":%.0f,\"bps5s\":%.0f,\"bps30s\":%.0f}"),
+			*Pair.Key.Kart.ToString(), *Pair.Key.Channel.ToString(), Pair.Key.bOutgoing ? TEXT("out") : TEXT("in"), *GetConnectionLabel(Pair.Key),
+			Counter.TotalMessages, Counter.TotalBits,
+			Counter.GetBitsPerSecond(1, Now), Counter.GetBitsPerSecond(5, Now), Counter.GetBitsPerSecond(30, Now)));
+	}
+
+	//whole connection totals from the net driver, including headers and everything that isn't a kart
+	TArray<FString> Connections;
+	UNetDriver* NetDriver = GetWorld()->GetNetDriver();
+	if (NetDriver != nullptr)
+	{
+		TArray<UNetConnection*> AllConnections = NetDriver->ClientConnections;
+		if (NetDriver->ServerConnection != nullptr)
+		{
+			AllConnections.Add(NetDriver->ServerConnection);
+		}
+		for (UNetConnection* Connection : AllConnections)
+		{
+			Connections.Add(FString::Printf(TEXT("{\"connection\":\"%s\",\"inBytesPerSecond\":%d,\"outBytesPerSecond\":%d}"),
+				*Connection->LowLevelGetRemoteAddress(true), Connection->InBytesPerSecond, Connection->OutBytesPerSecond));
+		}
+	}
+
+	return FString::Printf(TEXT("{\"karts\":[%s],\"connections\":[%s]}"), *FString::Join(Entries, TEXT(",")), *FString::Join(Connections, TEXT(",")));
+}
+
+bool UGoKartBandwidthSubsystem::WriteReport(const FString& FileName) const
+{
+	FString Path = FPaths::IsRelative(FileName) ? FPaths::ProjectSavedDir() / TEXT("Bandwidth") / FileName : FileName;
+	FString Report = FPaths::GetExtension(Path) == TEXT("csv") ? ToCsv() : ToJson();
+	if (!FFileHelper::SaveStringToFile(Report, *Path))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not write bandwidth report to %s"), *Path);
+		return false;
+	}
+	UE_LOG(LogTemp, Log, TEXT("Wrote bandwidth report to %s"), *Path);
+	return true;
+}
+
+void UGoKartBandwidthSubsystem::LogSummary() const
+{
+	double Now = GetWorld()->GetRealTimeSeconds();
+	for (const TPair<FGoKartBandwidthKey, FGoKartBandwidthCounter>& Pair : Counters)
+	{
+		UE_LOG(LogTemp, Log, TEXT("%-24s %-20s %-3s %-20s %8.0f bps (5s) %8.0f bps (30s)"),
+			*Pair.Key.Kart.ToString(), *Pair.Key.Channel.ToString(), Pair.Key.bOutgoing ? TEXT("out") : TEXT("in"), *GetConnectionLabel(Pair.Key),
+			Pair.Value.GetBitsPerSecond(5, Now), Pair.Value.GetBitsPerSecond(30, Now));
+	}
+}
+
+static FAutoConsoleCommandWithWorld KartBandwidthCommand(
+	TEXT("Kart.Bandwidth"),
+	TEXT("Log replication bandwidth per kart and per property or RPC"),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		UGoKartBandwidthSubsystem* Bandwidth = World != nullptr ? World->GetSubsystem<UGoKartBandwidthSubsystem>() : nullptr;
+		if (Bandwidth == nullptr) return;
+		Bandwidth->LogSummary();
+	}));
+
+static FAutoConsoleCommandWithWorldAndArgs KartBandwidthDumpCommand(
+	TEXT("Kart.Bandwidth.Dump"),
+	TEXT("Write kart bandwidth to Saved/Bandwidth/<File>, as CSV for .csv files and JSON otherwise"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UGoKartBandwidthSubsystem* Bandwidth = World != nullptr ? World->GetSubsystem<UGoKartBandwidthSubsystem>() : nullptr;
+		if (Bandwidth == nullptr) return;
+		Bandwidth->WriteReport(Args.Num() > 0 ? Args[0] : TEXT("Bandwidth.json"));
+	}));
+
+static FAutoConsoleCommandWithWorld KartBandwidthResetCommand(
+	TEXT("Kart.Bandwidth.Reset"),
+	TEXT("Clear the kart bandwidth counters"),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		UGoKartBandwidthSubsystem* Bandwidth = World != nullptr ? World->GetSubsystem<UGoKartBandwidthSubsystem>() : nullptr;
+		if (Bandwidth == nullptr) return;
+		Bandwidth->Reset();
+	}));
@@ -0,0 +1,78 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "GoKartBandwidth.generated.h"
+
+class UNetConnection;
+
+//bits sent or received through one property or RPC of one kart, bucketed per second for rolling averages
+struct FGoKartBandwidthCounter
+{
+	static const int32 WindowSeconds = 30;
+
+	int64 TotalBits = 0;
+	int64 TotalMessages = 0;
+
+	void Add(int32 Bits, double Now);
+	//average bits per second over the last Seconds whole seconds
+	float GetBitsPerSecond(int32 Seconds, double Now) const;
+
+private:
+	int32 Buckets[WindowSeconds] = { 0 };
+	int64 BucketSeconds[WindowSeconds] = { 0 };
+};
+
+struct FGoKartBandwidthKey
+{
+	//the kart's object name, an FName so recording a message never builds a string
+	FName Kart;
+	FName Channel;
+	bool bOutgoing;
+	//net connection object name for properties that are sent to each connection separately, None otherwise
+	FName Connection;
+
+	bool operator==(const FGoKartBandwidthKey& Other) const
+	{
+		return bOutgoing == Other.bOutgoing && Channel == Other.Channel && Kart == Other.Kart && Connection == Other.Connection;
+	}
+
+	friend uint32 GetTypeHash(const FGoKartBandwidthKey& Key)
+	{
+		return HashCombine(HashCombine(HashCombine(GetTypeHash(Key.Kart), GetTypeHash(Key.Channel)), GetTypeHash(Key.Connection)), Key.bOutgoing ? 1 : 0);
+	}
+};
+
+//attributes kart replication traffic to each kart and each property or RPC
+UCLASS()
+class KRAZYKARTS_API UGoKartBandwidthSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	void RecordOutgoing(const AActor* Kart, FName Channel, const UScriptStruct* Struct, const void* Data) { Record(Kart, Channel, GetPayloadBits(Struct, Data), true); }
+	void RecordIncoming(const AActor* Kart, FName Channel, const UScriptStruct* Struct, const void* Data) { Record(Kart, Channel, GetPayloadBits(Struct, Data), false); }
+	//for RPCs whose parameters aren't a single struct
+	void RecordOutgoing(const AActor* Kart, FName Channel, int32 Bits) { Record(Kart, Channel, Bits, true); }
+	void RecordIncoming(const AActor* Kart, FName Channel, int32 Bits) { Record(Kart, Channel, Bits, false); }
+	//a replicated property sent to one connection, called once for every connection it goes out to
+	void RecordOutgoing(const AActor* Kart, const UNetConnection* Connection, FName Channel, const UScriptStruct* Struct, const void* Data) { Record(Kart, Channel, GetPayloadBits(Struct, Data), true, Connection); }
+
+	void Reset() { Counters.Reset(); }
+
+	FString ToCsv() const;
+	FString ToJson() const;
+	bool WriteReport(const FString& FileName) const;
+	void LogSummary() const;
+
+private:
+	void Record(const AActor* Kart, FName Channel, int32 Bits, bool bOutgoing, const UNetConnection* Connection = nullptr);
+	//payload size the net code would write for this struct, packet and RPC headers aren't included
+	int32 GetPayloadBits(const UScriptStruct* Struct, const void* Data);
+
+	TMap<FGoKartBandwidthKey, FGoKartBandwidthCounter> Counters;
+	//kart structs are all fixed size, so each is measured once
+	TMap<const UScriptStruct*, int32> PayloadBits;
+};
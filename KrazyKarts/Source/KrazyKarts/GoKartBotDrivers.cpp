@@ -0,0 +1,183 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartBotDrivers.h"
+#include "GoKart.h"
+#include "GoKartTrack.h"
+#include "GoKartRaceInstances.h"
+#include "KrazyKarts.h"
+#include "Engine/World.h"
+#include "GameFramework/GameModeBase.h"
+#include "HAL/IConsoleManager.h"
+
+DECLARE_CYCLE_STAT(TEXT("Bot Drivers"), STAT_KartBotDrivers, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Bot Karts"), STAT_KartBotCount, STATGROUP_KrazyKarts);
+
+void UGoKartBotSubsystem::AddBot(AGoKart* Kart)
+{
+	if (Kart == nullptr || !Kart->HasAuthority() || Bots.Contains(Kart)) return;
+
+	Bots.Add(Kart);
+	TrackIndices.Add(INDEX_NONE);
+}
+
+void UGoKartBotSubsystem::RemoveBot(AGoKart* Kart)
+{
+	int32 Index = Bots.IndexOfByKey(Kart);
+	if (Index == INDEX_NONE) return;
+
+	Bots.RemoveAtSwap(Index);
+	TrackIndices.RemoveAtSwap(Index);
+}
+
+void UGoKartBotSubsystem::SpawnBots(int32 Count, int32 InstanceId)
+{
+	UWorld* World = GetWorld();
+	AGoKartTrack* Track = AGoKartTrack::Find(World);
+	if (Track == nullptr || World->GetNetMode() == NM_Client) return;
+
+	const FGoKartTrackTable& Table = Track->GetRacingLineTable();
+	if (Table.Num() == 0) return;
+
+	UClass* KartClass = AGoKart::StaticClass();
+	AGameModeBase* GameMode = World->GetAuthGameMode();
+	if (GameMode != nullptr && GameMode->DefaultPawnClass != nullptr && GameMode->DefaultPawnClass->IsChildOf(AGoKart::StaticClass()))
+	{
+		KartClass = GameMode->DefaultPawnClass;
+	}
+
+	//the track is baked for the first instance, the others are offset copies
+	UGoKartRaceInstanceSubsystem* RaceInstances = World->GetSubsystem<UGoKartRaceInstanceSubsystem>();
+	FGoKartRaceInstance* Instance = RaceInstances != nullptr ? RaceInstances->FindInstance(InstanceId) : nullptr;
+	FVector Origin = Instance != nullptr ? Instance->Origin : FVector::ZeroVector;
+
+	FActorSpawnParameters SpawnParameters;
+	SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButAlwaysSpawn;
+
+	for (int32 Bot = 0; Bot < Count; ++Bot)
+	{
+		int32 Index = (Bot * Table.Num()) / FMath::Max(Count, 1);
+		FRotator Rotation = Table.Directions[Index].Rotation();
+		AGoKart* Kart = World->SpawnActor<AGoKart>(KartClass, Origin + Table.Locations[Index] + FVector(0, 0, 50), Rotation, SpawnParameters);
+		if (Kart == nullptr) continue;
+
+		//players only see the karts of their own instance
+		if (Instance != nullptr)
+		{
+			RaceInstances->AddKart(Kart, InstanceId);
+		}
+		AddBot(Kart);
+	}
+}
+
+bool UGoKartBotSubsystem::IsTickable() const
+{
+	return !IsTemplate() && Bots.Num() > 0;
+}
+
+TStatId UGoKartBotSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartBotSubsystem, STATGROUP_Tickables);
+}
+
+void UGoKartBotSubsystem::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartBotDrivers);
+
+	if (!CachedTrack.IsValid())
+	{
+		CachedTrack = AGoKartTrack::Find(GetWorld());
+	}
+	if (!CachedTrack.IsValid() || CachedTrack->GetRacingLineTable().Num() == 0) return;
+
+	Gather();
+	Evaluate(*CachedTrack);
+	Apply();
+
+	SET_DWORD_STAT(STAT_KartBotCount, Bots.Num());
+}
+
+void UGoKartBotSubsystem::Gather()
+{
+	for (int32 Bot = Bots.Num() - 1; Bot >= 0; --Bot)
+	{
+		if (!Bots[Bot].IsValid() || Bots[Bot]->MovementComponent == nullptr)
+		{
+			Bots.RemoveAtSwap(Bot);
+			TrackIndices.RemoveAtSwap(Bot);
+		}
+	}
+
+	int32 NumBots = Bots.Num();
+	Locations.SetNumUninitialized(NumBots, false);
+	Forwards.SetNumUninitialized(NumBots, false);
+	Rights.SetNumUninitialized(NumBots, false);
+	Speeds.SetNumUninitialized(NumBots, false);
+	MinTurningRadii.SetNumUninitialized(NumBots, false);
+	Throttles.SetNumUninitialized(NumBots, false);
+	Steerings.SetNumUninitialized(NumBots, false);
+
+	UGoKartRaceInstanceSubsystem* RaceInstances = GetWorld()->GetSubsystem<UGoKartRaceInstanceSubsystem>();
+	for (int32 Bot = 0; Bot < NumBots; ++Bot)
+	{
+		const AGoKart* Kart = Bots[Bot].Get();
+		const FTransform& Transform = Kart->GetActorTransform();
+		//bots in an offset instance follow the racing line in their own copy of the track
+		FGoKartRaceInstance* Instance = RaceInstances != nullptr ? RaceInstances->FindInstance(Kart->GetRaceInstance()) : nullptr;
+		Locations[Bot] = Transform.GetLocation() - (Instance != nullptr ? Instance->Origin : FVector::ZeroVector);
+		Forwards[Bot] = Transform.GetUnitAxis(EAxis::X);
+		Rights[Bot] = Transform.GetUnitAxis(EAxis::Y);
+		Speeds[Bot] = FVector::DotProduct(Kart->MovementComponent->GetVelocity(), Forwards[Bot]);
+		MinTurningRadii[Bot] = Kart->MovementComponent->GetMinTurningRadius();
+	}
+}
+
+void UGoKartBotSubsystem::Evaluate(const AGoKartTrack& Track)
+{
+	const FGoKartTrackTable& Table = Track.GetRacingLineTable();
+
+	for (int32 Bot = 0; Bot < Bots.Num(); ++Bot)
+	{
+		int32 Nearest = Table.FindNearest(Locations[Bot], TrackIndices[Bot]);
+		TrackIndices[Bot] = Nearest;
+
+		//pure pursuit towards a point further along the line, speeds are m/s and distances cm
+		float LookAhead = BaseLookAhead + FMath::Max(Speeds[Bot], 0.f) * 100 * LookAheadTime;
+		FVector ToTarget = Table.Locations[Table.Advance(Nearest, LookAhead)] - Locations[Bot];
+		float Lateral = FVector::DotProduct(ToTarget, Rights[Bot]);
+		float PathCurvature = 2 * Lateral / FMath::Max(ToTarget.SizeSquared(), 1.f) * 100;
+		Steerings[Bot] = FMath::Clamp(PathCurvature * MinTurningRadii[Bot], -1.f, 1.f);
+
+		//slow down for the tightest corner coming up
+		float CornerCurvature = Table.MaxCurvaturesAhead[Nearest] * 100;
+		float TargetSpeed = CornerCurvature > KINDA_SMALL_NUMBER ? FMath::Min(FMath::Sqrt(MaxLateralAcceleration / CornerCurvature), MaxSpeed) : MaxSpeed;
+		Throttles[Bot] = FMath::Clamp((TargetSpeed - Speeds[Bot]) * ThrottleGain, -1.f, 1.f);
+	}
+}
+
+void UGoKartBotSubsystem::Apply()
+{
+	for (int32 Bot = 0; Bot < Bots.Num(); ++Bot)
+	{
+		UGoKartMovementComponent* MovementComponent = Bots[Bot]->MovementComponent;
+		MovementComponent->SetForce(Throttles[Bot]);
+		MovementComponent->SetSteeringCrank(Steerings[Bot]);
+	}
+}
+
+static FAutoConsoleCommandWithWorldAndArgs KartSpawnBotsCommand(
+	TEXT("Kart.SpawnBots"),
+	TEXT("Spawn <Count> server side bot karts along the track's racing line of race instance [Instance], the first open instance by default"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UGoKartBotSubsystem* BotDrivers = World != nullptr ? World->GetSubsystem<UGoKartBotSubsystem>() : nullptr;
+		if (BotDrivers == nullptr) return;
+
+		UGoKartRaceInstanceSubsystem* RaceInstances = World->GetSubsystem<UGoKartRaceInstanceSubsystem>();
+		int32 InstanceId = RaceInstances != nullptr && RaceInstances->GetInstances().Num() > 0 ? RaceInstances->GetInstances()[0].Id : INDEX_NONE;
+		if (Args.Num() > 1)
+		{
+			InstanceId = FCString::Atoi(*Args[1]);
+		}
+		BotDrivers->SpawnBots(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 1, InstanceId);
+	}));
@@ -0,0 +1,60 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "GoKartBotDrivers.generated.h"
+
+class AGoKart;
+class AGoKartTrack;
+
+//drives server side bot karts along the track's racing line, evaluating every bot in one pass per tick
+UCLASS()
+class KRAZYKARTS_API UGoKartBotSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	void AddBot(AGoKart* Kart);
+	void RemoveBot(AGoKart* Kart);
+	int32 NumBots() const { return Bots.Num(); }
+
+	//spawn bots spread along the racing line of one race instance, INDEX_NONE for the track itself outside any instance
+	void SpawnBots(int32 Count, int32 InstanceId);
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End FTickableGameObject interface
+
+private:
+	void Gather();
+	void Evaluate(const AGoKartTrack& Track);
+	void Apply();
+
+	TArray<TWeakObjectPtr<AGoKart>> Bots;
+
+	//per bot working set, kept as parallel arrays so the evaluate pass runs over contiguous data
+	TArray<FVector> Locations;
+	TArray<FVector> Forwards;
+	TArray<FVector> Rights;
+	TArray<float> Speeds;
+	TArray<float> MinTurningRadii;
+	TArray<int32> TrackIndices;
+	TArray<float> Throttles;
+	TArray<float> Steerings;
+
+	TWeakObjectPtr<AGoKartTrack> CachedTrack;
+
+	//how far ahead the bots aim, in cm at a standstill and in seconds of travel at speed
+	float BaseLookAhead = 800;
+	float LookAheadTime = 0.5f;
+	//sideways grip the bots assume when picking a corner speed, in m/s^2
+	float MaxLateralAcceleration = 12;
+	float MaxSpeed = 30;
+	float ThrottleGain = 0.5f;
+};
@@ -0,0 +1,194 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartContacts.h"
+#include "GoKartMovementComponent.h"
+#include "KrazyKarts.h"
+#include "GameFramework/Actor.h"
+
+DECLARE_CYCLE_STAT(TEXT("Kart Contacts"), STAT_KartContacts, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Kart Contact Pairs"), STAT_KartContactPairs, STATGROUP_KrazyKarts);
+
+void UGoKartContactSubsystem::AddKart(UGoKartMovementComponent* Kart)
+{
+	if (Kart == nullptr) return;
+	Karts.AddUnique(Kart);
+}
+
+void UGoKartContactSubsystem::RemoveKart(UGoKartMovementComponent* Kart)
+{
+	Karts.RemoveSwap(Kart);
+}
+
+bool UGoKartContactSubsystem::IsTickable() const
+{
+	return !IsTemplate() && Karts.Num() > 1;
+}
+
+TStatId UGoKartContactSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartContactSubsystem, STATGROUP_Tickables);
+}
+
+void UGoKartContactSubsystem::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartContacts);
+
+	Gather();
+	//a client with only simulated proxies around has nothing to predict
+	if (NumDriven == 0)
+	{
+		SET_DWORD_STAT(STAT_KartContactPairs, 0);
+		return;
+	}
+	BuildHash();
+	FindContacts();
+	if (Contacts.Num() > 0)
+	{
+		Solve();
+		Apply();
+	}
+
+	SET_DWORD_STAT(STAT_KartContactPairs, Contacts.Num());
+}
+
+void UGoKartContactSubsystem::Gather()
+{
+	Karts.RemoveAllSwap([](const TWeakObjectPtr<UGoKartMovementComponent>& Kart)
+	{
+		return !Kart.IsValid() || Kart->GetOwner() == nullptr;
+	});
+
+	//karts of an instance that is switched off, or on full physics, don't push anyone, parked pool karts aren't registered at all
+	ActiveKarts.Reset();
+	Driven.Reset();
+	NumDriven = 0;
+	for (const TWeakObjectPtr<UGoKartMovementComponent>& Kart : Karts)
+	{
+		if (Kart->IsComponentTickEnabled())
+		{
+			ActiveKarts.Add(Kart.Get());
+			bool bDriven = Kart->GetOwnerRole() != ROLE_SimulatedProxy;
+			Driven.Add(bDriven);
+			NumDriven += bDriven ? 1 : 0;
+		}
+	}
+
+	int32 NumKarts = ActiveKarts.Num();
+	Positions.SetNumUninitialized(NumKarts, false);
+	Velocities.SetNumUninitialized(NumKarts, false);
+	Radii.SetNumUninitialized(NumKarts, false);
+	InverseMasses.SetNumUninitialized(NumKarts, false);
+
+	float MaxRadius = 1;
+	for (int32 Index = 0; Index < NumKarts; ++Index)
+	{
+		UGoKartMovementComponent* Kart = ActiveKarts[Index];
+		Positions[Index] = Kart->GetOwner()->GetActorLocation();
+		Velocities[Index] = Kart->GetVelocity();
+		Radii[Index] = Kart->GetContactRadius();
+		InverseMasses[Index] = 1 / FMath::Max(Kart->GetMass(), 1.f);
+		MaxRadius = FMath::Max(MaxRadius, Radii[Index]);
+	}
+
+	//a cell as wide as the largest contact means only neighbouring cells can touch
+	CellSize = MaxRadius * 2;
+}
+
+void UGoKartContactSubsystem::BuildHash()
+{
+	CellHeads.Reset();
+	NextInCell.SetNumUninitialized(Positions.Num(), false);
+
+	for (int32 Index = 0; Index < Positions.Num(); ++Index)
+	{
+		FIntPoint Cell(FMath::FloorToInt(Positions[Index].X / CellSize), FMath::FloorToInt(Positions[Index].Y / CellSize));
+		int32& Head = CellHeads.FindOrAdd(Cell, INDEX_NONE);
+		NextInCell[Index] = Head;
+		Head = Index;
+	}
+}
+
+void UGoKartContactSubsystem::FindContacts()
+{
+	Contacts.Reset();
+
+	for (int32 A = 0; A < Positions.Num(); ++A)
+	{
+		FIntPoint Cell(FMath::FloorToInt(Positions[A].X / CellSize), FMath::FloorToInt(Positions[A].Y / CellSize));
+		for (int32 X = -1; X <= 1; ++X)
+		{
+			for (int32 Y = -1; Y <= 1; ++Y)
+			{
+				const int32* Head = CellHeads.Find(Cell + FIntPoint(X, Y));
+				for (int32 B = Head != nullptr ? *Head : INDEX_NONE; B != INDEX_NONE; B = NextInCell[B])
+				{
+					//each pair once, and two simulated proxies are the server's business
+					if (B <= A) continue;
+					if (!Driven[A] && !Driven[B]) continue;
+
+					//karts are circles in the ground plane
+					FVector Delta = Positions[B] - Positions[A];
+					Delta.Z = 0;
+					float Reach = Radii[A] + Radii[B];
+					float DistSq = Delta.SizeSquared();
+					if (DistSq >= Reach * Reach) continue;
+
+					float Dist = FMath::Sqrt(DistSq);
+					FContact& Contact = Contacts.AddDefaulted_GetRef();
+					Contact.A = A;
+					Contact.B = B;
+					Contact.Normal = Dist > KINDA_SMALL_NUMBER ? Delta / Dist : FVector::ForwardVector;
+					Contact.Penetration = Reach - Dist;
+				}
+			}
+		}
+	}
+}
+
+void UGoKartContactSubsystem::Solve()
+{
+	PositionCorrections.Reset();
+	PositionCorrections.SetNumZeroed(Positions.Num());
+
+	for (int32 Iteration = 0; Iteration < SolverIterations; ++Iteration)
+	{
+		for (const FContact& Contact : Contacts)
+		{
+			float InverseMassSum = InverseMasses[Contact.A] + InverseMasses[Contact.B];
+			float ClosingSpeed = FVector::DotProduct(Velocities[Contact.B] - Velocities[Contact.A], Contact.Normal);
+			if (ClosingSpeed >= 0) continue;
+
+			//equal and opposite impulse along the contact normal instead of stopping dead
+			FVector Impulse = Contact.Normal * (-(1 + Restitution) * ClosingSpeed / InverseMassSum);
+			Velocities[Contact.A] -= Impulse * InverseMasses[Contact.A];
+			Velocities[Contact.B] += Impulse * InverseMasses[Contact.B];
+		}
+	}
+
+	for (const FContact& Contact : Contacts)
+	{
+		float InverseMassSum = InverseMasses[Contact.A] + InverseMasses[Contact.B];
+		FVector Push = Contact.Normal * (Contact.Penetration * PenetrationCorrection / InverseMassSum);
+		PositionCorrections[Contact.A] -= Push * InverseMasses[Contact.A];
+		PositionCorrections[Contact.B] += Push * InverseMasses[Contact.B];
+	}
+}
+
+void UGoKartContactSubsystem::Apply()
+{
+	for (int32 Index = 0; Index < ActiveKarts.Num(); ++Index)
+	{
+		//a proxy's share of the impulse arrives with its next server update
+		if (!Driven[Index]) continue;
+
+		//the response goes out with the kart's next move, so the server checks it and the owning client's replay repeats it
+		UGoKartMovementComponent* Kart = ActiveKarts[Index];
+		FVector VelocityChange = Velocities[Index] - Kart->GetVelocity();
+		FVector Offset = PositionCorrections[Index].IsNearlyZero() ? FVector::ZeroVector : PositionCorrections[Index];
+		if (!VelocityChange.IsNearlyZero() || !Offset.IsZero())
+		{
+			Kart->AddContactResponse(VelocityChange, Offset);
+		}
+	}
+}
@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "GoKartContacts.generated.h"
+
+class UGoKartMovementComponent;
+
+//resolves kart against kart contacts for every simulated kart in one pass, broadphased through a spatial hash
+//on a client the owning kart is predicted against the simulated proxies, which take part in the solve but only move with the server
+UCLASS()
+class KRAZYKARTS_API UGoKartContactSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	void AddKart(UGoKartMovementComponent* Kart);
+	void RemoveKart(UGoKartMovementComponent* Kart);
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End FTickableGameObject interface
+
+private:
+	void Gather();
+	void BuildHash();
+	void FindContacts();
+	void Solve();
+	void Apply();
+
+	struct FContact
+	{
+		int32 A;
+		int32 B;
+		//from A to B in the ground plane
+		FVector Normal;
+		float Penetration;
+	};
+
+	TArray<TWeakObjectPtr<UGoKartMovementComponent>> Karts;
+	//karts simulating this tick, parked or switched off karts don't collide
+	TArray<UGoKartMovementComponent*> ActiveKarts;
+	//the solve's result is written back to this kart, false for simulated proxies
+	TArray<bool> Driven;
+	int32 NumDriven = 0;
+
+	//per kart working set, positions in cm and velocities in m/s
+	TArray<FVector> Positions;
+	TArray<FVector> Velocities;
+	TArray<float> Radii;
+	TArray<float> InverseMasses;
+	TArray<FVector> PositionCorrections;
+
+	//each cell holds the first kart in it, NextInCell chains the rest
+	TMap<FIntPoint, int32> CellHeads;
+	TArray<int32> NextInCell;
+	float CellSize = 0;
+
+	TArray<FContact> Contacts;
+
+	//bounciness of kart against kart hits
+	float Restitution = 0.3f;
+	//fraction of the overlap pushed out per tick, the rest is left for the following ticks to avoid jitter
+	float PenetrationCorrection = 0.8f;
+	int32 SolverIterations = 2;
+};
@@ -0,0 +1,123 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartGroundProbes.h"
+#include "GoKartMovementComponent.h"
+#include "KrazyKarts.h"
+#include "Engine/World.h"
+
+DECLARE_CYCLE_STAT(TEXT("Ground Probes"), STAT_KartGroundProbes, STATGROUP_KrazyKarts);
+
+void UGoKartGroundProbeSubsystem::AddKart(UGoKartMovementComponent* Kart)
+{
+	if (Kart == nullptr) return;
+	if (ProbeSets.ContainsByPredicate([Kart](const FProbeSet& Probes) { return Probes.Kart == Kart; })) return;
+
+	FProbeSet& Probes = ProbeSets.AddDefaulted_GetRef();
+	Probes.Kart = Kart;
+}
+
+void UGoKartGroundProbeSubsystem::RemoveKart(UGoKartMovementComponent* Kart)
+{
+	int32 Index = ProbeSets.IndexOfByPredicate([Kart](const FProbeSet& Probes) { return Probes.Kart == Kart; });
+	if (Index == INDEX_NONE) return;
+
+	ProbeSets.RemoveAtSwap(Index);
+}
+
+bool UGoKartGroundProbeSubsystem::IsTickable() const
+{
+	return !IsTemplate() && ProbeSets.Num() > 0;
+}
+
+TStatId UGoKartGroundProbeSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartGroundProbeSubsystem, STATGROUP_Tickables);
+}
+
+void UGoKartGroundProbeSubsystem::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartGroundProbes);
+
+	//last tick's traces have been run by the async trace task by now, all of this tick's go out as one batch
+	for (int32 Index = ProbeSets.Num() - 1; Index >= 0; --Index)
+	{
+		FProbeSet& Probes = ProbeSets[Index];
+		if (!Probes.Kart.IsValid() || Probes.Kart->GetOwner() == nullptr)
+		{
+			ProbeSets.RemoveAtSwap(Index);
+			continue;
+		}
+		//karts that aren't simulating right now, such as vehicles on full physics, and simulated proxies, which only follow the server, don't need the ground
+		if (!Probes.Kart->IsComponentTickEnabled() || Probes.Kart->GetOwnerRole() == ROLE_SimulatedProxy)
+		{
+			//a contact from before would otherwise be picked up by the first move once the kart simulates again
+			Probes.Kart->ClearGroundContact();
+			for (FTraceHandle& Handle : Probes.Handles)
+			{
+				Handle = FTraceHandle();
+			}
+			continue;
+		}
+
+		ConsumeResults(Probes);
+		IssueProbes(Probes);
+	}
+}
+
+void UGoKartGroundProbeSubsystem::ConsumeResults(FProbeSet& Probes)
+{
+	FVector Points[4];
+	int32 NumHits = 0;
+
+	for (int32 Corner = 0; Corner < 4; ++Corner)
+	{
+		FTraceDatum Datum;
+		if (!Probes.Handles[Corner].IsValid() || !GetWorld()->QueryTraceData(Probes.Handles[Corner], Datum))
+		{
+			//no complete batch this tick, such as the first one after the kart starts simulating
+			Probes.Kart->AgeGroundContact();
+			return;
+		}
+		if (Datum.OutHits.Num() == 0 || !Datum.OutHits[0].bBlockingHit) continue;
+
+		Points[Corner] = Datum.OutHits[0].ImpactPoint;
+		NumHits++;
+	}
+
+	if (NumHits < 4)
+	{
+		//a wheel off the edge or in the air, let the kart carry on as it is
+		Probes.Kart->ClearGroundContact();
+		return;
+	}
+
+	//the diagonals span the plane under the kart
+	FVector Normal = FVector::CrossProduct(Points[0] - Points[3], Points[1] - Points[2]).GetSafeNormal();
+	if (Normal.Z < 0)
+	{
+		Normal = -Normal;
+	}
+	FVector Centre = (Points[0] + Points[1] + Points[2] + Points[3]) / 4;
+	Probes.Kart->SetGroundContact(Normal, Centre);
+}
+
+void UGoKartGroundProbeSubsystem::IssueProbes(FProbeSet& Probes)
+{
+	UGoKartMovementComponent* Kart = Probes.Kart.Get();
+	const FTransform& Transform = Kart->GetOwner()->GetActorTransform();
+	FVector Up = Transform.GetUnitAxis(EAxis::Z);
+	FVector2D Extent = Kart->GetProbeExtent();
+	float ProbeLength = Kart->GetProbeLength();
+
+	FCollisionQueryParams Params(SCENE_QUERY_STAT(KartGroundProbe), false, Kart->GetOwner());
+
+	const FVector2D Corners[4] = { FVector2D(1, -1), FVector2D(1, 1), FVector2D(-1, -1), FVector2D(-1, 1) };
+	for (int32 Corner = 0; Corner < 4; ++Corner)
+	{
+		FVector Offset(Corners[Corner].X * Extent.X, Corners[Corner].Y * Extent.Y, 0);
+		FVector Start = Transform.TransformPosition(Offset) + Up * ProbeLength / 2;
+		FVector End = Start - Up * ProbeLength;
+		Probes.Handles[Corner] = GetWorld()->AsyncLineTraceByChannel(EAsyncTraceType::Single, Start, End, ECC_Visibility, Params);
+	}
+}
@@ -0,0 +1,42 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "WorldCollision.h"
+#include "GoKartGroundProbes.generated.h"
+
+class UGoKartMovementComponent;
+
+//issues the four corner suspension probes of every kart as async traces and hands the ground plane back a tick later
+UCLASS()
+class KRAZYKARTS_API UGoKartGroundProbeSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	void AddKart(UGoKartMovementComponent* Kart);
+	void RemoveKart(UGoKartMovementComponent* Kart);
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End FTickableGameObject interface
+
+private:
+	struct FProbeSet
+	{
+		TWeakObjectPtr<UGoKartMovementComponent> Kart;
+		//front left, front right, rear left, rear right
+		FTraceHandle Handles[4];
+	};
+
+	void ConsumeResults(FProbeSet& Probes);
+	void IssueProbes(FProbeSet& Probes);
+
+	TArray<FProbeSet> ProbeSets;
+};
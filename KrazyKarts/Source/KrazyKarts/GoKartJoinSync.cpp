@@ -0,0 +1,150 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartJoinSync.h"
+#include "KrazyKarts.h"
+#include "GoKart.h"
+#include "GoKartMovementComponent.h"
+#include "GoKartSpectatorStream.h"
+#include "GoKartBandwidth.h"
+#include "EngineUtils.h"
+#include "Engine/NetDriver.h"
+#include "Engine/PackageMapClient.h"
+#include "GameFramework/PlayerController.h"
+#include "Misc/Compression.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+DECLARE_CYCLE_STAT(TEXT("Join Snapshot Encode"), STAT_KartJoinSnapshotEncode, STATGROUP_KrazyKarts);
+DECLARE_CYCLE_STAT(TEXT("Join Snapshot Seed"), STAT_KartJoinSnapshotSeed, STATGROUP_KrazyKarts);
+
+void UGoKartJoinSyncSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+	WorldStartTime = FPlatformTime::Seconds();
+}
+
+uint32 UGoKartJoinSyncSubsystem::GetNetId(AActor* Actor) const
+{
+	UNetDriver* NetDriver = GetWorld()->GetNetDriver();
+	if (NetDriver == nullptr || !NetDriver->GuidCache.IsValid()) return 0;
+	return NetDriver->GuidCache->GetOrAssignNetGUID(Actor).Value;
+}
+
+AActor* UGoKartJoinSyncSubsystem::FindByNetId(uint32 NetId) const
+{
+	UNetDriver* NetDriver = GetWorld()->GetNetDriver();
+	if (NetDriver == nullptr || !NetDriver->GuidCache.IsValid()) return nullptr;
+	return Cast<AActor>(NetDriver->GuidCache->GetObjectFromNetGUID(FNetworkGUID(NetId), false));
+}
+
+void UGoKartJoinSyncSubsystem::SendJoinSnapshot(APlayerController* NewPlayer)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartJoinSnapshotEncode);
+
+	AGoKart* PlayerKart = NewPlayer != nullptr ? Cast<AGoKart>(NewPlayer->GetPawn()) : nullptr;
+	UGoKartMovementReplicator* PlayerReplicator = PlayerKart != nullptr ? PlayerKart->FindComponentByClass<UGoKartMovementReplicator>() : nullptr;
+	if (PlayerReplicator == nullptr || NewPlayer->IsLocalController()) return;
+
+	//every other kart racing in the same instance, the ones the player is about to receive
+	FGoKartSpectatorSnapshot Snapshot;
+	Snapshot.Time = GetWorld()->TimeSeconds;
+	for (TActorIterator<AGoKart> It(GetWorld()); It; ++It)
+	{
+		AGoKart* Kart = *It;
+		if (Kart == PlayerKart || Kart->IsHidden() || Kart->GetRaceInstance() != PlayerKart->GetRaceInstance()) continue;
+		UGoKartMovementComponent* MovementComponent = Kart->FindComponentByClass<UGoKartMovementComponent>();
+		uint32 NetId = GetNetId(Kart);
+		if (MovementComponent == nullptr || NetId == 0) continue;
+
+		FGoKartState& State = Snapshot.States.AddDefaulted_GetRef();
+		State.Transform = Kart->GetActorTransform();
+		State.Velocity = MovementComponent->GetVelocity();
+		State.LastMove = MovementComponent->GetLastMove();
+		Snapshot.KartIds.Add(NetId);
+	}
+	//nobody racing yet, the normal initial replication is all there is
+	if (Snapshot.KartIds.Num() == 0) return;
+
+	TArray<uint8> Raw;
+	FMemoryWriter Writer(Raw);
+	Snapshot.Serialize(Writer);
+
+	int32 RawSize = Raw.Num();
+	int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Zlib, RawSize);
+	TArray<uint8> Data;
+	Data.SetNumUninitialized(sizeof(int32) + CompressedSize);
+	FMemory::Memcpy(Data.GetData(), &RawSize, sizeof(int32));
+	if (!FCompression::CompressMemory(NAME_Zlib, Data.GetData() + sizeof(int32), CompressedSize, Raw.GetData(), RawSize)) return;
+	Data.SetNum(sizeof(int32) + CompressedSize, false);
+
+	PlayerReplicator->Client_JoinSnapshot(Data);
+
+	UGoKartBandwidthSubsystem* Bandwidth = GetWorld()->GetSubsystem<UGoKartBandwidthSubsystem>();
+	if (Bandwidth != nullptr)
+	{
+		Bandwidth->RecordOutgoing(PlayerKart, TEXT("Client_JoinSnapshot"), Data.Num() * 8);
+	}
+	UE_LOG(LogTemp, Log, TEXT("Sent join snapshot of %d karts to %s: %d bytes, %d uncompressed"),
+		Snapshot.KartIds.Num(), *NewPlayer->GetName(), Data.Num(), RawSize);
+}
+
+void UGoKartJoinSyncSubsystem::ReceiveSnapshot(const TArray<uint8>& Data)
+{
+	if (Data.Num() <= sizeof(int32)) return;
+
+	int32 RawSize = 0;
+	FMemory::Memcpy(&RawSize, Data.GetData(), sizeof(int32));
+	//a uint16 count and at most 65535 karts of 27 bytes
+	if (RawSize <= 0 || RawSize > 2 * 1024 * 1024) return;
+
+	TArray<uint8> Raw;
+	Raw.SetNumUninitialized(RawSize);
+	if (!FCompression::UncompressMemory(NAME_Zlib, Raw.GetData(), RawSize, Data.GetData() + sizeof(int32), Data.Num() - sizeof(int32))) return;
+
+	FGoKartSpectatorSnapshot Snapshot;
+	FMemoryReader Reader(Raw);
+	Snapshot.Serialize(Reader);
+	if (Reader.IsError()) return;
+
+	for (int32 Index = 0; Index < Snapshot.KartIds.Num(); ++Index)
+	{
+		PendingStates.Add(Snapshot.KartIds[Index], Snapshot.States[Index]);
+	}
+	SnapshotReceiveTime = FPlatformTime::Seconds();
+	SnapshotKarts = Snapshot.KartIds.Num();
+	UE_LOG(LogTemp, Log, TEXT("Received join snapshot of %d karts, %d bytes"), SnapshotKarts, Data.Num());
+
+	SeedPendingKarts();
+}
+
+void UGoKartJoinSyncSubsystem::SeedPendingKarts()
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartJoinSnapshotSeed);
+	if (PendingStates.Num() == 0) return;
+
+	double Now = FPlatformTime::Seconds();
+	if (Now - SnapshotReceiveTime > PendingTimeout)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Dropped join snapshot states for %d karts that never arrived"), PendingStates.Num());
+		PendingStates.Reset();
+		return;
+	}
+
+	for (auto It = PendingStates.CreateIterator(); It; ++It)
+	{
+		AActor* Kart = FindByNetId(It.Key());
+		UGoKartMovementReplicator* MovementReplicator = Kart != nullptr ? Kart->FindComponentByClass<UGoKartMovementReplicator>() : nullptr;
+		//not here yet, or here but not started
+		if (MovementReplicator == nullptr || !MovementReplicator->HasBegunPlay()) continue;
+
+		MovementReplicator->SeedInterpolation(It.Value(), 1 / FMath::Max(Kart->NetUpdateFrequency, 1.f));
+		It.RemoveCurrent();
+	}
+
+	if (PendingStates.Num() == 0)
+	{
+		UE_LOG(LogTemp, Log, TEXT("Join sync: %d karts playable %.0f ms after the map started, %.0f ms after the snapshot"),
+			SnapshotKarts, (Now - WorldStartTime) * 1000, (Now - SnapshotReceiveTime) * 1000);
+	}
+}
@@ -0,0 +1,39 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "GoKartMovementReplicator.h"
+#include "GoKartJoinSync.generated.h"
+
+class APlayerController;
+
+//sends a player joining a race in progress one compressed snapshot of every kart and seeds their proxies from it
+UCLASS()
+class KRAZYKARTS_API UGoKartJoinSyncSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+
+	//server: snapshot the karts of the new player's race and send it through their own kart
+	void SendJoinSnapshot(APlayerController* NewPlayer);
+
+	//client: unpack a snapshot and seed whichever karts have arrived, the rest are seeded as their channels open
+	void ReceiveSnapshot(const TArray<uint8>& Data);
+	void SeedPendingKarts();
+
+private:
+	uint32 GetNetId(AActor* Actor) const;
+	AActor* FindByNetId(uint32 NetId) const;
+
+	TMap<uint32, FGoKartState> PendingStates;
+	double SnapshotReceiveTime = 0;
+	double WorldStartTime = 0;
+	int32 SnapshotKarts = 0;
+
+	//snapshot states older than this are dropped rather than seeded
+	float PendingTimeout = 5;
+};
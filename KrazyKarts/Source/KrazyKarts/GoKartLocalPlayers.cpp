@@ -0,0 +1,101 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartLocalPlayers.h"
+#include "KrazyKarts.h"
+#include "GoKartAllocations.h"
+#include "GoKart.h"
+#include "GoKartBandwidth.h"
+#include "Engine/ChildConnection.h"
+#include "Engine/NetConnection.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+
+DECLARE_CYCLE_STAT(TEXT("Local Players Reconcile"), STAT_KartLocalPlayersReconcile, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Bundled Moves"), STAT_KartBundledMoves, STATGROUP_KrazyKarts);
+
+UNetConnection* UGoKartLocalPlayersSubsystem::GetRootConnection(const AActor* Actor)
+{
+	UNetConnection* Connection = Actor != nullptr ? Actor->GetNetConnection() : nullptr;
+	UChildConnection* Child = Connection != nullptr ? Connection->GetUChildConnection() : nullptr;
+	return Child != nullptr ? Child->Parent : Connection;
+}
+
+bool UGoKartLocalPlayersSubsystem::IsTickable() const
+{
+	return !IsTemplate() && GetWorld() != nullptr && GetWorld()->GetNetMode() == NM_Client;
+}
+
+TStatId UGoKartLocalPlayersSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartLocalPlayersSubsystem, STATGROUP_Tickables);
+}
+
+void UGoKartLocalPlayersSubsystem::BundleMove(AGoKart* Kart, const FGoKartMove& Move)
+{
+	FGoKartBundledMove& Bundled = Bundle.AddDefaulted_GetRef();
+	Bundled.Kart = Kart;
+	Bundled.Move = Move;
+}
+
+void UGoKartLocalPlayersSubsystem::MarkReconcile(UGoKartMovementReplicator* Replicator)
+{
+	PendingReconcile.AddUnique(Replicator);
+}
+
+void UGoKartLocalPlayersSubsystem::UpdateLocalKarts()
+{
+	LocalKarts.Reset();
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		APlayerController* Controller = It->Get();
+		AGoKart* Kart = Controller != nullptr && Controller->IsLocalController() ? Cast<AGoKart>(Controller->GetPawn()) : nullptr;
+		if (Kart != nullptr && Kart->GetLocalRole() == ROLE_AutonomousProxy)
+		{
+			LocalKarts.Add(Kart);
+		}
+	}
+	bBundling = LocalKarts.Num() > 1;
+}
+
+void UGoKartLocalPlayersSubsystem::Tick(float DeltaTime)
+{
+	LLM_SCOPE_BYTAG(KrazyKarts_Replication);
+	FGoKartAllocationScope AllocationScope;
+
+	//runs after every kart has ticked, so this frame's moves and updates are all in
+	{
+		SCOPE_CYCLE_COUNTER(STAT_KartLocalPlayersReconcile);
+		for (UGoKartMovementReplicator* Replicator : PendingReconcile)
+		{
+			if (Replicator != nullptr)
+			{
+				Replicator->Reconcile();
+			}
+		}
+		PendingReconcile.Reset();
+	}
+
+	if (Bundle.Num() > 0)
+	{
+		SET_DWORD_STAT(STAT_KartBundledMoves, Bundle.Num());
+
+		AGoKart* Sender = LocalKarts.Num() > 0 ? LocalKarts[0] : Bundle[0].Kart;
+		UGoKartMovementReplicator* SenderReplicator = Sender != nullptr ? Sender->FindComponentByClass<UGoKartMovementReplicator>() : nullptr;
+		if (SenderReplicator != nullptr)
+		{
+			UGoKartBandwidthSubsystem* Bandwidth = GetWorld()->GetSubsystem<UGoKartBandwidthSubsystem>();
+			if (Bandwidth != nullptr)
+			{
+				for (const FGoKartBundledMove& Bundled : Bundle)
+				{
+					Bandwidth->RecordOutgoing(Bundled.Kart, TEXT("Server_SendMoveBundle"), FGoKartMove::StaticStruct(), &Bundled.Move);
+				}
+			}
+			SenderReplicator->Server_SendMoveBundle(Bundle);
+		}
+		Bundle.Reset();
+	}
+
+	UpdateLocalKarts();
+}
@@ -0,0 +1,49 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "GoKartMovementReplicator.h"
+#include "GoKartLocalPlayers.generated.h"
+
+class AGoKart;
+class UNetConnection;
+
+//bundles the moves of split screen players on one client into a single RPC per frame and reconciles their karts in one pass
+UCLASS()
+class KRAZYKARTS_API UGoKartLocalPlayersSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	//true while more than one local player is driving a kart on this client
+	bool IsBundling() const { return bBundling; }
+
+	void BundleMove(AGoKart* Kart, const FGoKartMove& Move);
+	void MarkReconcile(UGoKartMovementReplicator* Replicator);
+
+	//the connection the actor is driven through, split screen players' child connections resolve to their parent
+	static UNetConnection* GetRootConnection(const AActor* Actor);
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End FTickableGameObject interface
+
+private:
+	void UpdateLocalKarts();
+
+	//autonomous karts of the local players, the first one carries the bundle
+	UPROPERTY()
+	TArray<AGoKart*> LocalKarts;
+
+	UPROPERTY()
+	TArray<UGoKartMovementReplicator*> PendingReconcile;
+
+	TArray<FGoKartBundledMove> Bundle;
+	bool bBundling = false;
+};
@@ -2,9 +2,17 @@
 
 
 #include "GoKartMovementComponent.h"
+#include "GoKartGroundProbes.h"
+#include "GoKartContacts.h"
+#include "GoKartAllocations.h"
+#include "GoKartActivity.h"
+#include "GoKart.h"
+#include "KrazyKarts.h"
 //#include "Engine/World.h"
 #include "GameFramework/GameStateBase.h"
 
+constexpr float FGoKartMove::DeltaTimeStep;
+
 // Sets default values for this component's properties
 UGoKartMovementComponent::UGoKartMovementComponent()
 {
@@ -19,6 +27,56 @@ UGoKartMovementComponent::UGoKartMovementComponent()
 void UGoKartMovementComponent::BeginPlay()
 {
 	Super::BeginPlay();
+
+	JoinSolvers();
+}
+
+void UGoKartMovementComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	LeaveSolvers();
+	Super::EndPlay(EndPlayReason);
+}
+
+void UGoKartMovementComponent::SetPooled(bool bPooled)
+{
+	if (bPooled)
+	{
+		LeaveSolvers();
+	}
+	else
+	{
+		JoinSolvers();
+	}
+}
+
+void UGoKartMovementComponent::JoinSolvers()
+{
+	UGoKartGroundProbeSubsystem* GroundProbes = GetWorld()->GetSubsystem<UGoKartGroundProbeSubsystem>();
+	if (bFollowGround && GroundProbes != nullptr)
+	{
+		GroundProbes->AddKart(this);
+	}
+
+	//the owning client solves the same contacts as the server, so a bump doesn't arrive as a correction
+	UGoKartContactSubsystem* Contacts = GetWorld()->GetSubsystem<UGoKartContactSubsystem>();
+	if (Contacts != nullptr)
+	{
+		Contacts->AddKart(this);
+	}
+}
+
+void UGoKartMovementComponent::LeaveSolvers()
+{
+	UGoKartGroundProbeSubsystem* GroundProbes = GetWorld()->GetSubsystem<UGoKartGroundProbeSubsystem>();
+	if (GroundProbes != nullptr)
+	{
+		GroundProbes->RemoveKart(this);
+	}
+	UGoKartContactSubsystem* Contacts = GetWorld()->GetSubsystem<UGoKartContactSubsystem>();
+	if (Contacts != nullptr)
+	{
+		Contacts->RemoveKart(this);
+	}
 }
 
 
@@ -26,39 +84,163 @@ void UGoKartMovementComponent::BeginPlay()
 void UGoKartMovementComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+	LLM_SCOPE_BYTAG(KrazyKarts_Simulation);
+	FGoKartAllocationScope AllocationScope;
 
 	if(GetOwnerRole() == ROLE_AutonomousProxy || GetOwner()->GetRemoteRole() == ROLE_SimulatedProxy)
 	{
-		LastMove = CreateMove(DeltaTime);
+		//moves sent to the server stay within the frame time it accepts
+		float MoveDeltaTime = GetOwnerRole() == ROLE_AutonomousProxy ? FMath::Min(DeltaTime, MaxMoveDeltaTime) : DeltaTime;
+		LastMove = CreateMove(MoveDeltaTime);
 		SimulateMove(LastMove);
+
+		//karts the server drives itself, such as bots, never send a move RPC that would wake their instance
+		UGoKartActivitySubsystem* Activity = GetOwnerRole() == ROLE_Authority ? GetWorld()->GetSubsystem<UGoKartActivitySubsystem>() : nullptr;
+		if (Activity != nullptr)
+		{
+			Activity->NoteMove(Cast<AGoKart>(GetOwner()), LastMove);
+		}
 	}	
 }
 
+bool UGoKartMovementComponent::IsPlausibleDeltaTime(const FGoKartMove& Move) const
+{
+	//written so a NaN fails too
+	return Move.DeltaTime >= Move.Count * MinMoveDeltaTime && Move.DeltaTime <= Move.Count * MaxMoveDeltaTime;
+}
+
+
+void UGoKartMovementComponent::ResetState()
+{
+	Velocity = FVector::ZeroVector;
+	Force = 0;
+	SteeringCrank = 0;
+	LastMove = FGoKartMove();
+
+	bHasGroundContact = false;
+	GroundNormal = FVector::UpVector;
+	GroundPoint = FVector::ZeroVector;
+	//the next kart may be placed at a different height, and on a client it is synced to a different clock
+	MeasuredRideHeight = -1;
+	DeltaTimeRemainder = 0;
+	ClearContactResponse();
+	ServerClockOffset = 0;
+	bHasServerClockOffset = false;
+}
 
 FGoKartMove UGoKartMovementComponent::CreateMove(float DeltaTime)
 {
 	FGoKartMove Move;
-	Move.DeltaTime = DeltaTime;
-	Move.Force = Force;
-	Move.SteeringCrank = SteeringCrank;
-	Move.Time = GetWorld()->GetGameState()->GetServerWorldTimeSeconds();
+	Move.DeltaTime = QuantizeDeltaTime(DeltaTime);
+	Move.Force = FGoKartMove::QuantizeInput(Force);
+	Move.SteeringCrank = FGoKartMove::QuantizeInput(SteeringCrank);
+	Move.Time = bHasServerClockOffset ? GetWorld()->TimeSeconds + ServerClockOffset : GetWorld()->GetGameState()->GetServerWorldTimeSeconds();
+	SetMoveGround(Move);
+
+	Move.ContactVelocity = PendingContactVelocity;
+	Move.ContactOffset = PendingContactOffset;
+	ClearContactResponse();
 
 	return Move;
 }
 
+float UGoKartMovementComponent::QuantizeDeltaTime(float DeltaTime)
+{
+	//never below one step, and never past the longest frame the server accepts
+	float Steps = FMath::RoundToFloat((DeltaTime + DeltaTimeRemainder) / FGoKartMove::DeltaTimeStep);
+	Steps = FMath::Clamp(Steps, 1.f, FMath::FloorToFloat(MaxMoveDeltaTime / FGoKartMove::DeltaTimeStep));
+	float Quantized = Steps * FGoKartMove::DeltaTimeStep;
+
+	//a hitch longer than the cap is dropped rather than owed to later frames
+	DeltaTimeRemainder = FMath::Clamp(DeltaTime + DeltaTimeRemainder - Quantized, -FGoKartMove::DeltaTimeStep, FGoKartMove::DeltaTimeStep);
+	return Quantized;
+}
+
+void UGoKartMovementComponent::SetMoveGround(FGoKartMove& Move) const
+{
+	Move.bOnGround = bHasGroundContact;
+	if (!bHasGroundContact) return;
+
+	//probe noise would otherwise break every run of merged moves on a slope
+	FVector Normal(FMath::RoundToFloat(GroundNormal.X * 1024), FMath::RoundToFloat(GroundNormal.Y * 1024), FMath::RoundToFloat(GroundNormal.Z * 1024));
+	Move.GroundNormal = Normal.GetSafeNormal(SMALL_NUMBER, FVector::UpVector);
+	//the difference is taken before the dot product, so it doesn't lose the world position's precision
+	float Height = GetRideHeight() - FVector::DotProduct(GetOwner()->GetActorLocation() - GroundPoint, Move.GroundNormal);
+	Move.GroundHeight = FMath::RoundToFloat(Height * 10) / 10;
+}
+
+FGoKartMove UGoKartMovementComponent::CheckGround(const FGoKartMove& Move) const
+{
+	FGoKartMove Probed = Move;
+	SetMoveGround(Probed);
+	if (!Move.bOnGround || !Probed.bOnGround) return Probed;
+
+	float AngleError = FMath::RadiansToDegrees(FMath::Acos(FMath::Clamp(FVector::DotProduct(Move.GroundNormal, Probed.GroundNormal), -1.f, 1.f)));
+	//both heights are measured from the kart, the client's from where it had the kart when it created the move
+	float HeightError = FMath::Abs(Move.GroundHeight - Probed.GroundHeight);
+	if (AngleError > MaxGroundAngleError || HeightError > MaxGroundHeightError) return Probed;
+
+	return Move;
+}
+
+FGoKartMove UGoKartMovementComponent::CheckContact(const FGoKartMove& Move)
+{
+	FGoKartMove Checked = Move;
+	FVector ServerVelocity = PendingContactVelocity;
+	FVector ServerOffset = PendingContactOffset;
+	ClearContactResponse();
+
+	//the client solved against interpolated proxies, so it is only ever close, and never gets a bump the server didn't see
+	bool bAgrees = FVector::Dist(Move.ContactVelocity, ServerVelocity) <= ServerVelocity.Size() * MaxContactError
+		&& FVector::Dist(Move.ContactOffset, ServerOffset) <= ServerOffset.Size() * MaxContactError;
+	if (!bAgrees)
+	{
+		Checked.ContactVelocity = ServerVelocity;
+		Checked.ContactOffset = ServerOffset;
+	}
+	return Checked;
+}
+
+void UGoKartMovementComponent::AddContactResponse(const FVector& VelocityChange, const FVector& Offset)
+{
+	PendingContactVelocity += VelocityChange;
+	PendingContactOffset += Offset;
+}
+
 void UGoKartMovementComponent::SimulateMove(const FGoKartMove& Move)
+{
+	//only frames of the same quantized length are merged, so Count equal steps are exactly the frames the client simulated
+	int32 Steps = FMath::Max<int32>(Move.Count, 1);
+	float StepTime = Move.DeltaTime / Steps;
+	MoveStartLocation = GetOwner()->GetActorLocation();
+
+	if (Move.HasContact())
+	{
+		Velocity += Move.ContactVelocity;
+		GetOwner()->AddActorWorldOffset(Move.ContactOffset);
+	}
+
+	for (int32 Step = 0; Step < Steps; ++Step)
+	{
+		SimulateStep(StepTime, Move);
+	}
+}
+
+void UGoKartMovementComponent::SimulateStep(float DeltaTime, const FGoKartMove& Move)
 {
 	FVector ForceVector = GetOwner()->GetActorForwardVector() * MaxForce * Move.Force;
 
 	ForceVector += GetAirResistance();
 	ForceVector += GetRollingResistance();
+	ForceVector += GetSlopeGravity(Move);
 
 	FVector Acceleration = ForceVector / Mass;
 
-	Velocity = Velocity + (Acceleration * Move.DeltaTime);
+	Velocity = Velocity + (Acceleration * DeltaTime);
 
-	ApplyRotation(Move.DeltaTime, Move.SteeringCrank);
-	UpdateLocationFromVelocity(Move.DeltaTime);
+	ApplyRotation(DeltaTime, Move.SteeringCrank);
+	UpdateLocationFromVelocity(DeltaTime);
+	FollowGround(DeltaTime, Move);
 }
 
 FVector UGoKartMovementComponent::GetAirResistance()
@@ -73,6 +255,53 @@ FVector UGoKartMovementComponent::GetRollingResistance()
 	return -Velocity.GetSafeNormal() * RollingResistanceCoefficient * NormalForce;
 }
 
+FVector UGoKartMovementComponent::GetSlopeGravity(const FGoKartMove& Move)
+{
+	if (!Move.bOnGround) return FVector::ZeroVector;
+
+	//the part of gravity along the ground pulls the kart down hills
+	FVector Gravity(0, 0, GetWorld()->GetGravityZ() / 100);
+	return FVector::VectorPlaneProject(Gravity, Move.GroundNormal) * Mass;
+}
+
+void UGoKartMovementComponent::SetGroundContact(const FVector& Normal, const FVector& Point)
+{
+	GroundNormal = Normal;
+	GroundPoint = Point;
+
+	if (!bHasGroundContact && RideHeight < 0 && MeasuredRideHeight < 0)
+	{
+		MeasuredRideHeight = FVector::DotProduct(GetOwner()->GetActorLocation() - GroundPoint, GroundNormal);
+	}
+	bHasGroundContact = true;
+	GroundContactTime = GetWorld()->TimeSeconds;
+}
+
+void UGoKartMovementComponent::AgeGroundContact()
+{
+	if (bHasGroundContact && GetWorld()->TimeSeconds - GroundContactTime > MaxGroundContactAge)
+	{
+		bHasGroundContact = false;
+	}
+}
+
+void UGoKartMovementComponent::FollowGround(float DeltaTime, const FGoKartMove& Move)
+{
+	if (!Move.bOnGround) return;
+
+	AActor* Owner = GetOwner();
+	FQuat Rotation = Owner->GetActorQuat();
+	FQuat Aligned = FQuat::FindBetweenNormals(Owner->GetActorUpVector(), Move.GroundNormal) * Rotation;
+	FQuat NewRotation = FQuat::Slerp(Rotation, Aligned, FMath::Min(GroundAlignRate * DeltaTime, 1.f));
+
+	//the plane is held relative to where the move started, every merged step rides on the same one
+	float Climb = FVector::DotProduct(Owner->GetActorLocation() - MoveStartLocation, Move.GroundNormal);
+	FVector NewLocation = Owner->GetActorLocation() + Move.GroundNormal * (Move.GroundHeight - Climb);
+
+	Owner->SetActorLocationAndRotation(NewLocation, NewRotation);
+	Velocity = FVector::VectorPlaneProject(Velocity, Move.GroundNormal);
+}
+
 void UGoKartMovementComponent::UpdateLocationFromVelocity(float DeltaTime)
 {
 	FVector Translation = Velocity * 100 * DeltaTime;
@@ -82,7 +311,12 @@ void UGoKartMovementComponent::UpdateLocationFromVelocity(float DeltaTime)
 
 	if (hitResult.IsValidBlockingHit())
 	{
-		Velocity = Velocity * 0;
+		//other karts are handled by the contact solver, which exchanges momentum instead of stopping dead
+		AActor* HitActor = hitResult.GetActor();
+		if (HitActor == nullptr || HitActor->FindComponentByClass<UGoKartMovementComponent>() == nullptr)
+		{
+			Velocity = Velocity * 0;
+		}
 	}
 }
 
@@ -11,20 +11,74 @@ struct FGoKartMove {
 	GENERATED_USTRUCT_BODY()
 		//data values to be able to simulate move from a given state
 	UPROPERTY()
-	float DeltaTime;
+	float DeltaTime = 0;
 
 	UPROPERTY()
-	float Force;
+	float Force = 0;
 
 	UPROPERTY()
-	float SteeringCrank;
+	float SteeringCrank = 0;
 
 	UPROPERTY()
-	float Time;
+	float Time = 0;
+
+	//number of consecutive frames with identical inputs merged into this move, DeltaTime covers all of them
+	UPROPERTY()
+	uint8 Count = 1;
+
+	//ground plane the move is simulated on, carried in the move so the server and the client's replay use the slope the client saw
+	UPROPERTY()
+	bool bOnGround = false;
+
+	UPROPERTY()
+	FVector GroundNormal = FVector::UpVector;
+
+	//distance in cm along GroundNormal the kart's origin has to move from where the move starts to ride on the plane
+	//kept relative to the kart so it stays precise in race instances far from the world origin
+	UPROPERTY()
+	float GroundHeight = 0;
+
+	//velocity change in m/s and push in cm from kart contacts solved since the previous move, applied before this one is simulated
+	//carried in the move so the client's replay applies the same bump instead of losing it to the reconcile
+	UPROPERTY()
+	FVector ContactVelocity = FVector::ZeroVector;
+
+	UPROPERTY()
+	FVector ContactOffset = FVector::ZeroVector;
+
+	bool HasContact() const { return !ContactVelocity.IsZero() || !ContactOffset.IsZero(); }
 
 	bool IsValid() const 
 	{
-		return FMath::Abs(Force) <= 1 && FMath::Abs(SteeringCrank) <= 1;
+		return FMath::Abs(Force) <= 1 && FMath::Abs(SteeringCrank) <= 1 && Count >= 1
+			&& GroundNormal.IsNormalized() && FMath::IsFinite(GroundHeight)
+			&& !ContactVelocity.ContainsNaN() && !ContactOffset.ContainsNaN();
+	}
+
+	//the ground counts as an input, a run of merged frames has to have been simulated on one plane
+	bool HasSameInputs(const FGoKartMove& Other) const
+	{
+		return Force == Other.Force && SteeringCrank == Other.SteeringCrank
+			&& bOnGround == Other.bOnGround && GroundNormal == Other.GroundNormal && GroundHeight == Other.GroundHeight;
+	}
+
+	//length of each of the merged frames, they are all the same
+	float GetFrameTime() const { return DeltaTime / FMath::Max<int32>(Count, 1); }
+
+	//frames only merge when they were simulated with the same inputs and the same frame length, so Count equal steps replay them exactly
+	bool CanMerge(const FGoKartMove& Next) const
+	{
+		//a contact is applied once per move, merging it would apply it once for several frames
+		return HasSameInputs(Next) && GetFrameTime() == Next.DeltaTime && !HasContact() && !Next.HasContact();
+	}
+
+	//frame times are snapped to 1/2048 s, a power of two so merged sums and their split back into frames stay exact in float
+	static constexpr float DeltaTimeStep = 1.f / 2048;
+
+	//inputs are snapped to 8 bit steps so that analog noise doesn't break up runs of identical moves
+	static float QuantizeInput(float Value)
+	{
+		return FMath::RoundToFloat(FMath::Clamp(Value, -1.f, 1.f) * 127) / 127;
 	}
 };
 
@@ -41,29 +95,75 @@ public:
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 	
 	void SimulateMove(const FGoKartMove& Move);
+	//clear motion, inputs, ground contact and clock offset in place so a pooled kart can be reused
+	void ResetState();
 	
 	FGoKartMove GetLastMove() { return LastMove; }
 	FVector GetVelocity() { return Velocity; }
+	float GetMinTurningRadius() const { return MinTurningRadius; }
+	float GetMass() const { return Mass; }
+	float GetMaxForce() const { return MaxForce; }
+	float GetDragCoefficient() const { return DragCoefficient; }
+	float GetRollingResistanceCoefficient() const { return RollingResistanceCoefficient; }
+	float GetContactRadius() const { return ContactRadius; }
+	//a move's time has to fit the number of frames it claims to cover
+	bool IsPlausibleDeltaTime(const FGoKartMove& Move) const;
+	//the move with the client's ground plane if it agrees with this kart's own probes, otherwise with the probed one
+	FGoKartMove CheckGround(const FGoKartMove& Move) const;
+	//the move with the client's contact response if it agrees with the server's own solve, otherwise with the server's, which is used up either way
+	FGoKartMove CheckContact(const FGoKartMove& Move);
+
+	//response from the contact solver, picked up by the next move created or received
+	void AddContactResponse(const FVector& VelocityChange, const FVector& Offset);
+	void ClearContactResponse() { PendingContactVelocity = FVector::ZeroVector; PendingContactOffset = FVector::ZeroVector; }
+	FVector GetPendingContactVelocity() const { return PendingContactVelocity; }
+	FVector GetPendingContactOffset() const { return PendingContactOffset; }
 	
 	void SetVelocity(FVector val) { Velocity = val; }
+	float GetForce() const { return Force; }
+	float GetSteeringCrank() const { return SteeringCrank; }
 	void SetForce(float force) { Force = force; }
 	void SetSteeringCrank(float sc) { SteeringCrank = sc; }
+	void SetServerClockOffset(float Offset) { ServerClockOffset = Offset; bHasServerClockOffset = true; }
+
+	//ground plane under the kart from last tick's suspension probes, picked up by the next move created
+	void SetGroundContact(const FVector& Normal, const FVector& Point);
+	void ClearGroundContact() { bHasGroundContact = false; }
+	//a kart parked in the pool takes no part in the ground probes or the contact solve
+	void SetPooled(bool bPooled);
+	//a probe batch that didn't complete keeps the last plane, until it is older than MaxGroundContactAge
+	void AgeGroundContact();
+	FVector2D GetProbeExtent() const { return ProbeExtent; }
+	float GetProbeLength() const { return ProbeLength; }
 
 
 
 protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	//batched ground probes and contact solve, joined for as long as the kart is in play
+	void JoinSolvers();
+	void LeaveSolvers();
 
 private:
 
 	FVector GetAirResistance();
 	FVector GetRollingResistance();
+	FVector GetSlopeGravity(const FGoKartMove& Move);
 
+	void SimulateStep(float DeltaTime, const FGoKartMove& Move);
 	void UpdateLocationFromVelocity(float DeltaTime);
+	void FollowGround(float DeltaTime, const FGoKartMove& Move);
 	void ApplyRotation(float DeltaTime, float SteeringThrow);
 
 	FGoKartMove CreateMove(float DeltaTime);
+	//snap a frame time to DeltaTimeStep, carrying the rounding into the next frame so simulated time keeps up with real time
+	float QuantizeDeltaTime(float DeltaTime);
+	//write the current ground contact into a move, snapped so that driving over the same plane keeps repeating the same values
+	void SetMoveGround(FGoKartMove& Move) const;
+	float GetRideHeight() const { return RideHeight >= 0 ? RideHeight : MeasuredRideHeight; }
 
 	//The mass of the car in kg
 	UPROPERTY(EditAnywhere)
@@ -80,11 +180,68 @@ private:
 	//amount of drag on the car: higher is more r.resistance
 	UPROPERTY(EditAnywhere)
 	float RollingResistanceCoefficient = 0.015;
+	//radius of the circle used for kart against kart contacts in cm
+	UPROPERTY(EditAnywhere)
+	float ContactRadius = 120;
+	//longest frame in s an owning client may send, a longer hitch is simulated as this long
+	UPROPERTY(EditAnywhere)
+	float MaxMoveDeltaTime = 0.1;
+	//shortest frame in s a move may claim per merged frame, just under one DeltaTimeStep
+	UPROPERTY(EditAnywhere)
+	float MinMoveDeltaTime = 0.00048;
 
 	FGoKartMove LastMove;
 
-	FVector Velocity;
-	float Force;
-	float SteeringCrank;
+	FVector Velocity = FVector::ZeroVector;
+	float Force = 0;
+	float SteeringCrank = 0;
+
+	//align to the terrain using the batched ground probes instead of driving on a flat plane
+	UPROPERTY(EditAnywhere)
+	bool bFollowGround = true;
+	//half length and half width of the probe rectangle in cm
+	UPROPERTY(EditAnywhere)
+	FVector2D ProbeExtent = FVector2D(100, 60);
+	//length of each probe in cm, centred on the kart
+	UPROPERTY(EditAnywhere)
+	float ProbeLength = 300;
+	//height of the kart's origin above the ground in cm, negative keeps the height it was placed at
+	UPROPERTY(EditAnywhere)
+	float RideHeight = -1;
+	//how quickly the kart tilts to match the ground, per second
+	UPROPERTY(EditAnywhere)
+	float GroundAlignRate = 10;
+	//degrees a client's ground normal may differ from the server's probes before the server uses its own
+	UPROPERTY(EditAnywhere)
+	float MaxGroundAngleError = 5;
+	//cm a client's ground height may differ from the server's probes before the server uses its own
+	UPROPERTY(EditAnywhere)
+	float MaxGroundHeightError = 10;
+
+	//contact response waiting for the next move
+	FVector PendingContactVelocity = FVector::ZeroVector;
+	FVector PendingContactOffset = FVector::ZeroVector;
+	//fraction of the server's own contact response the client's may differ by and still be taken
+	UPROPERTY(EditAnywhere)
+	float MaxContactError = 0.25;
 
+	//rounding left over from the last quantized frame time
+	float DeltaTimeRemainder = 0;
+
+	//seconds the last ground plane is kept while probe results are missing
+	UPROPERTY(EditAnywhere)
+	float MaxGroundContactAge = 0.1;
+	float GroundContactTime = 0;
+	//where the move being simulated started, its ground plane is relative to this
+	FVector MoveStartLocation = FVector::ZeroVector;
+
+	//ride height taken on the first ground contact when RideHeight is negative
+	float MeasuredRideHeight = -1;
+	bool bHasGroundContact = false;
+	FVector GroundNormal = FVector::UpVector;
+	FVector GroundPoint = FVector::ZeroVector;
+
+	//offset from the local world clock to the server's, measured by the replicator's clock sync
+	float ServerClockOffset = 0;
+	bool bHasServerClockOffset = false;
 };
@@ -2,8 +2,27 @@
 
 
 #include "GoKartMovementReplicator.h"
+#include "GoKartNetStats.h"
+#include "GoKartTelemetry.h"
+#include "GoKartBandwidth.h"
+#include "GoKartStatePublisher.h"
+#include "GoKartJoinSync.h"
+#include "GoKartLocalPlayers.h"
+#include "GoKartTrust.h"
+#include "GoKartActivity.h"
+#include "GoKartProxyInterpolation.h"
+#include "GoKartAllocations.h"
+#include "KrazyKarts.h"
+#include "GoKart.h"
 #include "GameFramework/GameStateBase.h"
+#include "GameFramework/Pawn.h"
 #include "Net/UnrealNetwork.h"
+#include "Engine/ActorChannel.h"
+#include "Engine/NetConnection.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Dropped Unacknowledged Moves"), STAT_KartDroppedMoves, STATGROUP_KrazyKarts);
+
+constexpr float UGoKartMovementReplicator::MaxRoundTripTime;
 
 // Sets default values for this component's properties
 UGoKartMovementReplicator::UGoKartMovementReplicator()
@@ -21,39 +40,410 @@ void UGoKartMovementReplicator::BeginPlay()
 	Super::BeginPlay();
 
 	MovementComponent = GetOwner()->FindComponentByClass<UGoKartMovementComponent>();
+	Telemetry = GetWorld()->GetSubsystem<UGoKartTelemetrySubsystem>();
+	Bandwidth = GetWorld()->GetSubsystem<UGoKartBandwidthSubsystem>();
+	StatePublisher = GetWorld()->GetSubsystem<UGoKartStatePublisherSubsystem>();
+	LocalPlayers = GetWorld()->GetSubsystem<UGoKartLocalPlayersSubsystem>();
+	Trust = GetWorld()->GetSubsystem<UGoKartTrustSubsystem>();
+	Activity = GetWorld()->GetSubsystem<UGoKartActivitySubsystem>();
+	ProxyInterpolation = GetWorld()->GetSubsystem<UGoKartProxyInterpolationSubsystem>();
+	if (GetOwnerRole() == ROLE_SimulatedProxy)
+	{
+		SetInterpolationBatched(true);
+	}
+
+	//a join snapshot may have arrived before this kart's channel opened
+	UGoKartJoinSyncSubsystem* JoinSync = GetWorld()->GetSubsystem<UGoKartJoinSyncSubsystem>();
+	if (JoinSync != nullptr && GetOwnerRole() == ROLE_SimulatedProxy)
+	{
+		JoinSync->SeedPendingKarts();
+	}
+}
+
+void UGoKartMovementReplicator::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	SetInterpolationBatched(false);
+
+	Super::EndPlay(EndPlayReason);
 }
 
 // Called every frame
 void UGoKartMovementReplicator::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+	LLM_SCOPE_BYTAG(KrazyKarts_Replication);
+	FGoKartAllocationScope AllocationScope;
 
 	if (MovementComponent == nullptr) return;
+
+	//Replay
+	if (bReplayPlayback)
+	{
+		if (!bInterpolationBatched)
+		{
+			ClientTick(DeltaTime);
+		}
+		return;
+	}
 	
 	FGoKartMove LastMove = MovementComponent->GetLastMove();
 	//Client
 	if (GetOwnerRole() == ROLE_AutonomousProxy)
 	{
-		UnacknowledgedMoves.Add(LastMove);
-		Server_SendMove(LastMove);
+		ClockSyncTick(DeltaTime);
+		QueueMove(LastMove);
+		SmoothCorrection(DeltaTime);
 	}
 	//Server
 	if (GetOwner()->GetRemoteRole() == ROLE_SimulatedProxy)
 	{
 		UpdateServerState(LastMove);
 	}
+	if (GetOwnerRole() == ROLE_Authority && Trust != nullptr)
+	{
+		bClientTrusted = Trust->IsEnabled() && GetWorld()->TimeSeconds >= UntrustedUntil;
+	}
 	//Remote Client
-	if (GetOwnerRole() == ROLE_SimulatedProxy)
+	if (GetOwnerRole() == ROLE_SimulatedProxy && !bInterpolationBatched)
 	{
 		ClientTick(DeltaTime);		
 	}
+
+	if (Telemetry != nullptr && Telemetry->IsRecording())
+	{
+		RecordTelemetry();
+	}
+}
+
+void UGoKartMovementReplicator::RecordTelemetry()
+{
+	const FTransform& Transform = GetOwner()->GetActorTransform();
+	const FGoKartMove& Move = MovementComponent->GetLastMove();
+
+	FGoKartTelemetrySample Sample;
+	Sample.Time = GetWorld()->TimeSeconds;
+	Sample.KartId = GetOwner()->GetUniqueID();
+	Sample.Location = Transform.GetLocation();
+	Sample.Rotation = Transform.GetRotation();
+	Sample.Velocity = MovementComponent->GetVelocity();
+	Sample.Force = Move.Force;
+	Sample.SteeringCrank = Move.SteeringCrank;
+	Sample.CorrectionError = LastCorrectionError;
+	Sample.RoundTripTime = ClockSync.RoundTripTime;
+	Telemetry->Record(Sample);
+}
+
+void UGoKartMovementReplicator::ResetState()
+{
+	//Reset rather than Empty keeps the allocations for the kart's next life
+	UnacknowledgedMoves.Reset();
+	DroppedMoves = 0;
+	bHasPendingMove = false;
+	PendingMoveState = FGoKartClientState();
+	bReconcilePending = false;
+
+	//the next owner is on a different connection, its clock and trust are measured from scratch
+	ClockSync = FGoKartClockSync();
+	TimeUntilClockSync = 0;
+	PendingEchoTime = -1;
+	DriftWindowClientTime = -1;
+	DriftWindowServerTime = -1;
+	ClockDriftAllowance = 0;
+	bClientTrusted = false;
+	UntrustedUntil = 0;
+
+	ClientTimeSinceUpdate = 0;
+	ClientTimeBetweenLastUpdates = 0;
+	SmoothedUpdateInterval = 0;
+	bHasServerState = false;
+	CorrectionOffset = FVector::ZeroVector;
+	CorrectionRotationOffset = FQuat::Identity;
+	ClientStartTransform = GetOwner()->GetActorTransform();
+	ClientStartVelocity = FVector::ZeroVector;
+	if (MeshOffsetRoot != nullptr)
+	{
+		MeshOffsetRoot->SetWorldTransform(ClientStartTransform);
+	}
+	PushInterpolation();
+
+	ClientSimulatedTime = 0;
+	ServerTimeAtFirstMove = -1;
+	LastCorrectionError = 0;
+
+	LastProcessedMove = FGoKartMove();
+	ServerState.LastMove = FGoKartMove();
+	ServerState.Transform = GetOwner()->GetActorTransform();
+	ServerState.Velocity = FVector::ZeroVector;
+	ServerStateRevision++;
+	SentServerStateRevisions.Reset();
+}
+
+void UGoKartMovementReplicator::SetReplayPlayback(bool bPlayback)
+{
+	bReplayPlayback = bPlayback;
+	if (MovementComponent != nullptr)
+	{
+		MovementComponent->SetComponentTickEnabled(!bPlayback);
+	}
+	//simulated proxies stay batched either way, a pooled kart on the server only while it plays back
+	if (GetOwnerRole() != ROLE_SimulatedProxy)
+	{
+		SetInterpolationBatched(bPlayback);
+	}
+}
+
+void UGoKartMovementReplicator::ApplyReplayState(const FGoKartState& State, bool bSnap)
+{
+	ServerState = State;
+
+	if (bSnap)
+	{
+		ResetState();
+		ServerState = State;
+		GetOwner()->SetActorTransform(State.Transform);
+		if (MeshOffsetRoot != nullptr)
+		{
+			MeshOffsetRoot->SetWorldTransform(State.Transform);
+		}
+		ClientStartTransform = State.Transform;
+		ClientStartVelocity = State.Velocity;
+		if (MovementComponent != nullptr)
+		{
+			MovementComponent->SetVelocity(State.Velocity);
+		}
+		PushInterpolation();
+		return;
+	}
+	SimulatedProxy_OnRep_ServerState();
+}
+
+void UGoKartMovementReplicator::SeedInterpolation(const FGoKartState& State, float UpdateInterval)
+{
+	if (MovementComponent == nullptr || GetOwnerRole() != ROLE_SimulatedProxy) return;
+
+	if (bHasServerState)
+	{
+		//already holding the first update, interpolate into it from the snapshot
+		ClientStartTransform = State.Transform;
+		ClientStartVelocity = State.Velocity;
+		ClientTimeBetweenLastUpdates = UpdateInterval;
+		ClientTimeSinceUpdate = 0;
+		PushInterpolation();
+		return;
+	}
+
+	//show the snapshot now and treat it as the previous update, so the first real one interpolates straight away
+	GetOwner()->SetActorTransform(State.Transform);
+	if (MeshOffsetRoot != nullptr)
+	{
+		MeshOffsetRoot->SetWorldTransform(State.Transform);
+	}
+	MovementComponent->SetVelocity(State.Velocity);
+	ClientTimeSinceUpdate = UpdateInterval;
+	PushInterpolation();
+}
+
+void UGoKartMovementReplicator::ApplyInterpolation(const FVector& Location, const FQuat& Rotation, const FVector& Velocity)
+{
+	if (MeshOffsetRoot != nullptr)
+	{
+		MeshOffsetRoot->SetWorldLocationAndRotation(Location, Rotation);
+	}
+	if (MovementComponent != nullptr)
+	{
+		MovementComponent->SetVelocity(Velocity);
+	}
+}
+
+void UGoKartMovementReplicator::SetInterpolationBatched(bool bBatched)
+{
+	if (ProxyInterpolation == nullptr || bBatched == bInterpolationBatched) return;
+
+	bInterpolationBatched = bBatched;
+	if (bBatched)
+	{
+		ProxyInterpolation->AddProxy(this);
+		PushInterpolation();
+	}
+	else
+	{
+		//ClientTick carries on from where the batch left off
+		SyncInterpolationTime();
+		ProxyInterpolation->RemoveProxy(this);
+	}
+}
+
+void UGoKartMovementReplicator::SyncInterpolationTime()
+{
+	if (!bInterpolationBatched) return;
+	ClientTimeSinceUpdate = ProxyInterpolation->GetTimeSinceUpdate(this);
+}
+
+void UGoKartMovementReplicator::PushInterpolation()
+{
+	if (!bInterpolationBatched) return;
+	ProxyInterpolation->SetSegment(this, ClientStartTransform, ClientStartVelocity, ServerState.Transform, ServerState.Velocity, ClientTimeBetweenLastUpdates, ClientTimeSinceUpdate);
+}
+
+void UGoKartMovementReplicator::Client_JoinSnapshot_Implementation(const TArray<uint8>& Data)
+{
+	if (Bandwidth != nullptr)
+	{
+		Bandwidth->RecordIncoming(GetOwner(), TEXT("Client_JoinSnapshot"), Data.Num() * 8);
+	}
+
+	UGoKartJoinSyncSubsystem* JoinSync = GetWorld()->GetSubsystem<UGoKartJoinSyncSubsystem>();
+	if (JoinSync == nullptr) return;
+	JoinSync->ReceiveSnapshot(Data);
+}
+
+void UGoKartMovementReplicator::QueueMove(const FGoKartMove& Move)
+{
+	bool bContinuesRun = UnacknowledgedMoves.Num() > 0 && UnacknowledgedMoves.Last().CanMerge(Move);
+
+	//the kart has already simulated Move, so this is the state a trusted client reports for it
+	FGoKartClientState State = bClientTrusted ? GetClientState() : FGoKartClientState();
+
+	if (bContinuesRun && bHasPendingMove)
+	{
+		FGoKartMove& PendingMove = UnacknowledgedMoves.Last();
+		PendingMove.DeltaTime += Move.DeltaTime;
+		PendingMove.Time = Move.Time;
+		PendingMove.Count++;
+		PendingMoveState = State;
+	}
+	else if (bContinuesRun)
+	{
+		//hold on to repeats of the move just sent until the inputs change
+		AddUnacknowledgedMove(Move);
+		bHasPendingMove = true;
+		PendingMoveState = State;
+	}
+	else
+	{
+		//new inputs go out straight away so coalescing never delays a change
+		FlushPendingMove();
+		AddUnacknowledgedMove(Move);
+		SendMove(Move, State);
+	}
+
+	if (bHasPendingMove && UnacknowledgedMoves.Last().Count >= MaxCoalescedMoves)
+	{
+		FlushPendingMove();
+	}
+}
+
+void UGoKartMovementReplicator::AddUnacknowledgedMove(const FGoKartMove& Move)
+{
+	//once per kart, Reset keeps the allocation from then on
+	if (UnacknowledgedMoves.Max() < MaxUnacknowledgedMoves)
+	{
+		UnacknowledgedMoves.Reserve(MaxUnacknowledgedMoves);
+	}
+
+	//a full queue means the server has stopped acknowledging for longer than any connection it would keep, and the oldest move is the least use to a reconcile
+	if (UnacknowledgedMoves.Num() >= MaxUnacknowledgedMoves)
+	{
+		if (DroppedMoves++ == 0)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("%s: no acknowledgement for %d moves, dropping the oldest"), *GetOwner()->GetName(), UnacknowledgedMoves.Num());
+		}
+		INC_DWORD_STAT(STAT_KartDroppedMoves);
+		UnacknowledgedMoves.RemoveAt(0, 1, false);
+	}
+	UnacknowledgedMoves.Add(Move);
+}
+
+void UGoKartMovementReplicator::FlushPendingMove()
+{
+	if (!bHasPendingMove) return;
+
+	bHasPendingMove = false;
+	SendMove(UnacknowledgedMoves.Last(), PendingMoveState);
+}
+
+FGoKartClientState UGoKartMovementReplicator::GetClientState() const
+{
+	FGoKartClientState State;
+	State.Location = GetOwner()->GetActorLocation();
+	State.Rotation = GetOwner()->GetActorRotation();
+	State.Velocity = MovementComponent != nullptr ? MovementComponent->GetVelocity() : FVector::ZeroVector;
+	return State;
+}
+
+void UGoKartMovementReplicator::SendMove(const FGoKartMove& Move, const FGoKartClientState& State)
+{
+	//split screen players share one RPC per frame
+	if (LocalPlayers != nullptr && LocalPlayers->IsBundling())
+	{
+		LocalPlayers->BundleMove(Cast<AGoKart>(GetOwner()), Move);
+		return;
+	}
+
+	if (bClientTrusted)
+	{
+		if (Bandwidth != nullptr)
+		{
+			Bandwidth->RecordOutgoing(GetOwner(), TEXT("Server_SendTrustedMove"), FGoKartMove::StaticStruct(), &Move);
+			Bandwidth->RecordOutgoing(GetOwner(), TEXT("Server_SendTrustedMove"), FGoKartClientState::StaticStruct(), &State);
+		}
+		Server_SendTrustedMove(Move, State);
+		return;
+	}
+
+	if (Bandwidth != nullptr)
+	{
+		Bandwidth->RecordOutgoing(GetOwner(), TEXT("Server_SendMove"), FGoKartMove::StaticStruct(), &Move);
+	}
+	Server_SendMove(Move);
 }
 
 void UGoKartMovementReplicator::UpdateServerState(const FGoKartMove& Move)
 {
-	ServerState.LastMove = Move;
+	//only remember the move here, the publisher writes ServerState once per tick
+	LastProcessedMove = Move;
+	if (StatePublisher != nullptr)
+	{
+		StatePublisher->MarkDirty(this);
+	}
+	else
+	{
+		PublishServerState();
+	}
+}
+
+void UGoKartMovementReplicator::PublishServerState()
+{
+	if (MovementComponent == nullptr) return;
+
+	ServerState.LastMove = LastProcessedMove;
 	ServerState.Transform = GetOwner()->GetActorTransform();
 	ServerState.Velocity = MovementComponent->GetVelocity();
+	ServerStateRevision++;
+	LastPublishTime = GetWorld()->TimeSeconds;
+}
+
+bool UGoKartMovementReplicator::IsPlayerControlled() const
+{
+	const APawn* Pawn = Cast<APawn>(GetOwner());
+	return Pawn != nullptr && Pawn->IsPlayerControlled();
+}
+
+bool UGoKartMovementReplicator::ReplicateSubobjects(UActorChannel* Channel, FOutBunch* Bunch, FReplicationFlags* RepFlags)
+{
+	bool bWroteSomething = Super::ReplicateSubobjects(Channel, Bunch, RepFlags);
+
+	//called for every connection the kart is replicated to, so each copy of ServerState is counted against the connection it went to
+	UNetConnection* Connection = Channel != nullptr ? Channel->Connection : nullptr;
+	if (Bandwidth == nullptr || Connection == nullptr) return bWroteSomething;
+
+	uint32& SentRevision = SentServerStateRevisions.FindOrAdd(Connection, 0);
+	if (SentRevision != ServerStateRevision)
+	{
+		SentRevision = ServerStateRevision;
+		Bandwidth->RecordOutgoing(GetOwner(), Connection, TEXT("ServerState"), FGoKartState::StaticStruct(), &ServerState);
+	}
+	return bWroteSomething;
 }
 
 void UGoKartMovementReplicator::ClientTick(float DeltaTime)
@@ -111,10 +501,19 @@ void UGoKartMovementReplicator::GetLifetimeReplicatedProps(TArray <FLifetimeProp
 {
 	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
 	DOREPLIFETIME(UGoKartMovementReplicator, ServerState);
+	DOREPLIFETIME_CONDITION(UGoKartMovementReplicator, bClientTrusted, COND_OwnerOnly);
 }
 
 void UGoKartMovementReplicator::OnRep_ServerState()
 {
+	LLM_SCOPE_BYTAG(KrazyKarts_Replication);
+	FGoKartAllocationScope AllocationScope;
+
+	if (Bandwidth != nullptr)
+	{
+		Bandwidth->RecordIncoming(GetOwner(), TEXT("ServerState"), FGoKartState::StaticStruct(), &ServerState);
+	}
+
 	switch (GetOwnerRole()) {
 		case ROLE_AutonomousProxy:
 			AutonomousProxy_OnRep_ServerState();
@@ -131,6 +530,28 @@ void UGoKartMovementReplicator::AutonomousProxy_OnRep_ServerState()
 {
 	if (MovementComponent == nullptr) return;
 
+	//split screen karts reconcile together once per frame, and only against their newest state
+	if (!bReconcilePending)
+	{
+		PredictedLocation = GetOwner()->GetActorLocation();
+	}
+	if (LocalPlayers != nullptr && LocalPlayers->IsBundling())
+	{
+		bReconcilePending = true;
+		LocalPlayers->MarkReconcile(this);
+		return;
+	}
+	Reconcile();
+}
+
+void UGoKartMovementReplicator::Reconcile()
+{
+	if (MovementComponent == nullptr) return;
+	bReconcilePending = false;
+
+	//what the player sees before the correction, including whatever is left of the previous one
+	FTransform VisualTransform = MeshOffsetRoot != nullptr ? MeshOffsetRoot->GetComponentTransform() : GetOwner()->GetActorTransform();
+
 	GetOwner()->SetActorTransform(ServerState.Transform);
 	MovementComponent->SetVelocity(ServerState.Velocity);
 
@@ -140,15 +561,82 @@ void UGoKartMovementReplicator::AutonomousProxy_OnRep_ServerState()
 	{
 		MovementComponent->SimulateMove(Move);
 	}
+	StartCorrectionSmoothing(VisualTransform);
+
+	UGoKartNetStatsSubsystem* NetStats = GetWorld()->GetSubsystem<UGoKartNetStatsSubsystem>();
+	AGameStateBase* GameState = GetWorld()->GetGameState();
+	LastCorrectionError = FVector::Dist(PredictedLocation, GetOwner()->GetActorLocation());
+	if (NetStats != nullptr)
+	{
+		NetStats->RecordCorrection(LastCorrectionError);
+		if (ClockSync.IsSynced())
+		{
+			NetStats->RecordAckLatency(ClockSync.ToServerTime(GetWorld()->TimeSeconds) - ServerState.LastMove.Time);
+		}
+		else if (GameState != nullptr)
+		{
+			NetStats->RecordAckLatency(GameState->GetServerWorldTimeSeconds() - ServerState.LastMove.Time);
+		}
+	}
+}
+
+
+void UGoKartMovementReplicator::StartCorrectionSmoothing(const FTransform& VisualTransform)
+{
+	if (MeshOffsetRoot == nullptr) return;
+
+	//the collision root has already snapped, the mesh is put back where it was and carries the error instead
+	const FTransform& ActorTransform = GetOwner()->GetActorTransform();
+	CorrectionOffset = VisualTransform.GetLocation() - ActorTransform.GetLocation();
+	CorrectionRotationOffset = VisualTransform.GetRotation() * ActorTransform.GetRotation().Inverse();
+
+	if (CorrectionSmoothingTime <= 0 || CorrectionOffset.Size() > MaxSmoothedCorrection)
+	{
+		CorrectionOffset = FVector::ZeroVector;
+		CorrectionRotationOffset = FQuat::Identity;
+	}
+	ApplyCorrectionOffset();
+}
+
+void UGoKartMovementReplicator::SmoothCorrection(float DeltaTime)
+{
+	if (MeshOffsetRoot == nullptr) return;
+	if (CorrectionOffset.IsZero() && CorrectionRotationOffset.Equals(FQuat::Identity, 0)) return;
+
+	//exponential, so a correction landing on top of an unfinished one simply adds to what is left
+	float Decay = FMath::Exp(-DeltaTime / FMath::Max(CorrectionSmoothingTime, KINDA_SMALL_NUMBER));
+	CorrectionOffset *= Decay;
+	CorrectionRotationOffset = FQuat::Slerp(FQuat::Identity, CorrectionRotationOffset, Decay);
+
+	if (CorrectionOffset.SizeSquared() < 0.01f && CorrectionRotationOffset.AngularDistance(FQuat::Identity) < 0.001f)
+	{
+		CorrectionOffset = FVector::ZeroVector;
+		CorrectionRotationOffset = FQuat::Identity;
+	}
+	ApplyCorrectionOffset();
 }
 
+void UGoKartMovementReplicator::ApplyCorrectionOffset()
+{
+	//relative to the kart, so the mesh follows this frame's movement whichever component ticks first
+	FQuat ActorRotation = GetOwner()->GetActorQuat();
+	MeshOffsetRoot->SetRelativeLocationAndRotation(ActorRotation.UnrotateVector(CorrectionOffset), ActorRotation.Inverse() * CorrectionRotationOffset * ActorRotation);
+}
 
 void UGoKartMovementReplicator::SimulatedProxy_OnRep_ServerState() 
 {
 	if (MovementComponent == nullptr) return;
 	
-	ClientTimeBetweenLastUpdates = ClientTimeSinceUpdate;
+	SyncInterpolationTime();
+	UpdateInterpolationTime(ClientTimeSinceUpdate);
 	ClientTimeSinceUpdate = 0;
+	bHasServerState = true;
+
+	UGoKartNetStatsSubsystem* NetStats = GetWorld()->GetSubsystem<UGoKartNetStatsSubsystem>();
+	if (NetStats != nullptr && MeshOffsetRoot != nullptr)
+	{
+		NetStats->RecordRemoteError(FVector::Dist(MeshOffsetRoot->GetComponentLocation(), ServerState.Transform.GetLocation()));
+	}
 
 	if (MeshOffsetRoot != nullptr) 
 	{
@@ -158,41 +646,209 @@ void UGoKartMovementReplicator::SimulatedProxy_OnRep_ServerState()
 	ClientStartVelocity = MovementComponent->GetVelocity();
 
 	GetOwner()->SetActorTransform(ServerState.Transform);
+	PushInterpolation();
+}
+
+
+void UGoKartMovementReplicator::UpdateInterpolationTime(float UpdateGap)
+{
+	//the first gap is measured from spawn or a join snapshot, not between two updates
+	if (!bHasServerState)
+	{
+		ClientTimeBetweenLastUpdates = UpdateGap;
+		return;
+	}
+
+	//a single late or early update no longer stretches or squeezes the next segment, the jitter margin absorbs it instead
+	SmoothedUpdateInterval = SmoothedUpdateInterval > 0 ? SmoothedUpdateInterval + (UpdateGap - SmoothedUpdateInterval) * 0.25f : UpdateGap;
+	float Jitter = ProxyInterpolation != nullptr ? ProxyInterpolation->GetConnectionJitter() : 0;
+	ClientTimeBetweenLastUpdates = SmoothedUpdateInterval + Jitter * InterpolationJitterMargin;
+}
+
+void UGoKartMovementReplicator::ClearAcknowledgedMoves(const FGoKartMove& LastMove)
+{
+	//in place, RemoveAll keeps the allocation
+	UnacknowledgedMoves.RemoveAll([&LastMove](const FGoKartMove& Move)
+	{
+		return Move.Time <= LastMove.Time;
+	});
+
+	if (DroppedMoves > 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s: acknowledgements resumed after %d dropped moves"), *GetOwner()->GetName(), DroppedMoves);
+		DroppedMoves = 0;
+	}
 
+	if (UnacknowledgedMoves.Num() == 0)
+	{
+		bHasPendingMove = false;
+	}
 }
 
 
-void UGoKartMovementReplicator::ClearAcknowledgedMoves(FGoKartMove LastMove)
+void UGoKartMovementReplicator::Server_SendMove_Implementation(FGoKartMove Move)
 {
-	TArray<FGoKartMove> NewMoves;
+	LLM_SCOPE_BYTAG(KrazyKarts_Replication);
+	FGoKartAllocationScope AllocationScope;
 
-	for (const FGoKartMove& Move : UnacknowledgedMoves)
+	if (Bandwidth != nullptr)
+	{
+		Bandwidth->RecordIncoming(GetOwner(), TEXT("Server_SendMove"), FGoKartMove::StaticStruct(), &Move);
+	}
+	ReceiveMove(Move);
+}
+
+bool UGoKartMovementReplicator::Server_SendMove_Validate(FGoKartMove Move)
+{
+	return IsMoveAcceptable(Move);
+}
+
+void UGoKartMovementReplicator::Server_SendMoveBundle_Implementation(const TArray<FGoKartBundledMove>& Moves)
+{
+	LLM_SCOPE_BYTAG(KrazyKarts_Replication);
+	FGoKartAllocationScope AllocationScope;
+
+	for (const FGoKartBundledMove& Bundled : Moves)
 	{
-		if (Move.Time > LastMove.Time)
+		//a split screen player that just left or respawned can still have a move in flight, that one is simply dropped
+		UGoKartMovementReplicator* KartReplicator = GetBundledReplicator(Bundled);
+		if (KartReplicator == nullptr) continue;
+
+		if (Bandwidth != nullptr)
 		{
-			NewMoves.Add(Move);
+			Bandwidth->RecordIncoming(Bundled.Kart, TEXT("Server_SendMoveBundle"), FGoKartMove::StaticStruct(), &Bundled.Move);
 		}
+		KartReplicator->ReceiveMove(Bundled.Move);
 	}
-	UnacknowledgedMoves = NewMoves;
 }
 
+bool UGoKartMovementReplicator::Server_SendMoveBundle_Validate(const TArray<FGoKartBundledMove>& Moves)
+{
+	//a kart can have several moves in one bundle, each has to fit on top of the ones before it
+	TMap<UGoKartMovementReplicator*, float, TInlineSetAllocator<4>> BundledTime;
+	for (const FGoKartBundledMove& Bundled : Moves)
+	{
+		UGoKartMovementReplicator* KartReplicator = GetBundledReplicator(Bundled);
+		if (KartReplicator == nullptr) continue;
 
-void UGoKartMovementReplicator::Server_SendMove_Implementation(FGoKartMove Move)
+		float& PendingTime = BundledTime.FindOrAdd(KartReplicator, 0);
+		if (!KartReplicator->IsMoveAcceptable(Bundled.Move, PendingTime)) return false;
+		PendingTime += KartReplicator->GetCountedTime(Bundled.Move);
+	}
+	return true;
+}
+
+UGoKartMovementReplicator* UGoKartMovementReplicator::GetBundledReplicator(const FGoKartBundledMove& Bundled) const
+{
+	//only karts driven from the sender's own machine
+	UGoKartMovementReplicator* KartReplicator = Bundled.Kart != nullptr ? Bundled.Kart->FindComponentByClass<UGoKartMovementReplicator>() : nullptr;
+	UNetConnection* Connection = UGoKartLocalPlayersSubsystem::GetRootConnection(GetOwner());
+	if (KartReplicator == nullptr || Connection == nullptr || UGoKartLocalPlayersSubsystem::GetRootConnection(Bundled.Kart) != Connection) return nullptr;
+	return KartReplicator;
+}
+
+void UGoKartMovementReplicator::Server_SendTrustedMove_Implementation(FGoKartMove Move, FGoKartClientState State)
 {
+	LLM_SCOPE_BYTAG(KrazyKarts_Replication);
+	FGoKartAllocationScope AllocationScope;
+
+	if (Bandwidth != nullptr)
+	{
+		Bandwidth->RecordIncoming(GetOwner(), TEXT("Server_SendTrustedMove"), FGoKartMove::StaticStruct(), &Move);
+		Bandwidth->RecordIncoming(GetOwner(), TEXT("Server_SendTrustedMove"), FGoKartClientState::StaticStruct(), &State);
+	}
+
+	//the client may not have heard yet that it lost trust or that the mode was switched off
+	if (Trust == nullptr || !bClientTrusted)
+	{
+		ReceiveMove(Move);
+		return;
+	}
 	if (MovementComponent == nullptr) return;
 
-	ClientSimulatedTime += Move.DeltaTime;
+	AdvanceClientTime(Move);
+	Trust->QueueCheck(this, Move, State);
+}
+
+bool UGoKartMovementReplicator::Server_SendTrustedMove_Validate(FGoKartMove Move, FGoKartClientState State)
+{
+	return IsMoveAcceptable(Move) && !State.Location.ContainsNaN() && !State.Velocity.ContainsNaN() && !State.Rotation.ContainsNaN();
+}
+
+void UGoKartMovementReplicator::AcceptClientState(const FGoKartMove& Move, const FGoKartClientState& State)
+{
+	if (MovementComponent == nullptr) return;
 
-	MovementComponent->SimulateMove(Move);
+	GetOwner()->SetActorLocationAndRotation(State.Location, State.Rotation);
+	MovementComponent->SetVelocity(State.Velocity);
+	//the trusted state already has the client's bumps in it
+	MovementComponent->ClearContactResponse();
 	UpdateServerState(Move);
 }
 
+void UGoKartMovementReplicator::RejectClientState(const FGoKartMove& Move, float PenaltySeconds)
+{
+	if (MovementComponent == nullptr) return;
+
+	//the authoritative result goes back in ServerState and corrects the client
+	UntrustedUntil = GetWorld()->TimeSeconds + PenaltySeconds;
+	bClientTrusted = false;
+	FGoKartMove Checked = MovementComponent->CheckContact(MovementComponent->CheckGround(Move));
+	MovementComponent->SimulateMove(Checked);
+	UpdateServerState(Checked);
+}
+
+void UGoKartMovementReplicator::AdvanceClientTime(const FGoKartMove& Move)
+{
+	//every received move passes through here, trusted or simulated
+	if (Activity != nullptr)
+	{
+		Activity->NoteMove(Cast<AGoKart>(GetOwner()), Move);
+	}
 
-bool UGoKartMovementReplicator::Server_SendMove_Validate(FGoKartMove Move)
+	if (ServerTimeAtFirstMove < 0)
+	{
+		ServerTimeAtFirstMove = GetWorld()->TimeSeconds;
+	}
+	ClientSimulatedTime += GetCountedTime(Move);
+}
+
+float UGoKartMovementReplicator::GetCountedTime(const FGoKartMove& Move) const
+{
+	//forgive only as much drift as the client's clock has been measured to have
+	return Move.DeltaTime * (1 - ClockDriftAllowance);
+}
+
+void UGoKartMovementReplicator::ReceiveMove(const FGoKartMove& Move)
+{
+	if (MovementComponent == nullptr) return;
+
+	AdvanceClientTime(Move);
+	//the client's ground plane and bumps are only taken where the server's own probes and contacts roughly agree with them
+	FGoKartMove Checked = MovementComponent->CheckContact(MovementComponent->CheckGround(Move));
+	MovementComponent->SimulateMove(Checked);
+	UpdateServerState(Checked);
+}
+
+
+bool UGoKartMovementReplicator::IsMoveAcceptable(const FGoKartMove& Move, float PendingTime) const
 {
-	float ProposedTime = ClientSimulatedTime + Move.DeltaTime;
+	//every merged frame is a swept step on the server, so a move may not claim more than the client is allowed to merge
+	if (Move.Count > MaxCoalescedMoves)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Received move merging too many frames"));
+		return false;
+	}
+	if (MovementComponent != nullptr && !MovementComponent->IsPlausibleDeltaTime(Move))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Received move with implausible delta time"));
+		return false;
+	}
+
+	float ProposedTime = ClientSimulatedTime + PendingTime + Move.DeltaTime;
+	float ServerElapsedTime = ServerTimeAtFirstMove < 0 ? 0 : GetWorld()->TimeSeconds - ServerTimeAtFirstMove;
 
-	if (ProposedTime >= GetWorld()->TimeSeconds)
+	if (ProposedTime > ServerElapsedTime + GetClientTimeTolerance())
 	{
 		UE_LOG(LogTemp, Error, TEXT("Client running too fast"));
 		return false;
@@ -206,3 +862,102 @@ bool UGoKartMovementReplicator::Server_SendMove_Validate(FGoKartMove Move)
 	return true;
 }
 
+float UGoKartMovementReplicator::GetClientTimeTolerance() const
+{
+	//moves bunch up on the wire by about the connection's jitter, so allow for a few deviations of the jitter the server measured itself
+	return MaxClientTimeAhead + FMath::Min(ClockSync.Jitter, MaxToleratedJitter) * 4;
+}
+
+void UGoKartMovementReplicator::ClockSyncTick(float DeltaTime)
+{
+	TimeUntilClockSync -= DeltaTime;
+	if (TimeUntilClockSync > 0) return;
+
+	//ping quickly until the filter has settled
+	TimeUntilClockSync = ClockSync.NumSamples < 4 ? ClockSyncInterval / 5 : ClockSyncInterval;
+	if (Bandwidth != nullptr)
+	{
+		Bandwidth->RecordOutgoing(GetOwner(), TEXT("Server_ClockPing"), 32);
+	}
+	Server_ClockPing(GetWorld()->TimeSeconds);
+}
+
+void UGoKartMovementReplicator::Server_ClockPing_Implementation(float ClientTime)
+{
+	float ServerTime = GetWorld()->TimeSeconds;
+	if (Bandwidth != nullptr)
+	{
+		Bandwidth->RecordIncoming(GetOwner(), TEXT("Server_ClockPing"), 32);
+		Bandwidth->RecordOutgoing(GetOwner(), TEXT("Client_ClockPong"), 2 * 32);
+	}
+	if (!FMath::IsFinite(ClientTime)) return;
+
+	MeasureClockDrift(ClientTime);
+	PendingEchoTime = ServerTime;
+	Client_ClockPong(ClientTime, ServerTime);
+}
+
+void UGoKartMovementReplicator::Server_ClockEcho_Implementation(float ServerTime)
+{
+	if (Bandwidth != nullptr)
+	{
+		Bandwidth->RecordIncoming(GetOwner(), TEXT("Server_ClockEcho"), 32);
+	}
+
+	//only the latest pong counts and only once, so a client can't replay old times to stretch its round trip
+	if (ServerTime != PendingEchoTime) return;
+	PendingEchoTime = -1;
+
+	//both ends of the sample are the server's own clock, nothing the client reports goes into the tolerance
+	ClockSync.AddSample(ServerTime, ServerTime, GetWorld()->TimeSeconds);
+	ClockSync.RoundTripTime = FMath::Min(ClockSync.RoundTripTime, MaxRoundTripTime);
+}
+
+void UGoKartMovementReplicator::MeasureClockDrift(float ClientTime)
+{
+	float ServerTime = GetWorld()->TimeSeconds;
+	if (DriftWindowServerTime < 0 || ClientTime < DriftWindowClientTime)
+	{
+		DriftWindowClientTime = ClientTime;
+		DriftWindowServerTime = ServerTime;
+		return;
+	}
+
+	float ServerElapsed = ServerTime - DriftWindowServerTime;
+	if (ServerElapsed < ClockDriftWindow) return;
+
+	//the pings' own delay varies by about the jitter, so only drift beyond that is the clock's
+	float ClientElapsed = ClientTime - DriftWindowClientTime;
+	float Drift = (ClientElapsed - ServerElapsed - 2 * ClockSync.Jitter) / ServerElapsed;
+	ClockDriftAllowance = FMath::Clamp(Drift, 0.f, MaxClockDrift);
+
+	DriftWindowClientTime = ClientTime;
+	DriftWindowServerTime = ServerTime;
+}
+
+void UGoKartMovementReplicator::Client_ClockPong_Implementation(float ClientTime, float ServerTime)
+{
+	ClockSync.AddSample(ClientTime, ServerTime, GetWorld()->TimeSeconds);
+
+	if (Bandwidth != nullptr)
+	{
+		Bandwidth->RecordIncoming(GetOwner(), TEXT("Client_ClockPong"), 2 * 32);
+		Bandwidth->RecordOutgoing(GetOwner(), TEXT("Server_ClockEcho"), 32);
+	}
+	Server_ClockEcho(ServerTime);
+
+	if (MovementComponent != nullptr)
+	{
+		MovementComponent->SetServerClockOffset(ClockSync.ClockOffset);
+	}
+	if (ProxyInterpolation != nullptr)
+	{
+		ProxyInterpolation->SetConnectionJitter(ClockSync.Jitter);
+	}
+
+	UGoKartNetStatsSubsystem* NetStats = GetWorld()->GetSubsystem<UGoKartNetStatsSubsystem>();
+	if (NetStats != nullptr)
+	{
+		NetStats->RecordConnectionClock(ClockSync.RoundTripTime, ClockSync.Jitter, ClockSync.ClockOffset);
+	}
+}
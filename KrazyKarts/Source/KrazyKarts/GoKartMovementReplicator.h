@@ -22,6 +22,33 @@ struct FGoKartState
 	FTransform Transform;
 };
 
+USTRUCT()
+struct FGoKartBundledMove
+{
+	GENERATED_USTRUCT_BODY()
+	//one local player's move inside a split screen input bundle
+	UPROPERTY()
+	class AGoKart* Kart = nullptr;
+
+	UPROPERTY()
+	FGoKartMove Move;
+};
+
+USTRUCT()
+struct FGoKartClientState
+{
+	GENERATED_USTRUCT_BODY()
+	//where a trusted client's own simulation left the kart after a move
+	UPROPERTY()
+	FVector_NetQuantize10 Location;
+
+	UPROPERTY()
+	FRotator Rotation;
+
+	UPROPERTY()
+	FVector_NetQuantize100 Velocity;
+};
+
 struct FHermiteCubicSpline 
 {
 	FVector StartLocation;
@@ -46,6 +73,42 @@ struct FHermiteCubicSpline
 	}
 };
 
+struct FGoKartClockSync
+{
+	//smoothed round trip time in seconds
+	float RoundTripTime = 0;
+	//smoothed deviation of the round trip samples in seconds
+	float Jitter = 0;
+	//add to local world time to get server world time
+	float ClockOffset = 0;
+	int32 NumSamples = 0;
+
+	//filter one ping exchange into the estimates, times are in seconds of the sender's world clock
+	void AddSample(float ClientSendTime, float ServerTime, float ClientReceiveTime)
+	{
+		float SampleRoundTrip = FMath::Max(ClientReceiveTime - ClientSendTime, 0.f);
+		float SampleOffset = ServerTime + SampleRoundTrip / 2 - ClientReceiveTime;
+
+		if (NumSamples++ == 0)
+		{
+			RoundTripTime = SampleRoundTrip;
+			Jitter = SampleRoundTrip / 2;
+			ClockOffset = SampleOffset;
+			return;
+		}
+		//same gains as TCP's SRTT/RTTVAR estimator
+		Jitter += (FMath::Abs(SampleRoundTrip - RoundTripTime) - Jitter) * 0.25f;
+		RoundTripTime += (SampleRoundTrip - RoundTripTime) * 0.125f;
+
+		//slow round trips are more likely to be asymmetric, so they barely move the offset
+		float OffsetGain = SampleRoundTrip <= RoundTripTime + Jitter ? 0.25f : 0.02f;
+		ClockOffset += (SampleOffset - ClockOffset) * OffsetGain;
+	}
+
+	bool IsSynced() const { return NumSamples > 0; }
+	float ToServerTime(float LocalTime) const { return LocalTime + ClockOffset; }
+};
+
 UCLASS(ClassGroup = (Custom), meta = (BlueprintSpawnableComponent))
 class KRAZYKARTS_API UGoKartMovementReplicator : public UActorComponent
 {
@@ -56,15 +119,85 @@ public:
 	UGoKartMovementReplicator();
 	// Called every frame
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+	virtual bool ReplicateSubobjects(class UActorChannel* Channel, class FOutBunch* Bunch, FReplicationFlags* RepFlags) override;
+
+	//clear move queues, interpolation, clock sync, trust and server state in place so a pooled kart can be reused
+	void ResetState();
+
+	//copy the kart's current transform, velocity and last processed move into ServerState, called by the state publisher
+	void PublishServerState();
+	float GetLastPublishTime() const { return LastPublishTime; }
+	bool IsQueuedForPublish() const { return bQueuedForPublish; }
+	void SetQueuedForPublish(bool bQueued) { bQueuedForPublish = bQueued; }
+	bool IsPlayerControlled() const;
+
+	const FGoKartState& GetServerState() const { return ServerState; }
+
+	//drive the kart from replay or spectator snapshot states through the simulated proxy interpolation instead of simulating it
+	void SetReplayPlayback(bool bPlayback);
+	bool IsReplayPlayback() const { return bReplayPlayback; }
+	//feed one snapshot state, interpolated towards like a server update or snapped to when seeking
+	void ApplyReplayState(const FGoKartState& State, bool bSnap);
+
+	//start a simulated proxy's interpolation from a join snapshot state instead of waiting for two server updates
+	void SeedInterpolation(const FGoKartState& State, float UpdateInterval);
+	//write one frame of the batched proxy interpolation back onto the kart
+	void ApplyInterpolation(const FVector& Location, const FQuat& Rotation, const FVector& Velocity);
+
+	//compressed state of every other kart in the race, sent once to a player joining mid-race
+	UFUNCTION(Client, Reliable)
+	void Client_JoinSnapshot(const TArray<uint8>& Data);
+
+	//every split screen player's moves for this frame in one RPC, sent through the first local player's kart
+	UFUNCTION(Server, Reliable, WithValidation)
+	void Server_SendMoveBundle(const TArray<FGoKartBundledMove>& Moves);
+
+	//trusted mode: take the client's resulting state after the envelope check passed, or simulate the move after it failed
+	void AcceptClientState(const FGoKartMove& Move, const FGoKartClientState& State);
+	void RejectClientState(const FGoKartMove& Move, float PenaltySeconds);
+
+	//replay unacknowledged moves on top of the last ServerState, deferred to the local players pass when split screen
+	void Reconcile();
+
+	//round trip, jitter and clock offset of the owning connection, measured by whichever side this is
+	float GetRoundTripTime() const { return ClockSync.RoundTripTime; }
+	float GetJitter() const { return ClockSync.Jitter; }
+	float GetClockOffset() const { return ClockSync.ClockOffset; }
 
 protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 private:
-	void ClearAcknowledgedMoves(FGoKartMove LastMove);
+	void ClearAcknowledgedMoves(const FGoKartMove& LastMove);
+	void AddUnacknowledgedMove(const FGoKartMove& Move);
+	void QueueMove(const FGoKartMove& Move);
+	void SendMove(const FGoKartMove& Move, const FGoKartClientState& State);
+	void FlushPendingMove();
+	//PendingTime is counted time of earlier moves that have been validated but not received yet, such as the rest of a bundle
+	bool IsMoveAcceptable(const FGoKartMove& Move, float PendingTime = 0) const;
+	void AdvanceClientTime(const FGoKartMove& Move);
+	//time a move adds to the client's simulated time
+	float GetCountedTime(const FGoKartMove& Move) const;
+	//the bundled kart's replicator if the bundle's sender drives it, nullptr otherwise
+	UGoKartMovementReplicator* GetBundledReplicator(const FGoKartBundledMove& Bundled) const;
+	void ReceiveMove(const FGoKartMove& Move);
+	FGoKartClientState GetClientState() const;
 	void UpdateServerState(const FGoKartMove& Move);
 	void ClientTick(float DeltaTime);
+	void RecordTelemetry();
+	//move this proxy in or out of the batched interpolation pass
+	void SetInterpolationBatched(bool bBatched);
+	//the batched pass owns the time since the last update while it interpolates this kart
+	void SyncInterpolationTime();
+	void PushInterpolation();
+	//size the next segment from the smoothed update interval and the connection's jitter
+	void UpdateInterpolationTime(float UpdateGap);
+	//the owning client's mesh keeps showing where the kart was before a correction and eases onto the corrected kart
+	void StartCorrectionSmoothing(const FTransform& VisualTransform);
+	void SmoothCorrection(float DeltaTime);
+	void ApplyCorrectionOffset();
 
 	FHermiteCubicSpline CreateSpline(float VelocityToDerivative);
 	void InterpolateLocation(const FHermiteCubicSpline &Spline, float LerpRatio);
@@ -75,6 +208,25 @@ private:
 	UFUNCTION(Server, Reliable, WithValidation)
 	void Server_SendMove(FGoKartMove Move);
 
+	UFUNCTION(Server, Reliable, WithValidation)
+	void Server_SendTrustedMove(FGoKartMove Move, FGoKartClientState State);
+
+	void ClockSyncTick(float DeltaTime);
+	float GetClientTimeTolerance() const;
+
+	UFUNCTION(Server, Unreliable)
+	void Server_ClockPing(float ClientTime);
+
+	UFUNCTION(Client, Unreliable)
+	void Client_ClockPong(float ClientTime, float ServerTime);
+
+	//the client hands the server's pong time straight back, so the server times the round trip on its own clock
+	UFUNCTION(Server, Unreliable)
+	void Server_ClockEcho(float ServerTime);
+
+	//compare the client's clock with the server's across a window of pings
+	void MeasureClockDrift(float ClientTime);
+
 	UFUNCTION()
 	void OnRep_ServerState();
 	void AutonomousProxy_OnRep_ServerState();
@@ -87,16 +239,128 @@ private:
 	UPROPERTY()
 	UGoKartMovementComponent* MovementComponent;
 
-	//list of unacknowledged moves
+	UPROPERTY()
+	class UGoKartTelemetrySubsystem* Telemetry;
+
+	UPROPERTY()
+	class UGoKartBandwidthSubsystem* Bandwidth;
+
+	UPROPERTY()
+	class UGoKartStatePublisherSubsystem* StatePublisher;
+
+	UPROPERTY()
+	class UGoKartLocalPlayersSubsystem* LocalPlayers;
+
+	UPROPERTY()
+	class UGoKartTrustSubsystem* Trust;
+
+	UPROPERTY()
+	class UGoKartActivitySubsystem* Activity;
+
+	UPROPERTY()
+	class UGoKartProxyInterpolationSubsystem* ProxyInterpolation;
+
+	//the server checks this client's own simulation instead of repeating it, only replicated to the owner
+	UPROPERTY(Replicated)
+	bool bClientTrusted = false;
+	//server time until which a client that failed a check is simulated in full again
+	float UntrustedUntil = 0;
+	//client state after the move that is still collecting coalesced frames
+	FGoKartClientState PendingMoveState;
+
+	//bumped whenever ServerState changes, each connection remembers the one it was last sent so its copy is counted once
+	uint32 ServerStateRevision = 0;
+	TMap<TWeakObjectPtr<class UNetConnection>, uint32> SentServerStateRevisions;
+
+	//latest move the server has simulated, waiting to be published into ServerState
+	FGoKartMove LastProcessedMove;
+	float LastPublishTime = 0;
+	bool bQueuedForPublish = false;
+
+	bool bReplayPlayback = false;
+	//interpolated by the proxy interpolation subsystem rather than in ClientTick
+	bool bInterpolationBatched = false;
+	//ServerState arrived and is waiting for the batched reconcile, the kart still holds its prediction
+	bool bReconcilePending = false;
+	FVector PredictedLocation;
+	//a simulated proxy has had at least one ServerState from the server
+	bool bHasServerState = false;
+
+	//distance in cm the last server correction moved the owning client's kart
+	float LastCorrectionError = 0;
+
+	//seconds for a correction of the owning client's kart to fade out of the mesh, 0 snaps the mesh with the collision
+	UPROPERTY(EditAnywhere)
+	float CorrectionSmoothingTime = 0.15;
+	//corrections further than this in cm are treated as teleports and snap straight away
+	UPROPERTY(EditAnywhere)
+	float MaxSmoothedCorrection = 300;
+	//world space error still held by the mesh while the collision root sits at the corrected transform
+	FVector CorrectionOffset = FVector::ZeroVector;
+	FQuat CorrectionRotationOffset = FQuat::Identity;
+
+	//longest round trip in seconds the server credits a client with
+	static constexpr float MaxRoundTripTime = 1;
+	//a move is acknowledged at the latest a round trip plus one server update after it is sent, AGoKart updates once a second
+	static constexpr float MaxAcknowledgeDelay = MaxRoundTripTime + 1;
+	//highest frame rate the queue is sized for, every frame with new inputs is a move of its own
+	static constexpr int32 MaxMoveRate = 120;
+	static constexpr int32 MaxUnacknowledgedMoves = int32(MaxAcknowledgeDelay * MaxMoveRate);
+
+	//list of unacknowledged moves, reserved once to the cap so queueing never touches the heap
 	TArray<FGoKartMove> UnacknowledgedMoves;
+	//moves dropped off the front of a full queue since the server last acknowledged one
+	int32 DroppedMoves = 0;
+
+	//the last unacknowledged move is still collecting identical frames and hasn't been sent yet
+	bool bHasPendingMove = false;
+
+	//most identical frames merged into one move before it is sent anyway
+	UPROPERTY(EditAnywhere)
+	uint8 MaxCoalescedMoves = 8;
 
 	float ClientTimeSinceUpdate;
 	float ClientTimeBetweenLastUpdates;
+	//filtered gap between server updates, 0 until the second update
+	float SmoothedUpdateInterval = 0;
+	//deviations of the connection's jitter added to each segment, so a late update is usually covered before the proxy runs out of spline
+	UPROPERTY(EditAnywhere)
+	float InterpolationJitterMargin = 2;
 
 	FTransform ClientStartTransform;
 	FVector ClientStartVelocity;
 
 	float ClientSimulatedTime;
+	//server time the first move arrived, the client's simulated time is measured from here
+	float ServerTimeAtFirstMove = -1;
+
+	//seconds between clock sync pings once the first few samples are in
+	UPROPERTY(EditAnywhere)
+	float ClockSyncInterval = 1;
+	//how far ahead of the server clock a client may run before its moves are rejected
+	UPROPERTY(EditAnywhere)
+	float MaxClientTimeAhead = 0.25;
+	//most clock drift forgiven, so honest clients running slightly fast are not kicked over a long race
+	UPROPERTY(EditAnywhere)
+	float MaxClockDrift = 0.005;
+	//seconds of pings the client's drift is measured over
+	UPROPERTY(EditAnywhere)
+	float ClockDriftWindow = 10;
+	//largest jitter the server allows for when moves bunch up, whatever it measures
+	UPROPERTY(EditAnywhere)
+	float MaxToleratedJitter = 0.1;
+
+	//on the client the estimate from its pings, on the server its own measurement of the echoes
+	FGoKartClockSync ClockSync;
+	float TimeUntilClockSync = 0;
+
+	//server time of the last pong sent, only its echo is timed, -1 once it has been
+	float PendingEchoTime = -1;
+	//client and server time at the start of the current drift window, -1 before the first ping
+	float DriftWindowClientTime = -1;
+	float DriftWindowServerTime = -1;
+	//fraction of the client's move time forgiven, what the last window measured up to MaxClockDrift
+	float ClockDriftAllowance = 0;
 
 	UPROPERTY() 
 	USceneComponent* MeshOffsetRoot;
@@ -0,0 +1,211 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartNetStats.h"
+#include "Engine/World.h"
+#include "Engine/NetDriver.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/CommandLine.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+namespace
+{
+	struct FGoKartNetProfile
+	{
+		const TCHAR* Name;
+		int32 LagMs;
+		int32 LagVarianceMs;
+		int32 LossPercent;
+		int32 Reorder;
+	};
+
+	//latency, jitter, loss and reordering profiles used for netcode regression runs
+	const FGoKartNetProfile NetProfiles[] =
+	{
+		{ TEXT("Off"),      0,   0,   0,  0 },
+		{ TEXT("LAN"),      5,   2,   0,  0 },
+		{ TEXT("Average"),  60,  15,  1,  0 },
+		{ TEXT("Bad"),      150, 50,  5,  1 },
+		{ TEXT("Terrible"), 300, 100, 10, 1 },
+	};
+}
+
+void FGoKartNetSampleSeries::Add(float Sample)
+{
+	bSortedDirty = true;
+	if (Samples.Num() < MaxSamples)
+	{
+		//one allocation for the whole ring rather than a regrow every time it doubles mid-race
+		if (Samples.Max() == 0)
+		{
+			Samples.Reserve(MaxSamples);
+		}
+		Samples.Add(Sample);
+		return;
+	}
+	Samples[NextIndex] = Sample;
+	NextIndex = (NextIndex + 1) % MaxSamples;
+}
+
+void FGoKartNetSampleSeries::Reset()
+{
+	Samples.Reset();
+	Sorted.Reset();
+	NextIndex = 0;
+	bSortedDirty = false;
+}
+
+float FGoKartNetSampleSeries::GetPercentile(float Percentile) const
+{
+	if (Samples.Num() == 0) return 0;
+
+	//one sort serves every percentile of a report, and the copy reuses its allocation
+	if (bSortedDirty)
+	{
+		Sorted = Samples;
+		Sorted.Sort();
+		bSortedDirty = false;
+	}
+	int32 Index = FMath::Clamp(FMath::CeilToInt(Percentile / 100 * Sorted.Num()) - 1, 0, Sorted.Num() - 1);
+	return Sorted[Index];
+}
+
+float FGoKartNetSampleSeries::GetMax() const
+{
+	return Samples.Num() > 0 ? FMath::Max(Samples) : 0;
+}
+
+float FGoKartNetSampleSeries::GetMean() const
+{
+	if (Samples.Num() == 0) return 0;
+
+	double Sum = 0;
+	for (float Sample : Samples)
+	{
+		Sum += Sample;
+	}
+	return Sum / Samples.Num();
+}
+
+FString FGoKartNetSampleSeries::ToJson() const
+{
+	return FString::Printf(TEXT("{\"count\":%d,\"mean\":%.4f,\"p50\":%.4f,\"p90\":%.4f,\"p99\":%.4f,\"max\":%.4f}"),
+		Num(), GetMean(), GetPercentile(50), GetPercentile(90), GetPercentile(99), GetMax());
+}
+
+void UGoKartNetStatsSubsystem::Deinitialize()
+{
+	//-KartNetStatsReport=<file> lets automated runs collect the metrics when the world shuts down
+	FString ReportFile;
+	if (FParse::Value(FCommandLine::Get(), TEXT("KartNetStatsReport="), ReportFile))
+	{
+		WriteReport(ReportFile);
+	}
+	Super::Deinitialize();
+}
+
+void UGoKartNetStatsSubsystem::RecordConnectionClock(float InRoundTripTime, float InJitter, float InClockOffset)
+{
+	RoundTripTimes.Add(InRoundTripTime);
+	Jitter = InJitter;
+	ClockOffset = InClockOffset;
+}
+
+void UGoKartNetStatsSubsystem::Reset()
+{
+	Corrections.Reset();
+	RemoteErrors.Reset();
+	AckLatencies.Reset();
+	RoundTripTimes.Reset();
+}
+
+FString UGoKartNetStatsSubsystem::ToJson() const
+{
+	UWorld* World = GetWorld();
+	const TCHAR* NetMode = TEXT("Standalone");
+	if (World != nullptr)
+	{
+		switch (World->GetNetMode())
+		{
+		case NM_DedicatedServer: NetMode = TEXT("DedicatedServer"); break;
+		case NM_ListenServer: NetMode = TEXT("ListenServer"); break;
+		case NM_Client: NetMode = TEXT("Client"); break;
+		default: break;
+		}
+	}
+
+	return FString::Printf(TEXT("{\"netMode\":\"%s\",\"netProfile\":\"%s\",\"correctionCm\":%s,\"remoteErrorCm\":%s,\"ackLatencySeconds\":%s,\"rttSeconds\":%s,\"jitterSeconds\":%.4f,\"clockOffsetSeconds\":%.4f}"),
+		NetMode, *ActiveNetProfile.ToString(), *Corrections.ToJson(), *RemoteErrors.ToJson(), *AckLatencies.ToJson(), *RoundTripTimes.ToJson(), Jitter, ClockOffset);
+}
+
+bool UGoKartNetStatsSubsystem::WriteReport(const FString& FileName) const
+{
+	FString Path = FPaths::IsRelative(FileName) ? FPaths::ProjectSavedDir() / TEXT("NetStats") / FileName : FileName;
+	if (!FFileHelper::SaveStringToFile(ToJson(), *Path))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not write net stats report to %s"), *Path);
+		return false;
+	}
+	UE_LOG(LogTemp, Log, TEXT("Wrote net stats report to %s"), *Path);
+	return true;
+}
+
+bool UGoKartNetStatsSubsystem::ApplyNetProfile(FName ProfileName)
+{
+#if DO_ENABLE_NET_TEST
+	UNetDriver* NetDriver = GetWorld()->GetNetDriver();
+	if (NetDriver == nullptr) return false;
+
+	for (const FGoKartNetProfile& Profile : NetProfiles)
+	{
+		if (ProfileName != Profile.Name) continue;
+
+		FPacketSimulationSettings Settings;
+		Settings.PktLag = Profile.LagMs;
+		Settings.PktLagVariance = Profile.LagVarianceMs;
+		Settings.PktLoss = Profile.LossPercent;
+		Settings.PktOrder = Profile.Reorder;
+		NetDriver->SetPacketSimulationSettings(Settings);
+
+		ActiveNetProfile = ProfileName;
+		return true;
+	}
+	UE_LOG(LogTemp, Error, TEXT("Unknown net profile %s"), *ProfileName.ToString());
+#endif
+	return false;
+}
+
+static FAutoConsoleCommandWithWorldAndArgs KartNetProfileCommand(
+	TEXT("Kart.NetProfile"),
+	TEXT("Emulate network conditions: Off, LAN, Average, Bad or Terrible"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UGoKartNetStatsSubsystem* Stats = World != nullptr ? World->GetSubsystem<UGoKartNetStatsSubsystem>() : nullptr;
+		if (Stats == nullptr || Args.Num() == 0) return;
+		Stats->ApplyNetProfile(FName(*Args[0]));
+	}));
+
+static FAutoConsoleCommandWithWorldAndArgs KartNetStatsResetCommand(
+	TEXT("Kart.NetStats.Reset"),
+	TEXT("Clear collected kart netcode metrics"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UGoKartNetStatsSubsystem* Stats = World != nullptr ? World->GetSubsystem<UGoKartNetStatsSubsystem>() : nullptr;
+		if (Stats == nullptr) return;
+		Stats->Reset();
+	}));
+
+static FAutoConsoleCommandWithWorldAndArgs KartNetStatsDumpCommand(
+	TEXT("Kart.NetStats.Dump"),
+	TEXT("Log kart netcode metrics as JSON, optionally writing them to Saved/NetStats/<File>"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UGoKartNetStatsSubsystem* Stats = World != nullptr ? World->GetSubsystem<UGoKartNetStatsSubsystem>() : nullptr;
+		if (Stats == nullptr) return;
+		UE_LOG(LogTemp, Log, TEXT("%s"), *Stats->ToJson());
+		if (Args.Num() > 0)
+		{
+			Stats->WriteReport(Args[0]);
+		}
+	}));
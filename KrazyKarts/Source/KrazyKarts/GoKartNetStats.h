@@ -0,0 +1,74 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "GoKartNetStats.generated.h"
+
+//bounded history of samples for one metric, oldest samples are overwritten once full
+struct FGoKartNetSampleSeries
+{
+	void Add(float Sample);
+	void Reset();
+
+	int32 Num() const { return Samples.Num(); }
+	float GetPercentile(float Percentile) const;
+	float GetMax() const;
+	float GetMean() const;
+
+	FString ToJson() const;
+
+private:
+	static const int32 MaxSamples = 65536;
+
+	TArray<float> Samples;
+	int32 NextIndex = 0;
+
+	//sorted copy of Samples, only redone when a report asks for a percentile after new samples arrived
+	mutable TArray<float> Sorted;
+	mutable bool bSortedDirty = false;
+};
+
+//collects prediction and interpolation error metrics for every kart in a world
+UCLASS()
+class KRAZYKARTS_API UGoKartNetStatsSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+
+	//distance in cm the owning client was moved by a server correction
+	void RecordCorrection(float Distance) { Corrections.Add(Distance); }
+	//distance in cm between a remote kart's displayed location and the authority when an update arrives
+	void RecordRemoteError(float Distance) { RemoteErrors.Add(Distance); }
+	//seconds from a move being created to the server acknowledging it
+	void RecordAckLatency(float Seconds) { AckLatencies.Add(Seconds); }
+	//latest filtered clock sync estimate of the local connection
+	void RecordConnectionClock(float InRoundTripTime, float InJitter, float InClockOffset);
+
+	void Reset();
+
+	//machine readable summary of all metrics
+	FString ToJson() const;
+	bool WriteReport(const FString& FileName) const;
+
+	const FGoKartNetSampleSeries& GetCorrections() const { return Corrections; }
+	const FGoKartNetSampleSeries& GetRemoteErrors() const { return RemoteErrors; }
+	const FGoKartNetSampleSeries& GetAckLatencies() const { return AckLatencies; }
+
+	//apply one of the named latency/jitter/loss/reordering profiles to this world's net driver
+	bool ApplyNetProfile(FName ProfileName);
+
+private:
+	FGoKartNetSampleSeries Corrections;
+	FGoKartNetSampleSeries RemoteErrors;
+	FGoKartNetSampleSeries AckLatencies;
+	FGoKartNetSampleSeries RoundTripTimes;
+
+	float Jitter = 0;
+	float ClockOffset = 0;
+
+	FName ActiveNetProfile = TEXT("Off");
+};
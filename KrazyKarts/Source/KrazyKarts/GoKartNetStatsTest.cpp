@@ -0,0 +1,95 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartNetStats.h"
+#include "Misc/AutomationTest.h"
+#include "Tests/AutomationCommon.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+
+#if WITH_DEV_AUTOMATION_TESTS && DO_ENABLE_NET_TEST
+
+namespace
+{
+	//how long the karts drive under the profile before the metrics are checked
+	const float NetProfileSeconds = 20;
+
+	//limits for the Average profile, a regression past these shows up as visible rubber banding
+	const float MaxCorrectionP99 = 50;
+	const float MaxRemoteErrorP99 = 150;
+	const float MaxAckLatencyP99 = 0.5f;
+
+	//the same slalom every run, so the metrics compare between runs
+	void SetInputScript(int32 Script)
+	{
+		if (IConsoleVariable* InputScript = IConsoleManager::Get().FindConsoleVariable(TEXT("Kart.InputScript")))
+		{
+			InputScript->Set(Script);
+		}
+	}
+
+	//the test needs a client connected to a running race, e.g. a two player PIE session or -ExecCmds="Automation RunTests KrazyKarts"
+	UWorld* FindClientWorld()
+	{
+		if (GEngine == nullptr) return nullptr;
+
+		for (const FWorldContext& Context : GEngine->GetWorldContexts())
+		{
+			UWorld* World = Context.World();
+			if (World != nullptr && World->GetNetMode() == NM_Client) return World;
+		}
+		return nullptr;
+	}
+}
+
+DEFINE_LATENT_AUTOMATION_COMMAND_TWO_PARAMETER(FGoKartCheckNetStatsCommand, FAutomationTestBase*, Test, TWeakObjectPtr<UWorld>, World);
+
+bool FGoKartCheckNetStatsCommand::Update()
+{
+	UGoKartNetStatsSubsystem* Stats = World.IsValid() ? World->GetSubsystem<UGoKartNetStatsSubsystem>() : nullptr;
+	if (Stats == nullptr)
+	{
+		Test->AddError(TEXT("Client world went away while the profile was running"));
+		return true;
+	}
+	UE_LOG(LogTemp, Log, TEXT("%s"), *Stats->ToJson());
+
+	const FGoKartNetSampleSeries& Corrections = Stats->GetCorrections();
+	const FGoKartNetSampleSeries& RemoteErrors = Stats->GetRemoteErrors();
+	const FGoKartNetSampleSeries& AckLatencies = Stats->GetAckLatencies();
+
+	Test->TestTrue(TEXT("Server updates were received"), Corrections.Num() > 0);
+	Test->TestTrue(TEXT("Moves were acknowledged"), AckLatencies.Num() > 0);
+	Test->TestTrue(FString::Printf(TEXT("Correction p99 %.2f cm is within %.2f cm"), Corrections.GetPercentile(99), MaxCorrectionP99), Corrections.GetPercentile(99) <= MaxCorrectionP99);
+	Test->TestTrue(FString::Printf(TEXT("Remote error p99 %.2f cm is within %.2f cm"), RemoteErrors.GetPercentile(99), MaxRemoteErrorP99), RemoteErrors.GetPercentile(99) <= MaxRemoteErrorP99);
+	Test->TestTrue(FString::Printf(TEXT("Ack latency p99 %.3f s is within %.3f s"), AckLatencies.GetPercentile(99), MaxAckLatencyP99), AckLatencies.GetPercentile(99) <= MaxAckLatencyP99);
+
+	Stats->ApplyNetProfile(TEXT("Off"));
+	SetInputScript(0);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FGoKartNetProfileTest, "KrazyKarts.NetStats.AverageProfile", EAutomationTestFlags::ClientContext | EAutomationTestFlags::ProductFilter)
+
+bool FGoKartNetProfileTest::RunTest(const FString& Parameters)
+{
+	UWorld* World = FindClientWorld();
+	if (World == nullptr)
+	{
+		AddError(TEXT("No client world, start a networked session first"));
+		return false;
+	}
+
+	UGoKartNetStatsSubsystem* Stats = World->GetSubsystem<UGoKartNetStatsSubsystem>();
+	if (!TestNotNull(TEXT("Net stats subsystem"), Stats)) return false;
+	if (!TestTrue(TEXT("Average profile applied"), Stats->ApplyNetProfile(TEXT("Average")))) return false;
+	SetInputScript(2);
+	Stats->Reset();
+
+	ADD_LATENT_AUTOMATION_COMMAND(FWaitLatentCommand(NetProfileSeconds));
+	ADD_LATENT_AUTOMATION_COMMAND(FGoKartCheckNetStatsCommand(this, World));
+	return true;
+}
+
+#endif
@@ -0,0 +1,71 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartPool.h"
+#include "GoKart.h"
+#include "KrazyKarts.h"
+#include "Engine/World.h"
+
+DECLARE_CYCLE_STAT(TEXT("Pool Acquire"), STAT_KartPoolAcquire, STATGROUP_KrazyKarts);
+DECLARE_CYCLE_STAT(TEXT("Pool Release"), STAT_KartPoolRelease, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Pool Misses"), STAT_KartPoolMisses, STATGROUP_KrazyKarts);
+
+void UGoKartPoolSubsystem::Prewarm(TSubclassOf<AGoKart> KartClass, int32 Count)
+{
+	if (KartClass == nullptr) return;
+
+	FGoKartPoolList& Pool = Pools.FindOrAdd(KartClass);
+	Pool.Karts.Reserve(Pool.Karts.Num() + Count);
+	for (int32 Index = 0; Index < Count; ++Index)
+	{
+		AGoKart* Kart = SpawnKart(KartClass, FTransform::Identity);
+		if (Kart == nullptr) return;
+
+		Kart->OnReleasedToPool();
+		Pool.Karts.Add(Kart);
+	}
+}
+
+AGoKart* UGoKartPoolSubsystem::Acquire(TSubclassOf<AGoKart> KartClass, const FTransform& Transform)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartPoolAcquire);
+
+	if (KartClass == nullptr) return nullptr;
+
+	FGoKartPoolList* Pool = Pools.Find(KartClass);
+	while (Pool != nullptr && Pool->Karts.Num() > 0)
+	{
+		AGoKart* Kart = Pool->Karts.Pop(false);
+		if (IsValid(Kart))
+		{
+			Kart->OnAcquiredFromPool(Transform);
+			return Kart;
+		}
+	}
+
+	INC_DWORD_STAT(STAT_KartPoolMisses);
+	return SpawnKart(KartClass, Transform);
+}
+
+void UGoKartPoolSubsystem::Release(AGoKart* Kart)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartPoolRelease);
+
+	if (!IsValid(Kart)) return;
+
+	Kart->OnReleasedToPool();
+	Pools.FindOrAdd(Kart->GetClass()).Karts.AddUnique(Kart);
+}
+
+int32 UGoKartPoolSubsystem::NumPooled(TSubclassOf<AGoKart> KartClass) const
+{
+	const FGoKartPoolList* Pool = Pools.Find(KartClass);
+	return Pool != nullptr ? Pool->Karts.Num() : 0;
+}
+
+AGoKart* UGoKartPoolSubsystem::SpawnKart(TSubclassOf<AGoKart> KartClass, const FTransform& Transform)
+{
+	FActorSpawnParameters SpawnParameters;
+	SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	return GetWorld()->SpawnActor<AGoKart>(KartClass, Transform, SpawnParameters);
+}
@@ -0,0 +1,41 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "GoKartPool.generated.h"
+
+class AGoKart;
+
+USTRUCT()
+struct FGoKartPoolList
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	TArray<AGoKart*> Karts;
+};
+
+//keeps parked kart actors around so joining, leaving and restarting races don't construct and destroy them
+UCLASS()
+class KRAZYKARTS_API UGoKartPoolSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	//spawn karts up front, while nobody is racing yet
+	void Prewarm(TSubclassOf<AGoKart> KartClass, int32 Count);
+
+	//a parked kart of KartClass moved to Transform, spawning a new one only when the pool is empty
+	AGoKart* Acquire(TSubclassOf<AGoKart> KartClass, const FTransform& Transform);
+	void Release(AGoKart* Kart);
+
+	int32 NumPooled(TSubclassOf<AGoKart> KartClass) const;
+
+private:
+	AGoKart* SpawnKart(TSubclassOf<AGoKart> KartClass, const FTransform& Transform);
+
+	UPROPERTY()
+	TMap<UClass*, FGoKartPoolList> Pools;
+};
@@ -0,0 +1,305 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartProxyInterpolation.h"
+#include "GoKartMovementReplicator.h"
+#include "GoKartAllocations.h"
+#include "KrazyKarts.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+
+DECLARE_CYCLE_STAT(TEXT("Proxy Interpolation"), STAT_KartProxyInterpolation, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Interpolated Proxies"), STAT_KartInterpolatedProxies, STATGROUP_KrazyKarts);
+
+template <typename FunctionType>
+void FGoKartProxyBatch::ForEachArray(FunctionType Function)
+{
+	for (TArray<float>* Array : {
+		&P0X, &P0Y, &P0Z, &P1X, &P1Y, &P1Z,
+		&T0X, &T0Y, &T0Z, &T1X, &T1Y, &T1Z,
+		&Q0X, &Q0Y, &Q0Z, &Q0W, &Q1X, &Q1Y, &Q1Z, &Q1W,
+		&Omegas, &InvSinOmegas, &Times, &Durations,
+		&OutX, &OutY, &OutZ, &OutVX, &OutVY, &OutVZ,
+		&OutQX, &OutQY, &OutQZ, &OutQW })
+	{
+		Function(*Array);
+	}
+}
+
+void FGoKartProxyBatch::SetNum(int32 NewNum)
+{
+	//whole groups of four so Evaluate never needs a scalar tail, the spare lanes stay zero and are never applied
+	int32 PaddedNum = Align(NewNum, 4);
+	ForEachArray([PaddedNum](TArray<float>& Array)
+	{
+		Array.SetNumZeroed(PaddedNum, false);
+	});
+	NumSegments = NewNum;
+}
+
+void FGoKartProxyBatch::RemoveAtSwap(int32 Index)
+{
+	int32 LastIndex = NumSegments - 1;
+	ForEachArray([Index, LastIndex](TArray<float>& Array)
+	{
+		Array[Index] = Array[LastIndex];
+		Array[LastIndex] = 0;
+	});
+	SetNum(LastIndex);
+}
+
+void FGoKartProxyBatch::SetSegment(int32 Index, const FTransform& Start, const FVector& StartVelocity, const FTransform& Target, const FVector& TargetVelocity, float Duration, float Time)
+{
+	float VelocityToDerivative = Duration * 100; //*100 to convert m to cm
+	FVector P0 = Start.GetLocation();
+	FVector P1 = Target.GetLocation();
+	FVector T0 = StartVelocity * VelocityToDerivative;
+	FVector T1 = TargetVelocity * VelocityToDerivative;
+	P0X[Index] = P0.X; P0Y[Index] = P0.Y; P0Z[Index] = P0.Z;
+	P1X[Index] = P1.X; P1Y[Index] = P1.Y; P1Z[Index] = P1.Z;
+	T0X[Index] = T0.X; T0Y[Index] = T0.Y; T0Z[Index] = T0.Z;
+	T1X[Index] = T1.X; T1Y[Index] = T1.Y; T1Z[Index] = T1.Z;
+
+	//the per segment half of FQuat::Slerp: shortest path and the angle between the end points
+	FQuat Q0 = Start.GetRotation();
+	FQuat Q1 = Target.GetRotation();
+	float RawCosom = Q0 | Q1;
+	if (RawCosom < 0)
+	{
+		Q1 = -Q1;
+	}
+	float Cosom = FMath::Abs(RawCosom);
+	float Omega = 0;
+	float InvSinOmega = 0;
+	if (Cosom < 0.9999f)
+	{
+		Omega = FMath::Acos(Cosom);
+		InvSinOmega = 1 / FMath::Sin(Omega);
+	}
+	Q0X[Index] = Q0.X; Q0Y[Index] = Q0.Y; Q0Z[Index] = Q0.Z; Q0W[Index] = Q0.W;
+	Q1X[Index] = Q1.X; Q1Y[Index] = Q1.Y; Q1Z[Index] = Q1.Z; Q1W[Index] = Q1.W;
+	Omegas[Index] = Omega;
+	InvSinOmegas[Index] = InvSinOmega;
+
+	Durations[Index] = Duration;
+	Times[Index] = Time;
+}
+
+void FGoKartProxyBatch::Evaluate(float DeltaTime)
+{
+	const VectorRegister Delta = VectorSetFloat1(DeltaTime);
+	const VectorRegister MinDuration = VectorSetFloat1(KINDA_SMALL_NUMBER);
+	const VectorRegister One = VectorOne();
+	const VectorRegister Two = VectorSetFloat1(2);
+	const VectorRegister Three = VectorSetFloat1(3);
+	const VectorRegister Four = VectorSetFloat1(4);
+	const VectorRegister Six = VectorSetFloat1(6);
+	const VectorRegister Hundred = VectorSetFloat1(100);
+	const VectorRegister Zero = VectorZero();
+
+	for (int32 Index = 0; Index < NumSegments; Index += 4)
+	{
+		VectorRegister Time = VectorAdd(VectorLoad(&Times[Index]), Delta);
+		VectorStore(Time, &Times[Index]);
+		VectorRegister Duration = VectorLoad(&Durations[Index]);
+
+		//same unclamped ratio as the per proxy path, a late update extrapolates along the spline
+		VectorRegister A = VectorDivide(Time, VectorMax(Duration, MinDuration));
+		VectorRegister A2 = VectorMultiply(A, A);
+		VectorRegister A3 = VectorMultiply(A2, A);
+
+		//FMath::CubicInterp basis
+		VectorRegister H00 = VectorAdd(VectorSubtract(VectorMultiply(Two, A3), VectorMultiply(Three, A2)), One);
+		VectorRegister H10 = VectorAdd(VectorSubtract(A3, VectorMultiply(Two, A2)), A);
+		VectorRegister H01 = VectorSubtract(VectorMultiply(Three, A2), VectorMultiply(Two, A3));
+		VectorRegister H11 = VectorSubtract(A3, A2);
+
+		//FMath::CubicInterpDerivative basis, divided by the duration to give cm/s
+		VectorRegister InvDerivative = VectorDivide(One, VectorMultiply(VectorMax(Duration, MinDuration), Hundred));
+		VectorRegister D00 = VectorMultiply(VectorSubtract(VectorMultiply(Six, A2), VectorMultiply(Six, A)), InvDerivative);
+		VectorRegister D10 = VectorMultiply(VectorAdd(VectorSubtract(VectorMultiply(Three, A2), VectorMultiply(Four, A)), One), InvDerivative);
+		VectorRegister D01 = VectorNegate(D00);
+		VectorRegister D11 = VectorMultiply(VectorSubtract(VectorMultiply(Three, A2), VectorMultiply(Two, A)), InvDerivative);
+
+		auto EvaluateAxis = [&](const TArray<float>& P0, const TArray<float>& T0, const TArray<float>& P1, const TArray<float>& T1, TArray<float>& OutLocation, TArray<float>& OutVelocity)
+		{
+			VectorRegister VP0 = VectorLoad(&P0[Index]);
+			VectorRegister VT0 = VectorLoad(&T0[Index]);
+			VectorRegister VP1 = VectorLoad(&P1[Index]);
+			VectorRegister VT1 = VectorLoad(&T1[Index]);
+
+			VectorRegister Location = VectorMultiply(H00, VP0);
+			Location = VectorMultiplyAdd(H10, VT0, Location);
+			Location = VectorMultiplyAdd(H01, VP1, Location);
+			Location = VectorMultiplyAdd(H11, VT1, Location);
+			VectorStore(Location, &OutLocation[Index]);
+
+			VectorRegister Velocity = VectorMultiply(D00, VP0);
+			Velocity = VectorMultiplyAdd(D10, VT0, Velocity);
+			Velocity = VectorMultiplyAdd(D01, VP1, Velocity);
+			Velocity = VectorMultiplyAdd(D11, VT1, Velocity);
+			VectorStore(Velocity, &OutVelocity[Index]);
+		};
+		EvaluateAxis(P0X, T0X, P1X, T1X, OutX, OutVX);
+		EvaluateAxis(P0Y, T0Y, P1Y, T1Y, OutY, OutVY);
+		EvaluateAxis(P0Z, T0Z, P1Z, T1Z, OutZ, OutVZ);
+
+		//the per frame half of FQuat::Slerp, lerp weights where the end points are too close for the sine form
+		VectorRegister Omega = VectorLoad(&Omegas[Index]);
+		VectorRegister InvSinOmega = VectorLoad(&InvSinOmegas[Index]);
+		VectorRegister UseSine = VectorCompareGT(Omega, Zero);
+		VectorRegister Scale0 = VectorSelect(UseSine, VectorMultiply(VectorSin(VectorMultiply(VectorSubtract(One, A), Omega)), InvSinOmega), VectorSubtract(One, A));
+		VectorRegister Scale1 = VectorSelect(UseSine, VectorMultiply(VectorSin(VectorMultiply(A, Omega)), InvSinOmega), A);
+
+		VectorRegister QX = VectorMultiplyAdd(Scale1, VectorLoad(&Q1X[Index]), VectorMultiply(Scale0, VectorLoad(&Q0X[Index])));
+		VectorRegister QY = VectorMultiplyAdd(Scale1, VectorLoad(&Q1Y[Index]), VectorMultiply(Scale0, VectorLoad(&Q0Y[Index])));
+		VectorRegister QZ = VectorMultiplyAdd(Scale1, VectorLoad(&Q1Z[Index]), VectorMultiply(Scale0, VectorLoad(&Q0Z[Index])));
+		VectorRegister QW = VectorMultiplyAdd(Scale1, VectorLoad(&Q1W[Index]), VectorMultiply(Scale0, VectorLoad(&Q0W[Index])));
+
+		VectorRegister SizeSquared = VectorMultiply(QX, QX);
+		SizeSquared = VectorMultiplyAdd(QY, QY, SizeSquared);
+		SizeSquared = VectorMultiplyAdd(QZ, QZ, SizeSquared);
+		SizeSquared = VectorMultiplyAdd(QW, QW, SizeSquared);
+		//padding lanes are all zero, keep them finite
+		VectorRegister InvSize = VectorReciprocalSqrtAccurate(VectorMax(SizeSquared, VectorSetFloat1(SMALL_NUMBER)));
+		VectorStore(VectorMultiply(QX, InvSize), &OutQX[Index]);
+		VectorStore(VectorMultiply(QY, InvSize), &OutQY[Index]);
+		VectorStore(VectorMultiply(QZ, InvSize), &OutQZ[Index]);
+		VectorStore(VectorMultiply(QW, InvSize), &OutQW[Index]);
+	}
+}
+
+void UGoKartProxyInterpolationSubsystem::AddProxy(UGoKartMovementReplicator* Replicator)
+{
+	if (Replicator == nullptr || Slots.Contains(Replicator)) return;
+
+	int32 Slot = Replicators.Add(Replicator);
+	Slots.Add(Replicator, Slot);
+	Batch.SetNum(Replicators.Num());
+}
+
+void UGoKartProxyInterpolationSubsystem::RemoveProxy(UGoKartMovementReplicator* Replicator)
+{
+	int32 Slot;
+	if (!Slots.RemoveAndCopyValue(Replicator, Slot)) return;
+
+	//move the last proxy into the freed slot so the batch stays dense
+	Batch.RemoveAtSwap(Slot);
+	Replicators.RemoveAtSwap(Slot, 1, false);
+	if (Replicators.IsValidIndex(Slot))
+	{
+		Slots.Add(Replicators[Slot], Slot);
+	}
+}
+
+void UGoKartProxyInterpolationSubsystem::SetSegment(UGoKartMovementReplicator* Replicator, const FTransform& Start, const FVector& StartVelocity, const FTransform& Target, const FVector& TargetVelocity, float Duration, float Time)
+{
+	const int32* Slot = Slots.Find(Replicator);
+	if (Slot == nullptr) return;
+	Batch.SetSegment(*Slot, Start, StartVelocity, Target, TargetVelocity, Duration, Time);
+}
+
+float UGoKartProxyInterpolationSubsystem::GetTimeSinceUpdate(const UGoKartMovementReplicator* Replicator) const
+{
+	const int32* Slot = Slots.Find(Replicator);
+	return Slot != nullptr ? Batch.GetTime(*Slot) : 0;
+}
+
+bool UGoKartProxyInterpolationSubsystem::IsTickable() const
+{
+	return !IsTemplate() && Replicators.Num() > 0;
+}
+
+TStatId UGoKartProxyInterpolationSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartProxyInterpolationSubsystem, STATGROUP_Tickables);
+}
+
+void UGoKartProxyInterpolationSubsystem::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartProxyInterpolation);
+	LLM_SCOPE_BYTAG(KrazyKarts_Interpolation);
+	FGoKartAllocationScope AllocationScope;
+
+	Batch.Evaluate(DeltaTime);
+
+	for (int32 Slot = 0; Slot < Replicators.Num(); ++Slot)
+	{
+		//no segment until the second update has arrived
+		if (!Batch.IsMoving(Slot)) continue;
+		Replicators[Slot]->ApplyInterpolation(Batch.GetLocation(Slot), Batch.GetRotation(Slot), Batch.GetVelocity(Slot));
+	}
+
+	SET_DWORD_STAT(STAT_KartInterpolatedProxies, Replicators.Num());
+}
+
+void UGoKartProxyInterpolationSubsystem::RunBenchmark(int32 Count)
+{
+	Count = FMath::Max(Count, 1);
+	const int32 NumFrames = 1000;
+	const float DeltaTime = 1 / 60.f;
+	const float Duration = 0.1f;
+
+	FRandomStream Random(Count);
+	TArray<FTransform> Starts;
+	TArray<FTransform> Targets;
+	TArray<FVector> StartVelocities;
+	TArray<FVector> TargetVelocities;
+	FGoKartProxyBatch BenchBatch;
+	BenchBatch.SetNum(Count);
+	for (int32 Index = 0; Index < Count; ++Index)
+	{
+		FVector Location = Random.GetUnitVector() * Random.FRandRange(0, 100000);
+		FRotator Rotation(0, Random.FRandRange(-180, 180), 0);
+		FVector Velocity = Rotation.Vector() * Random.FRandRange(0, 20);
+		Starts.Add(FTransform(Rotation, Location));
+		Targets.Add(FTransform(Rotation + FRotator(0, Random.FRandRange(-10, 10), 0), Location + Velocity * Duration * 100));
+		StartVelocities.Add(Velocity);
+		TargetVelocities.Add(Velocity);
+		BenchBatch.SetSegment(Index, Starts[Index], StartVelocities[Index], Targets[Index], TargetVelocities[Index], Duration, 0);
+	}
+
+	//the per proxy path as ClientTick runs it, writing into the same place the apply step would
+	TArray<FTransform> Results;
+	Results.SetNum(Count);
+	TArray<FVector> ResultVelocities;
+	ResultVelocities.SetNum(Count);
+	double StartTime = FPlatformTime::Seconds();
+	for (int32 Frame = 0; Frame < NumFrames; ++Frame)
+	{
+		float LerpRatio = FMath::Fmod(Frame * DeltaTime, Duration) / Duration;
+		float VelocityToDerivative = Duration * 100;
+		for (int32 Index = 0; Index < Count; ++Index)
+		{
+			FHermiteCubicSpline Spline(Starts[Index].GetLocation(), Targets[Index].GetLocation(), StartVelocities[Index] * VelocityToDerivative, TargetVelocities[Index] * VelocityToDerivative);
+			Results[Index].SetLocation(Spline.InterpolateLocation(LerpRatio));
+			ResultVelocities[Index] = Spline.InterpolateDerivative(LerpRatio) / VelocityToDerivative;
+			Results[Index].SetRotation(FQuat::Slerp(Starts[Index].GetRotation(), Targets[Index].GetRotation(), LerpRatio));
+		}
+	}
+	double ScalarSeconds = FPlatformTime::Seconds() - StartTime;
+
+	StartTime = FPlatformTime::Seconds();
+	for (int32 Frame = 0; Frame < NumFrames; ++Frame)
+	{
+		BenchBatch.Evaluate(DeltaTime);
+		for (int32 Index = 0; Index < Count; ++Index)
+		{
+			Results[Index].SetLocation(BenchBatch.GetLocation(Index));
+			ResultVelocities[Index] = BenchBatch.GetVelocity(Index);
+			Results[Index].SetRotation(BenchBatch.GetRotation(Index));
+		}
+	}
+	double BatchedSeconds = FPlatformTime::Seconds() - StartTime;
+
+	UE_LOG(LogTemp, Log, TEXT("Proxy interpolation, %d proxies: per proxy %.2f us/frame, batched %.2f us/frame (%.1fx)"),
+		Count, ScalarSeconds * 1e6 / NumFrames, BatchedSeconds * 1e6 / NumFrames, ScalarSeconds / FMath::Max(BatchedSeconds, 1e-9));
+}
+
+static FAutoConsoleCommandWithWorldAndArgs KartProxyInterpolationBenchCommand(
+	TEXT("Kart.ProxyInterpolation.Bench"),
+	TEXT("Time the batched simulated proxy interpolation against the per proxy path for <Count> synthetic proxies (default 128)"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UGoKartProxyInterpolationSubsystem::RunBenchmark(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 128);
+	}));
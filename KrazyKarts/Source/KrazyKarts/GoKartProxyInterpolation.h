@@ -0,0 +1,87 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "GoKartProxyInterpolation.generated.h"
+
+class UGoKartMovementReplicator;
+
+//the Hermite location and slerp rotation segments of many proxies, stored as structure of arrays and evaluated four at a time
+struct KRAZYKARTS_API FGoKartProxyBatch
+{
+	int32 Num() const { return NumSegments; }
+	void SetNum(int32 NewNum);
+	void RemoveAtSwap(int32 Index);
+
+	//velocities are in m/s, Time is how far into the Duration long segment the proxy already is
+	void SetSegment(int32 Index, const FTransform& Start, const FVector& StartVelocity, const FTransform& Target, const FVector& TargetVelocity, float Duration, float Time);
+	bool IsMoving(int32 Index) const { return Durations[Index] >= KINDA_SMALL_NUMBER; }
+	float GetTime(int32 Index) const { return Times[Index]; }
+
+	//advance every segment by DeltaTime and evaluate location, velocity and rotation into the outputs
+	void Evaluate(float DeltaTime);
+
+	FVector GetLocation(int32 Index) const { return FVector(OutX[Index], OutY[Index], OutZ[Index]); }
+	FVector GetVelocity(int32 Index) const { return FVector(OutVX[Index], OutVY[Index], OutVZ[Index]); }
+	FQuat GetRotation(int32 Index) const { return FQuat(OutQX[Index], OutQY[Index], OutQZ[Index], OutQW[Index]); }
+
+private:
+	int32 NumSegments = 0;
+
+	//Hermite end points in cm and tangents in cm per segment
+	TArray<float> P0X, P0Y, P0Z, P1X, P1Y, P1Z;
+	TArray<float> T0X, T0Y, T0Z, T1X, T1Y, T1Z;
+	//rotation end points, with the angle between them and its inverse sine precomputed once per segment
+	TArray<float> Q0X, Q0Y, Q0Z, Q0W, Q1X, Q1Y, Q1Z, Q1W;
+	TArray<float> Omegas, InvSinOmegas;
+	TArray<float> Times, Durations;
+
+	TArray<float> OutX, OutY, OutZ, OutVX, OutVY, OutVZ;
+	TArray<float> OutQX, OutQY, OutQZ, OutQW;
+
+	template <typename FunctionType>
+	void ForEachArray(FunctionType Function);
+};
+
+//interpolates every simulated proxy on the client in one batched pass per frame instead of once per replicator tick
+UCLASS()
+class KRAZYKARTS_API UGoKartProxyInterpolationSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	void AddProxy(UGoKartMovementReplicator* Replicator);
+	void RemoveProxy(UGoKartMovementReplicator* Replicator);
+
+	void SetSegment(UGoKartMovementReplicator* Replicator, const FTransform& Start, const FVector& StartVelocity, const FTransform& Target, const FVector& TargetVelocity, float Duration, float Time);
+	//seconds since the proxy's current segment started
+	float GetTimeSinceUpdate(const UGoKartMovementReplicator* Replicator) const;
+
+	//jitter of the local player's connection from its clock sync, proxies stretch their segments by a margin of it
+	void SetConnectionJitter(float InJitter) { ConnectionJitter = InJitter; }
+	float GetConnectionJitter() const { return ConnectionJitter; }
+
+	//time the batched pass against per proxy splines for Count synthetic proxies
+	static void RunBenchmark(int32 Count);
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End FTickableGameObject interface
+
+private:
+	FGoKartProxyBatch Batch;
+
+	//slot i of the batch belongs to Replicators[i]
+	UPROPERTY()
+	TArray<UGoKartMovementReplicator*> Replicators;
+
+	TMap<const UGoKartMovementReplicator*, int32> Slots;
+
+	float ConnectionJitter = 0;
+};
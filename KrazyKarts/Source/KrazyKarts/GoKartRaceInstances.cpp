@@ -0,0 +1,249 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartRaceInstances.h"
+#include "GoKart.h"
+#include "EngineDefines.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformMemory.h"
+#include "Misc/App.h"
+
+void UGoKartRaceInstanceSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	BaselineUsedPhysical = FPlatformMemory::GetStats().UsedPhysical;
+}
+
+FVector UGoKartRaceInstanceSubsystem::GetInstanceOrigin(int32 InstanceId, float InstanceSpacing)
+{
+	if (InstanceId <= 0) return FVector::ZeroVector;
+
+	//ring R is the 8R cells at distance R from the centre cell, walked one side of 2R cells at a time
+	int32 Ring = 1;
+	int32 FirstInRing = 1;
+	while (InstanceId >= FirstInRing + 8 * Ring)
+	{
+		FirstInRing += 8 * Ring;
+		++Ring;
+	}
+	int32 Offset = InstanceId - FirstInRing;
+	int32 Step = Offset % (2 * Ring);
+
+	FIntPoint Cell;
+	switch (Offset / (2 * Ring)) {
+	case 0:
+		Cell = FIntPoint(Ring, Step - Ring);
+		break;
+	case 1:
+		Cell = FIntPoint(Ring - Step, Ring);
+		break;
+	case 2:
+		Cell = FIntPoint(-Ring, Ring - Step);
+		break;
+	default:
+		Cell = FIntPoint(Step - Ring, -Ring);
+		break;
+	}
+	return FVector(Cell.X * InstanceSpacing, Cell.Y * InstanceSpacing, 0);
+}
+
+int32 UGoKartRaceInstanceSubsystem::GetMaxInstances(float InstanceSpacing)
+{
+	if (InstanceSpacing <= 0) return 1;
+
+	//the outermost ring's space reaches half a spacing past its origins, all of it has to stay inside the world bounds
+	int32 Rings = FMath::Max(FMath::FloorToInt((HALF_WORLD_MAX - InstanceSpacing / 2) / InstanceSpacing), 0);
+	return FMath::Square(2 * Rings + 1);
+}
+
+int32 UGoKartRaceInstanceSubsystem::AssignPlayer(AController* Player, int32 MaxPlayersPerInstance, float InstanceSpacing)
+{
+	if (const int32* Existing = PlayerInstances.Find(Player))
+	{
+		return *Existing;
+	}
+
+	FGoKartRaceInstance* Target = nullptr;
+	for (FGoKartRaceInstance& Instance : Instances)
+	{
+		Instance.Players.RemoveAll([](const TWeakObjectPtr<AController>& P) { return !P.IsValid(); });
+		if (Instance.Players.Num() < MaxPlayersPerInstance)
+		{
+			Target = &Instance;
+			break;
+		}
+	}
+
+	if (Target == nullptr)
+	{
+		int32 Id = Instances.Num();
+		if (Id >= GetMaxInstances(InstanceSpacing))
+		{
+			UE_LOG(LogTemp, Warning, TEXT("No room for another race instance, %d instances fill the world at %.0f cm spacing"), Id, InstanceSpacing);
+			return INDEX_NONE;
+		}
+		Target = &Instances.AddDefaulted_GetRef();
+		Target->Id = Id;
+		Target->Origin = GetInstanceOrigin(Id, InstanceSpacing);
+	}
+
+	Target->Players.Add(Player);
+	PlayerInstances.Add(Player, Target->Id);
+	return Target->Id;
+}
+
+bool UGoKartRaceInstanceSubsystem::HasRoom(int32 MaxPlayersPerInstance, float InstanceSpacing) const
+{
+	if (Instances.Num() < GetMaxInstances(InstanceSpacing)) return true;
+
+	for (const FGoKartRaceInstance& Instance : Instances)
+	{
+		int32 NumPlayers = Instance.Players.FilterByPredicate([](const TWeakObjectPtr<AController>& P) { return P.IsValid(); }).Num();
+		if (NumPlayers < MaxPlayersPerInstance) return true;
+	}
+	return false;
+}
+
+void UGoKartRaceInstanceSubsystem::RemovePlayer(AController* Player)
+{
+	int32 InstanceId;
+	if (!PlayerInstances.RemoveAndCopyValue(Player, InstanceId)) return;
+
+	FGoKartRaceInstance* Instance = FindInstance(InstanceId);
+	if (Instance == nullptr) return;
+
+	Instance->Players.Remove(Player);
+}
+
+void UGoKartRaceInstanceSubsystem::AddKart(AGoKart* Kart, int32 InstanceId)
+{
+	FGoKartRaceInstance* Instance = FindInstance(InstanceId);
+	if (Instance == nullptr || Kart == nullptr) return;
+
+	Kart->SetRaceInstance(InstanceId);
+	Instance->Karts.AddUnique(Kart);
+	Kart->SetKartTickEnabled(Instance->bTickEnabled);
+	//a kart joining counts as activity, so an idle instance wakes up for it
+	Instance->LastActiveTime = GetWorld()->TimeSeconds;
+}
+
+void UGoKartRaceInstanceSubsystem::RemoveKart(AGoKart* Kart)
+{
+	FGoKartRaceInstance* Instance = Kart != nullptr ? FindInstance(Kart->GetRaceInstance()) : nullptr;
+	if (Instance == nullptr) return;
+
+	Instance->Karts.Remove(Kart);
+}
+
+void UGoKartRaceInstanceSubsystem::SetInstanceTickEnabled(int32 InstanceId, bool bEnabled)
+{
+	FGoKartRaceInstance* Instance = FindInstance(InstanceId);
+	if (Instance == nullptr || Instance->bTickEnabled == bEnabled) return;
+
+	Instance->bTickEnabled = bEnabled;
+	for (const TWeakObjectPtr<AGoKart>& Kart : Instance->Karts)
+	{
+		if (Kart.IsValid())
+		{
+			Kart->SetKartTickEnabled(bEnabled);
+		}
+	}
+}
+
+void UGoKartRaceInstanceSubsystem::SetInstanceIdle(int32 InstanceId, bool bIdle, float IdleInterval)
+{
+	FGoKartRaceInstance* Instance = FindInstance(InstanceId);
+	if (Instance == nullptr || Instance->bIdle == bIdle) return;
+
+	Instance->bIdle = bIdle;
+	for (const TWeakObjectPtr<AGoKart>& Kart : Instance->Karts)
+	{
+		if (Kart.IsValid())
+		{
+			Kart->SetKartTickInterval(bIdle ? IdleInterval : 0);
+		}
+	}
+}
+
+FGoKartRaceInstance* UGoKartRaceInstanceSubsystem::FindInstance(int32 InstanceId)
+{
+	return Instances.IsValidIndex(InstanceId) ? &Instances[InstanceId] : nullptr;
+}
+
+int32 UGoKartRaceInstanceSubsystem::CountActiveInstances() const
+{
+	int32 ActiveInstances = 0;
+	for (const FGoKartRaceInstance& Instance : Instances)
+	{
+		if (Instance.Players.Num() > 0) ActiveInstances++;
+	}
+	return ActiveInstances;
+}
+
+bool UGoKartRaceInstanceSubsystem::IsTickable() const
+{
+	return !IsTemplate() && GetWorld() != nullptr && GetWorld()->GetNetMode() != NM_Client;
+}
+
+TStatId UGoKartRaceInstanceSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartRaceInstanceSubsystem, STATGROUP_Tickables);
+}
+
+void UGoKartRaceInstanceSubsystem::Tick(float DeltaTime)
+{
+	//the server sleeps out the rest of each tick, only the time spent working is per race cost
+	float WorkMs = FMath::Max(FApp::GetDeltaTime() - FApp::GetIdleTime(), 0.0) * 1000;
+	FrameMs += (WorkMs - FrameMs) * 0.05f;
+
+	if (CountActiveInstances() == 0)
+	{
+		BaselineFrameMs = BaselineFrameMs < 0 ? WorkMs : BaselineFrameMs + (WorkMs - BaselineFrameMs) * 0.05f;
+	}
+}
+
+FString UGoKartRaceInstanceSubsystem::Describe() const
+{
+	int32 ActiveInstances = CountActiveInstances();
+	int32 Races = FMath::Max(ActiveInstances, 1);
+
+	FPlatformMemoryStats MemoryStats = FPlatformMemory::GetStats();
+	float UsedMB = MemoryStats.UsedPhysical / (1024.f * 1024.f);
+	float BaselineMB = BaselineUsedPhysical / (1024.f * 1024.f);
+	float BaselineMs = FMath::Max(BaselineFrameMs, 0.f);
+
+	//what each race adds on top of the empty server, a process of its own would carry the empty server as well
+	float RaceMB = (UsedMB - BaselineMB) / Races;
+	float RaceMs = FMath::Max(FrameMs - BaselineMs, 0.f) / Races;
+	float SharedMB = UsedMB / Races;
+	float SharedMs = FrameMs / Races;
+	float SeparateMB = BaselineMB + RaceMB;
+	float SeparateMs = BaselineMs + RaceMs;
+
+	FString Result = FString::Printf(TEXT("%d race instances (%d active), %.1f MB used, %.2f ms game thread per frame\n"),
+		Instances.Num(), ActiveInstances, UsedMB, FrameMs);
+	Result += FString::Printf(TEXT("  empty server %.1f MB / %s, each race adds %.1f MB / %.2f ms\n"),
+		BaselineMB, BaselineFrameMs < 0 ? TEXT("not measured yet") : *FString::Printf(TEXT("%.2f ms"), BaselineMs), RaceMB, RaceMs);
+	Result += FString::Printf(TEXT("  per race: %.1f MB / %.2f ms shared here, %.1f MB / %.2f ms as one process per race (%.0f%% of the memory)\n"),
+		SharedMB, SharedMs, SeparateMB, SeparateMs, SharedMB / FMath::Max(SeparateMB, 1.f) * 100);
+
+	for (const FGoKartRaceInstance& Instance : Instances)
+	{
+		Result += FString::Printf(TEXT("  [%d] origin %s, %d players, %d karts, ticking %s\n"),
+			Instance.Id, *Instance.Origin.ToString(), Instance.Players.Num(), Instance.Karts.Num(),
+			!Instance.bTickEnabled ? TEXT("off") : Instance.bIdle ? TEXT("idle") : TEXT("on"));
+	}
+	return Result;
+}
+
+static FAutoConsoleCommandWithWorld KartInstancesCommand(
+	TEXT("Kart.Instances"),
+	TEXT("List the race instances hosted by this server with their per race memory and frame cost"),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		UGoKartRaceInstanceSubsystem* Instances = World != nullptr ? World->GetSubsystem<UGoKartRaceInstanceSubsystem>() : nullptr;
+		if (Instances == nullptr) return;
+		UE_LOG(LogTemp, Log, TEXT("%s"), *Instances->Describe());
+	}));
@@ -0,0 +1,77 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "GoKartRaceInstances.generated.h"
+
+class AGoKart;
+
+//one isolated race hosted inside a shared server world
+struct FGoKartRaceInstance
+{
+	int32 Id;
+	//every instance gets its own copy of the track space, offset from the others
+	FVector Origin;
+	TArray<TWeakObjectPtr<AController>> Players;
+	TArray<TWeakObjectPtr<AGoKart>> Karts;
+	bool bTickEnabled = true;
+	//no input or movement for a while, the karts tick at the idle interval
+	bool bIdle = false;
+	float LastActiveTime = 0;
+};
+
+//lets one server process host several independent races, each with its own kart set and relevancy
+UCLASS()
+class KRAZYKARTS_API UGoKartRaceInstanceSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+
+	//puts the player in the first instance with room, opening a new one if they are all full, INDEX_NONE when the world has no room for another
+	int32 AssignPlayer(AController* Player, int32 MaxPlayersPerInstance, float InstanceSpacing);
+	void RemovePlayer(AController* Player);
+	//a player joining now would get a place in an existing or a new instance
+	bool HasRoom(int32 MaxPlayersPerInstance, float InstanceSpacing) const;
+
+	//instances fill the rings of a square grid outwards from the world origin, InstanceSpacing cm apart
+	static FVector GetInstanceOrigin(int32 InstanceId, float InstanceSpacing);
+	//how many instances fit in the grid with every instance's space inside the world bounds
+	static int32 GetMaxInstances(float InstanceSpacing);
+
+	void AddKart(AGoKart* Kart, int32 InstanceId);
+	void RemoveKart(AGoKart* Kart);
+
+	//enable or disable ticking for every kart of one instance together
+	void SetInstanceTickEnabled(int32 InstanceId, bool bEnabled);
+	//slow every kart of one instance down to IdleInterval between ticks, or back to every frame
+	void SetInstanceIdle(int32 InstanceId, bool bIdle, float IdleInterval);
+
+	FGoKartRaceInstance* FindInstance(int32 InstanceId);
+	const TArray<FGoKartRaceInstance>& GetInstances() const { return Instances; }
+
+	FString Describe() const;
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End FTickableGameObject interface
+
+private:
+	int32 CountActiveInstances() const;
+
+	TArray<FGoKartRaceInstance> Instances;
+	TMap<TWeakObjectPtr<AController>, int32> PlayerInstances;
+
+	//the empty server, the fixed cost a separate process per race would pay once for every race
+	uint64 BaselineUsedPhysical = 0;
+	float BaselineFrameMs = -1;
+	//smoothed game thread time per frame, without the wait for the tick rate
+	float FrameMs = 0;
+};
@@ -0,0 +1,312 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartRaceProgress.h"
+#include "KrazyKarts.h"
+#include "GoKart.h"
+#include "GoKartTrack.h"
+#include "GoKartRaceInstances.h"
+#include "HAL/IConsoleManager.h"
+
+DECLARE_CYCLE_STAT(TEXT("Race Progress"), STAT_KartRaceProgress, STATGROUP_KrazyKarts);
+
+namespace
+{
+	float Cross2D(const FVector& A, const FVector& B)
+	{
+		return A.X * B.Y - A.Y * B.X;
+	}
+
+	//true when segment P1 P2 crosses segment Q1 Q2 in the ground plane
+	bool SegmentsCross2D(const FVector& P1, const FVector& P2, const FVector& Q1, const FVector& Q2)
+	{
+		FVector P = P2 - P1;
+		FVector Q = Q2 - Q1;
+		float Denominator = Cross2D(P, Q);
+		if (FMath::Abs(Denominator) < KINDA_SMALL_NUMBER) return false;
+
+		float T = Cross2D(Q1 - P1, Q) / Denominator;
+		float U = Cross2D(Q1 - P1, P) / Denominator;
+		return T >= 0 && T <= 1 && U >= 0 && U <= 1;
+	}
+}
+
+bool UGoKartRaceProgressSubsystem::IsTickable() const
+{
+	return !IsTemplate() && Karts.Num() > 0;
+}
+
+TStatId UGoKartRaceProgressSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartRaceProgressSubsystem, STATGROUP_Tickables);
+}
+
+void UGoKartRaceProgressSubsystem::AddKart(AGoKart* Kart)
+{
+	if (Kart == nullptr || Karts.Contains(Kart)) return;
+
+	Karts.Add(Kart);
+	Instances.Add(INDEX_NONE);
+	Origins.Add(FVector::ZeroVector);
+	PreviousLocations.Add(Kart->GetActorLocation());
+	Locations.Add(Kart->GetActorLocation());
+	Hints.Add(INDEX_NONE);
+	Laps.Add(0);
+	NextCheckpoints.Add(0);
+	Progress.Add(0);
+	Positions.Add(0);
+	bActive.Add(false);
+	ListedIn.Add(INDEX_NONE);
+}
+
+void UGoKartRaceProgressSubsystem::RemoveKart(AGoKart* Kart)
+{
+	int32 Index = Karts.IndexOfByKey(Kart);
+	if (Index == INDEX_NONE) return;
+
+	Karts.RemoveAtSwap(Index);
+	Instances.RemoveAtSwap(Index);
+	Origins.RemoveAtSwap(Index);
+	PreviousLocations.RemoveAtSwap(Index);
+	Locations.RemoveAtSwap(Index);
+	Hints.RemoveAtSwap(Index);
+	Laps.RemoveAtSwap(Index);
+	NextCheckpoints.RemoveAtSwap(Index);
+	Progress.RemoveAtSwap(Index);
+	Positions.RemoveAtSwap(Index);
+	bActive.RemoveAtSwap(Index);
+	ListedIn.RemoveAtSwap(Index);
+
+	//indices have moved, the lists are rebuilt and fully sorted once on the next tick
+	Standings.Reset();
+	for (int32& Listed : ListedIn)
+	{
+		Listed = INDEX_NONE;
+	}
+}
+
+void UGoKartRaceProgressSubsystem::ResetKart(AGoKart* Kart)
+{
+	int32 Index = Karts.IndexOfByKey(Kart);
+	if (Index == INDEX_NONE) return;
+
+	PreviousLocations[Index] = Kart->GetActorLocation();
+	Hints[Index] = INDEX_NONE;
+	Laps[Index] = 0;
+	NextCheckpoints[Index] = 0;
+	Progress[Index] = 0;
+}
+
+int32 UGoKartRaceProgressSubsystem::GetLap(const AGoKart* Kart) const
+{
+	int32 Index = Karts.IndexOfByKey(Kart);
+	return Index != INDEX_NONE ? Laps[Index] : 0;
+}
+
+int32 UGoKartRaceProgressSubsystem::GetPosition(const AGoKart* Kart) const
+{
+	int32 Index = Karts.IndexOfByKey(Kart);
+	return Index != INDEX_NONE ? Positions[Index] : 0;
+}
+
+TArray<AGoKart*> UGoKartRaceProgressSubsystem::GetStandings(int32 InstanceId) const
+{
+	TArray<AGoKart*> Result;
+	if (const TArray<int32>* Order = Standings.Find(InstanceId))
+	{
+		for (int32 Index : *Order)
+		{
+			Result.Add(Karts[Index].Get());
+		}
+	}
+	return Result;
+}
+
+void UGoKartRaceProgressSubsystem::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartRaceProgress);
+
+	Gather();
+	Project();
+	CrossCheckpoints();
+	Rank();
+
+	//listeners run after the pass, so they see this tick's standings
+	for (const TPair<AGoKart*, int32>& Completed : CompletedLaps)
+	{
+		OnLapCompleted.Broadcast(Completed.Key, Completed.Value);
+	}
+	CompletedLaps.Reset();
+}
+
+void UGoKartRaceProgressSubsystem::Gather()
+{
+	UGoKartRaceInstanceSubsystem* RaceInstances = GetWorld()->GetSubsystem<UGoKartRaceInstanceSubsystem>();
+
+	for (int32 Index = 0; Index < Karts.Num(); ++Index)
+	{
+		AGoKart* Kart = Karts[Index].Get();
+		bool bWasActive = bActive[Index];
+		//parked, hibernating or gone
+		bActive[Index] = Kart != nullptr && !Kart->IsHidden() && Kart->IsActorTickEnabled();
+		if (!bActive[Index]) continue;
+
+		//the kart may have been moved while it wasn't tracked, start over from where it is now
+		if (!bWasActive)
+		{
+			Hints[Index] = INDEX_NONE;
+		}
+
+		PreviousLocations[Index] = Locations[Index];
+		Locations[Index] = Kart->GetActorLocation();
+		Instances[Index] = Kart->GetRaceInstance();
+
+		FGoKartRaceInstance* Instance = RaceInstances != nullptr ? RaceInstances->FindInstance(Instances[Index]) : nullptr;
+		Origins[Index] = Instance != nullptr ? Instance->Origin : FVector::ZeroVector;
+	}
+}
+
+void UGoKartRaceProgressSubsystem::Project()
+{
+	AGoKartTrack* Track = AGoKartTrack::Find(GetWorld());
+	if (Track == nullptr) return;
+
+	const FGoKartTrackTable& Table = Track->GetCenterlineTable();
+	const TArray<int32>& Checkpoints = Track->GetCheckpoints();
+	if (Table.Num() == 0 || Checkpoints.Num() == 0) return;
+	float TableLength = Table.GetTableLength();
+
+	for (int32 Index = 0; Index < Karts.Num(); ++Index)
+	{
+		if (!bActive[Index]) continue;
+
+		//the centerline is baked for the first instance, the others are offset copies
+		FVector TrackLocation = Locations[Index] - Origins[Index];
+		if (Hints[Index] == INDEX_NONE)
+		{
+			PreviousLocations[Index] = Locations[Index];
+		}
+		Hints[Index] = Table.FindNearest(TrackLocation, Hints[Index]);
+		float Distance = Table.ProjectDistance(TrackLocation, Hints[Index]);
+
+		//held between the last gate crossed and the one still to be crossed, so reversing over the line or cutting across gains nothing
+		int32 Next = NextCheckpoints[Index];
+		int32 Last = (Next + Checkpoints.Num() - 1) % Checkpoints.Num();
+		float Floor = Table.GetDistance(Checkpoints[Last]);
+		float Cap = Next == 0 ? TableLength : Table.GetDistance(Checkpoints[Next]);
+		if (Distance < Floor || Distance > Cap)
+		{
+			//outside the window the projection may have wrapped round the loop, go to whichever end is nearer along the track
+			float PastCap = FMath::Fmod(Distance - Cap + TableLength, TableLength);
+			float BehindFloor = FMath::Fmod(Floor - Distance + TableLength, TableLength);
+			Distance = PastCap < BehindFloor ? Cap : Floor;
+		}
+		Progress[Index] = Laps[Index] * TableLength + Distance;
+	}
+}
+
+void UGoKartRaceProgressSubsystem::CrossCheckpoints()
+{
+	AGoKartTrack* Track = AGoKartTrack::Find(GetWorld());
+	if (Track == nullptr) return;
+
+	const FGoKartTrackTable& Table = Track->GetCenterlineTable();
+	const TArray<int32>& Checkpoints = Track->GetCheckpoints();
+	if (Table.Num() == 0 || Checkpoints.Num() == 0) return;
+	float HalfWidth = Track->GetCheckpointHalfWidth();
+
+	for (int32 Index = 0; Index < Karts.Num(); ++Index)
+	{
+		if (!bActive[Index]) continue;
+
+		//only the next gate in order counts
+		int32 Sample = Checkpoints[NextCheckpoints[Index]];
+		const FVector& Direction = Table.Directions[Sample];
+		FVector Center = Table.Locations[Sample] + Origins[Index];
+		FVector Across = FVector(-Direction.Y, Direction.X, 0).GetSafeNormal() * HalfWidth;
+
+		FVector Movement = Locations[Index] - PreviousLocations[Index];
+		if (FVector::DotProduct(Movement, Direction) <= 0) continue;
+		if (!SegmentsCross2D(PreviousLocations[Index], Locations[Index], Center - Across, Center + Across)) continue;
+
+		if (NextCheckpoints[Index] == 0)
+		{
+			Laps[Index]++;
+			if (Laps[Index] > 1)
+			{
+				CompletedLaps.Emplace(Karts[Index].Get(), Laps[Index] - 1);
+			}
+		}
+		NextCheckpoints[Index] = (NextCheckpoints[Index] + 1) % Checkpoints.Num();
+	}
+}
+
+void UGoKartRaceProgressSubsystem::Rank()
+{
+	//keep every list to the active karts of its instance, without disturbing their order
+	for (TPair<int32, TArray<int32>>& Pair : Standings)
+	{
+		int32 InstanceId = Pair.Key;
+		Pair.Value.RemoveAll([this, InstanceId](int32 Index)
+		{
+			bool bStays = bActive[Index] && Instances[Index] == InstanceId;
+			if (!bStays)
+			{
+				ListedIn[Index] = INDEX_NONE;
+				Positions[Index] = 0;
+			}
+			return !bStays;
+		});
+	}
+	for (int32 Index = 0; Index < Karts.Num(); ++Index)
+	{
+		if (bActive[Index] && ListedIn[Index] == INDEX_NONE)
+		{
+			Standings.FindOrAdd(Instances[Index]).Add(Index);
+			ListedIn[Index] = Instances[Index];
+		}
+	}
+
+	//overtakes are rare, so insertion sort on last tick's order is close to linear
+	for (TPair<int32, TArray<int32>>& Pair : Standings)
+	{
+		TArray<int32>& Order = Pair.Value;
+		for (int32 Slot = 1; Slot < Order.Num(); ++Slot)
+		{
+			int32 Kart = Order[Slot];
+			int32 Insert = Slot;
+			while (Insert > 0 && Progress[Order[Insert - 1]] < Progress[Kart])
+			{
+				Order[Insert] = Order[Insert - 1];
+				Insert--;
+			}
+			Order[Insert] = Kart;
+		}
+
+		for (int32 Slot = 0; Slot < Order.Num(); ++Slot)
+		{
+			Positions[Order[Slot]] = Slot + 1;
+		}
+	}
+}
+
+static FAutoConsoleCommandWithWorld KartStandingsCommand(
+	TEXT("Kart.Standings"),
+	TEXT("Log every race instance's standings with laps and positions"),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		UGoKartRaceProgressSubsystem* RaceProgress = World != nullptr ? World->GetSubsystem<UGoKartRaceProgressSubsystem>() : nullptr;
+		UGoKartRaceInstanceSubsystem* Instances = World != nullptr ? World->GetSubsystem<UGoKartRaceInstanceSubsystem>() : nullptr;
+		if (RaceProgress == nullptr || Instances == nullptr) return;
+
+		for (const FGoKartRaceInstance& Instance : Instances->GetInstances())
+		{
+			TArray<AGoKart*> Standings = RaceProgress->GetStandings(Instance.Id);
+			UE_LOG(LogTemp, Log, TEXT("Race instance %d:"), Instance.Id);
+			for (AGoKart* Kart : Standings)
+			{
+				if (Kart == nullptr) continue;
+				UE_LOG(LogTemp, Log, TEXT("  %d. %s, lap %d"), RaceProgress->GetPosition(Kart), *Kart->GetName(), RaceProgress->GetLap(Kart));
+			}
+		}
+	}));
@@ -0,0 +1,67 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "GoKartRaceProgress.generated.h"
+
+class AGoKart;
+
+DECLARE_MULTICAST_DELEGATE_TwoParams(FGoKartLapCompleted, AGoKart* /*Kart*/, int32 /*Lap*/);
+
+//tracks laps, checkpoints and standings of every kart by projecting them onto the track's centerline, no overlap volumes involved
+UCLASS()
+class KRAZYKARTS_API UGoKartRaceProgressSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	void AddKart(AGoKart* Kart);
+	void RemoveKart(AGoKart* Kart);
+	//back to the grid, no laps and no checkpoints
+	void ResetKart(AGoKart* Kart);
+
+	int32 GetLap(const AGoKart* Kart) const;
+	//1 for the leader of the kart's race instance, 0 when the kart isn't tracked
+	int32 GetPosition(const AGoKart* Kart) const;
+	//karts of one race instance from first to last
+	TArray<AGoKart*> GetStandings(int32 InstanceId) const;
+
+	FGoKartLapCompleted OnLapCompleted;
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End FTickableGameObject interface
+
+private:
+	void Gather();
+	void Project();
+	void CrossCheckpoints();
+	void Rank();
+
+	//per kart state, kept between ticks
+	TArray<TWeakObjectPtr<AGoKart>> Karts;
+	TArray<int32> Instances;
+	TArray<FVector> Origins;
+	TArray<FVector> PreviousLocations;
+	TArray<FVector> Locations;
+	TArray<int32> Hints;
+	TArray<int32> Laps;
+	TArray<int32> NextCheckpoints;
+	//laps times track length plus the distance along the lap, capped at the next checkpoint
+	TArray<float> Progress;
+	TArray<int32> Positions;
+	TArray<bool> bActive;
+	//instance whose standings list the kart is in, INDEX_NONE when it isn't in one
+	TArray<int32> ListedIn;
+
+	//kart indices of every instance in standing order, nearly sorted from one tick to the next
+	TMap<int32, TArray<int32>> Standings;
+
+	TArray<TPair<AGoKart*, int32>> CompletedLaps;
+};
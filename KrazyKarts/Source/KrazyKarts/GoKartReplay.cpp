@@ -0,0 +1,623 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartReplay.h"
+#include "KrazyKarts.h"
+#include "GoKart.h"
+#include "GoKartMovementComponent.h"
+#include "GoKartPool.h"
+#include "EngineUtils.h"
+#include "Algo/BinarySearch.h"
+#include "GameFramework/GameModeBase.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/Compression.h"
+#include "Misc/CommandLine.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryWriter.h"
+#include "Serialization/MemoryReader.h"
+
+DECLARE_CYCLE_STAT(TEXT("Replay Record"), STAT_KartReplayRecord, STATGROUP_KrazyKarts);
+DECLARE_CYCLE_STAT(TEXT("Replay Playback"), STAT_KartReplayPlayback, STATGROUP_KrazyKarts);
+DECLARE_CYCLE_STAT(TEXT("Replay Seek"), STAT_KartReplaySeek, STATGROUP_KrazyKarts);
+
+namespace
+{
+	void SerializeRotation(FArchive& Ar, FRotator& Rotation)
+	{
+		uint16 Pitch = FRotator::CompressAxisToShort(Rotation.Pitch);
+		uint16 Yaw = FRotator::CompressAxisToShort(Rotation.Yaw);
+		uint16 Roll = FRotator::CompressAxisToShort(Rotation.Roll);
+		Ar << Pitch << Yaw << Roll;
+		Rotation = FRotator(FRotator::DecompressAxisFromShort(Pitch), FRotator::DecompressAxisFromShort(Yaw), FRotator::DecompressAxisFromShort(Roll));
+	}
+
+	void SerializeInputs(FArchive& Ar, FGoKartMove& Move)
+	{
+		int8 Force = (int8)FMath::RoundToInt(FMath::Clamp(Move.Force, -1.f, 1.f) * 127);
+		int8 Steering = (int8)FMath::RoundToInt(FMath::Clamp(Move.SteeringCrank, -1.f, 1.f) * 127);
+		Ar << Force << Steering;
+		Move.Force = Force / 127.f;
+		Move.SteeringCrank = Steering / 127.f;
+	}
+
+	bool FitsDelta(const FVector& Delta)
+	{
+		return FMath::Abs(Delta.X) < MAX_int16 && FMath::Abs(Delta.Y) < MAX_int16 && FMath::Abs(Delta.Z) < MAX_int16;
+	}
+
+	//writes Value - Reference in steps of 1/Scale and moves Reference by what the reader will reconstruct
+	void SerializeDelta(FArchive& Ar, const FVector& Value, FVector& Reference, float Scale)
+	{
+		FVector Delta = (Value - Reference) * Scale;
+		int16 X = (int16)FMath::RoundToInt(Delta.X);
+		int16 Y = (int16)FMath::RoundToInt(Delta.Y);
+		int16 Z = (int16)FMath::RoundToInt(Delta.Z);
+		Ar << X << Y << Z;
+		Reference += FVector(X, Y, Z) / Scale;
+	}
+
+	void ReadDelta(FArchive& Ar, FVector& Reference, float Scale)
+	{
+		int16 X = 0, Y = 0, Z = 0;
+		Ar << X << Y << Z;
+		Reference += FVector(X, Y, Z) / Scale;
+	}
+}
+
+void FGoKartReplayFormat::WriteKeyframe(FArchive& Ar, const FGoKartReplayFrame& Frame, TArray<FGoKartState>& OutReconstructed)
+{
+	float Time = Frame.Time;
+	int32 NumKarts = Frame.KartIds.Num();
+	Ar << Time << NumKarts;
+
+	OutReconstructed.SetNum(NumKarts);
+	for (int32 Kart = 0; Kart < NumKarts; ++Kart)
+	{
+		uint32 KartId = Frame.KartIds[Kart];
+		FGoKartState& State = OutReconstructed[Kart];
+		State = Frame.States[Kart];
+
+		FVector Location = State.Transform.GetLocation();
+		FRotator Rotation = State.Transform.Rotator();
+		Ar << KartId << Location;
+		SerializeRotation(Ar, Rotation);
+		Ar << State.Velocity;
+		SerializeInputs(Ar, State.LastMove);
+		State.Transform = FTransform(Rotation, Location);
+	}
+}
+
+bool FGoKartReplayFormat::CanWriteDelta(const FGoKartReplayFrame& Frame, const TArray<uint32>& ChunkKarts, const TArray<FGoKartState>& Reconstructed)
+{
+	if (Frame.KartIds != ChunkKarts) return false;
+
+	for (int32 Kart = 0; Kart < ChunkKarts.Num(); ++Kart)
+	{
+		const FGoKartState& State = Frame.States[Kart];
+		const FGoKartState& Reference = Reconstructed[Kart];
+		if (!FitsDelta((State.Transform.GetLocation() - Reference.Transform.GetLocation()) * LocationScale)) return false;
+		if (!FitsDelta((State.Velocity - Reference.Velocity) * VelocityScale)) return false;
+	}
+	return true;
+}
+
+void FGoKartReplayFormat::WriteDelta(FArchive& Ar, const FGoKartReplayFrame& Frame, const TArray<uint32>& ChunkKarts, TArray<FGoKartState>& InOutReconstructed)
+{
+	float Time = Frame.Time;
+	Ar << Time;
+
+	for (int32 Kart = 0; Kart < ChunkKarts.Num(); ++Kart)
+	{
+		const FGoKartState& State = Frame.States[Kart];
+		FGoKartState& Reference = InOutReconstructed[Kart];
+
+		FVector Location = Reference.Transform.GetLocation();
+		FRotator Rotation = State.Transform.Rotator();
+		SerializeDelta(Ar, State.Transform.GetLocation(), Location, LocationScale);
+		SerializeRotation(Ar, Rotation);
+		SerializeDelta(Ar, State.Velocity, Reference.Velocity, VelocityScale);
+		Reference.LastMove = State.LastMove;
+		SerializeInputs(Ar, Reference.LastMove);
+		Reference.Transform = FTransform(Rotation, Location);
+	}
+}
+
+bool FGoKartReplayFormat::ReadIndex(FArchive& Reader, TArray<FChunkInfo>& OutChunks)
+{
+	const int64 FooterSize = sizeof(int32) + sizeof(int64) + sizeof(uint32);
+	if (Reader.TotalSize() < FooterSize) return false;
+
+	uint32 HeaderMagic = 0, HeaderVersion = 0;
+	Reader.Seek(0);
+	Reader << HeaderMagic << HeaderVersion;
+	if (HeaderMagic != Magic || HeaderVersion != Version) return false;
+
+	int32 NumChunks = 0;
+	int64 IndexOffset = 0;
+	uint32 FooterMagic = 0;
+	Reader.Seek(Reader.TotalSize() - FooterSize);
+	Reader << NumChunks << IndexOffset << FooterMagic;
+	if (FooterMagic != Magic || NumChunks < 0) return false;
+
+	OutChunks.SetNum(NumChunks);
+	Reader.Seek(IndexOffset);
+	for (FChunkInfo& Chunk : OutChunks)
+	{
+		Reader << Chunk.Offset << Chunk.StartTime << Chunk.EndTime;
+	}
+	return !Reader.IsError();
+}
+
+bool FGoKartReplayFormat::ReadChunk(FArchive& Reader, const FChunkInfo& Chunk, TArray<FGoKartReplayFrame>& OutFrames)
+{
+	float StartTime, EndTime;
+	int32 NumFrames = 0, RawSize = 0, CompressedSize = 0;
+
+	Reader.Seek(Chunk.Offset);
+	Reader << StartTime << EndTime << NumFrames << RawSize << CompressedSize;
+	if (NumFrames <= 0 || RawSize <= 0 || CompressedSize <= 0) return false;
+
+	TArray<uint8> Compressed;
+	Compressed.SetNumUninitialized(CompressedSize);
+	Reader.Serialize(Compressed.GetData(), CompressedSize);
+
+	TArray<uint8> Raw;
+	Raw.SetNumUninitialized(RawSize);
+	if (!FCompression::UncompressMemory(NAME_Zlib, Raw.GetData(), RawSize, Compressed.GetData(), CompressedSize)) return false;
+
+	FMemoryReader Ar(Raw);
+	OutFrames.SetNum(NumFrames);
+
+	//keyframe
+	FGoKartReplayFrame& Keyframe = OutFrames[0];
+	int32 NumKarts = 0;
+	Ar << Keyframe.Time << NumKarts;
+	if (NumKarts < 0 || NumKarts > RawSize) return false;
+
+	Keyframe.KartIds.SetNum(NumKarts);
+	Keyframe.States.SetNum(NumKarts);
+	for (int32 Kart = 0; Kart < NumKarts; ++Kart)
+	{
+		FGoKartState& State = Keyframe.States[Kart];
+		FVector Location;
+		FRotator Rotation;
+		Ar << Keyframe.KartIds[Kart] << Location;
+		SerializeRotation(Ar, Rotation);
+		Ar << State.Velocity;
+		SerializeInputs(Ar, State.LastMove);
+		State.Transform = FTransform(Rotation, Location);
+	}
+
+	//deltas against the frame before
+	for (int32 FrameIndex = 1; FrameIndex < NumFrames; ++FrameIndex)
+	{
+		const FGoKartReplayFrame& Previous = OutFrames[FrameIndex - 1];
+		FGoKartReplayFrame& Frame = OutFrames[FrameIndex];
+		Ar << Frame.Time;
+		Frame.KartIds = Previous.KartIds;
+		Frame.States.SetNum(NumKarts);
+
+		for (int32 Kart = 0; Kart < NumKarts; ++Kart)
+		{
+			FGoKartState& State = Frame.States[Kart];
+			FVector Location = Previous.States[Kart].Transform.GetLocation();
+			FRotator Rotation;
+			State.Velocity = Previous.States[Kart].Velocity;
+
+			ReadDelta(Ar, Location, LocationScale);
+			SerializeRotation(Ar, Rotation);
+			ReadDelta(Ar, State.Velocity, VelocityScale);
+			SerializeInputs(Ar, State.LastMove);
+			State.Transform = FTransform(Rotation, Location);
+		}
+	}
+	return !Ar.IsError();
+}
+
+void UGoKartReplaySubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	//-KartReplay=<file> records the whole session
+	FString FileName;
+	if (GetWorld()->IsGameWorld() && FParse::Value(FCommandLine::Get(), TEXT("KartReplay="), FileName))
+	{
+		StartRecording(FileName);
+	}
+}
+
+void UGoKartReplaySubsystem::Deinitialize()
+{
+	StopRecording();
+	StopPlayback();
+	Super::Deinitialize();
+}
+
+FString UGoKartReplaySubsystem::ResolvePath(const FString& FileName)
+{
+	return FPaths::IsRelative(FileName) ? FPaths::ProjectSavedDir() / TEXT("Replays") / FileName : FileName;
+}
+
+bool UGoKartReplaySubsystem::StartRecording(const FString& FileName)
+{
+	StopRecording();
+	if (GetWorld()->GetNetMode() == NM_Client)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Kart replays are recorded on the server"));
+		return false;
+	}
+
+	RecordPath = ResolvePath(FileName);
+	RecordFile.Reset(IFileManager::Get().CreateFileWriter(*RecordPath));
+	if (!RecordFile.IsValid())
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not start replay recording to %s"), *RecordPath);
+		return false;
+	}
+
+	uint32 HeaderMagic = FGoKartReplayFormat::Magic;
+	uint32 HeaderVersion = FGoKartReplayFormat::Version;
+	*RecordFile << HeaderMagic << HeaderVersion;
+
+	RecordIndex.Reset();
+	ChunkKarts.Reset();
+	ChunkFrames = 0;
+	TimeUntilSample = 0;
+	RecordStartTime = GetWorld()->TimeSeconds;
+	RecordCostSeconds = 0;
+	KartSamples = 0;
+
+	UE_LOG(LogTemp, Log, TEXT("Recording kart replay to %s"), *RecordPath);
+	return true;
+}
+
+void UGoKartReplaySubsystem::StopRecording()
+{
+	if (!RecordFile.IsValid()) return;
+
+	EndChunk();
+
+	int64 IndexOffset = RecordFile->Tell();
+	for (FGoKartReplayFormat::FChunkInfo& Info : RecordIndex)
+	{
+		*RecordFile << Info.Offset << Info.StartTime << Info.EndTime;
+	}
+	int32 NumChunks = RecordIndex.Num();
+	uint32 FooterMagic = FGoKartReplayFormat::Magic;
+	*RecordFile << NumChunks << IndexOffset << FooterMagic;
+
+	int64 FileSize = RecordFile->Tell();
+	RecordFile->Close();
+	RecordFile.Reset();
+
+	float KartMinutes = KartSamples * SampleInterval / 60;
+	UE_LOG(LogTemp, Log, TEXT("Kart replay %s: %lld bytes in %d chunks, %.1f KB per kart minute, %.2f ms recording"),
+		*RecordPath, FileSize, NumChunks, KartMinutes > 0 ? FileSize / 1024.f / KartMinutes : 0.f, RecordCostSeconds * 1000);
+}
+
+bool UGoKartReplaySubsystem::IsTickable() const
+{
+	return !IsTemplate() && (RecordFile.IsValid() || PlaybackFile.IsValid());
+}
+
+TStatId UGoKartReplaySubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartReplaySubsystem, STATGROUP_Tickables);
+}
+
+void UGoKartReplaySubsystem::Tick(float DeltaTime)
+{
+	if (PlaybackFile.IsValid())
+	{
+		PlaybackTick(DeltaTime);
+	}
+
+	if (RecordFile.IsValid())
+	{
+		TimeUntilSample -= DeltaTime;
+		if (TimeUntilSample <= 0)
+		{
+			TimeUntilSample += SampleInterval;
+			TimeUntilSample = FMath::Max(TimeUntilSample, 0.f);
+			RecordFrame();
+		}
+	}
+}
+
+void UGoKartReplaySubsystem::RecordFrame()
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartReplayRecord);
+	double StartTime = FPlatformTime::Seconds();
+
+	FGoKartReplayFrame Frame;
+	Frame.Time = GetWorld()->TimeSeconds - RecordStartTime;
+	for (TActorIterator<AGoKart> It(GetWorld()); It; ++It)
+	{
+		AGoKart* Kart = *It;
+		//parked in the pool or driven by a replay
+		if (Kart->IsHidden()) continue;
+		UGoKartMovementComponent* MovementComponent = Kart->FindComponentByClass<UGoKartMovementComponent>();
+		UGoKartMovementReplicator* MovementReplicator = Kart->FindComponentByClass<UGoKartMovementReplicator>();
+		if (MovementComponent == nullptr || MovementReplicator == nullptr || MovementReplicator->IsReplayPlayback()) continue;
+
+		//the actor rather than the published ServerState, which may lag behind by the publish budget
+		FGoKartState& State = Frame.States.AddDefaulted_GetRef();
+		State.Transform = Kart->GetActorTransform();
+		State.Velocity = MovementComponent->GetVelocity();
+		State.LastMove = MovementComponent->GetLastMove();
+		Frame.KartIds.Add(Kart->GetUniqueID());
+	}
+	KartSamples += Frame.KartIds.Num();
+
+	if (ChunkFrames > 0 && (ChunkFrames >= FramesPerChunk || !FGoKartReplayFormat::CanWriteDelta(Frame, ChunkKarts, Reconstructed)))
+	{
+		EndChunk();
+	}
+
+	if (ChunkFrames == 0)
+	{
+		BeginChunk(Frame);
+	}
+	else
+	{
+		FGoKartReplayFormat::WriteDelta(*ChunkWriter, Frame, ChunkKarts, Reconstructed);
+	}
+	ChunkEndTime = Frame.Time;
+	ChunkFrames++;
+
+	RecordCostSeconds += FPlatformTime::Seconds() - StartTime;
+}
+
+void UGoKartReplaySubsystem::BeginChunk(const FGoKartReplayFrame& Frame)
+{
+	ChunkData.Reset();
+	ChunkWriter = MakeUnique<FMemoryWriter>(ChunkData);
+	ChunkKarts = Frame.KartIds;
+	ChunkStartTime = Frame.Time;
+	FGoKartReplayFormat::WriteKeyframe(*ChunkWriter, Frame, Reconstructed);
+}
+
+void UGoKartReplaySubsystem::EndChunk()
+{
+	if (ChunkFrames == 0 || !RecordFile.IsValid()) return;
+
+	int32 RawSize = ChunkData.Num();
+	int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Zlib, RawSize);
+	TArray<uint8> Compressed;
+	Compressed.SetNumUninitialized(CompressedSize);
+	int32 NumFrames = ChunkFrames;
+	ChunkFrames = 0;
+	if (!FCompression::CompressMemory(NAME_Zlib, Compressed.GetData(), CompressedSize, ChunkData.GetData(), RawSize)) return;
+
+	FGoKartReplayFormat::FChunkInfo& Info = RecordIndex.AddDefaulted_GetRef();
+	Info.Offset = RecordFile->Tell();
+	Info.StartTime = ChunkStartTime;
+	Info.EndTime = ChunkEndTime;
+
+	*RecordFile << Info.StartTime << Info.EndTime << NumFrames << RawSize << CompressedSize;
+	RecordFile->Serialize(Compressed.GetData(), CompressedSize);
+}
+
+bool UGoKartReplaySubsystem::StartPlayback(const FString& FileName)
+{
+	StopPlayback();
+
+	FString Path = ResolvePath(FileName);
+	PlaybackFile.Reset(IFileManager::Get().CreateFileReader(*Path));
+	if (!PlaybackFile.IsValid() || !FGoKartReplayFormat::ReadIndex(*PlaybackFile, PlaybackIndex) || PlaybackIndex.Num() == 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not play kart replay %s"), *Path);
+		PlaybackFile.Reset();
+		return false;
+	}
+
+	UE_LOG(LogTemp, Log, TEXT("Playing kart replay %s, %.1f s"), *Path, PlaybackIndex.Last().EndTime);
+	Seek(0);
+	return true;
+}
+
+void UGoKartReplaySubsystem::StopPlayback()
+{
+	UGoKartPoolSubsystem* Pool = GetWorld()->GetSubsystem<UGoKartPoolSubsystem>();
+	for (const TPair<uint32, AGoKart*>& Pair : PlaybackKarts)
+	{
+		AGoKart* Kart = Pair.Value;
+		if (Kart == nullptr) continue;
+
+		UGoKartMovementReplicator* MovementReplicator = Kart->FindComponentByClass<UGoKartMovementReplicator>();
+		if (MovementReplicator != nullptr)
+		{
+			MovementReplicator->SetReplayPlayback(false);
+		}
+		if (Pool != nullptr)
+		{
+			Pool->Release(Kart);
+		}
+		else
+		{
+			Kart->Destroy();
+		}
+	}
+	PlaybackKarts.Reset();
+
+	PlaybackFile.Reset();
+	PlaybackIndex.Reset();
+	PlaybackFrames.Reset();
+	PlaybackChunk = INDEX_NONE;
+	NextPlaybackFrame = 0;
+	PlaybackTime = 0;
+}
+
+void UGoKartReplaySubsystem::Seek(float Time)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartReplaySeek);
+	if (!PlaybackFile.IsValid()) return;
+
+	//last chunk starting at or before Time
+	int32 ChunkIndex = Algo::UpperBoundBy(PlaybackIndex, Time, &FGoKartReplayFormat::FChunkInfo::StartTime) - 1;
+	ChunkIndex = FMath::Clamp(ChunkIndex, 0, PlaybackIndex.Num() - 1);
+	if (ChunkIndex != PlaybackChunk && !LoadChunk(ChunkIndex))
+	{
+		StopPlayback();
+		return;
+	}
+
+	int32 FrameIndex = Algo::UpperBoundBy(PlaybackFrames, Time, &FGoKartReplayFrame::Time) - 1;
+	FrameIndex = FMath::Max(FrameIndex, 0);
+	ApplyFrame(PlaybackFrames[FrameIndex], true);
+
+	NextPlaybackFrame = FrameIndex + 1;
+	PlaybackTime = FMath::Max(Time, PlaybackFrames[FrameIndex].Time);
+}
+
+bool UGoKartReplaySubsystem::LoadChunk(int32 ChunkIndex)
+{
+	if (!FGoKartReplayFormat::ReadChunk(*PlaybackFile, PlaybackIndex[ChunkIndex], PlaybackFrames))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Kart replay chunk %d is corrupt"), ChunkIndex);
+		return false;
+	}
+	PlaybackChunk = ChunkIndex;
+	NextPlaybackFrame = 0;
+	return true;
+}
+
+void UGoKartReplaySubsystem::PlaybackTick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartReplayPlayback);
+
+	PlaybackTime += DeltaTime;
+	while (true)
+	{
+		if (NextPlaybackFrame >= PlaybackFrames.Num())
+		{
+			if (PlaybackChunk + 1 >= PlaybackIndex.Num())
+			{
+				UE_LOG(LogTemp, Log, TEXT("Kart replay finished"));
+				StopPlayback();
+				return;
+			}
+			if (!LoadChunk(PlaybackChunk + 1))
+			{
+				StopPlayback();
+				return;
+			}
+			//a new keyframe may bring a different set of karts, the rest of them carry on interpolating
+		}
+
+		const FGoKartReplayFrame& Frame = PlaybackFrames[NextPlaybackFrame];
+		if (Frame.Time > PlaybackTime) break;
+
+		ApplyFrame(Frame, false);
+		NextPlaybackFrame++;
+	}
+}
+
+void UGoKartReplaySubsystem::ApplyFrame(const FGoKartReplayFrame& Frame, bool bSnap)
+{
+	//karts that have left the race by this frame go back to the pool
+	UGoKartPoolSubsystem* Pool = GetWorld()->GetSubsystem<UGoKartPoolSubsystem>();
+	for (auto It = PlaybackKarts.CreateIterator(); It; ++It)
+	{
+		if (Frame.KartIds.Contains(It.Key())) continue;
+
+		AGoKart* Kart = It.Value();
+		if (Kart != nullptr)
+		{
+			UGoKartMovementReplicator* MovementReplicator = Kart->FindComponentByClass<UGoKartMovementReplicator>();
+			if (MovementReplicator != nullptr)
+			{
+				MovementReplicator->SetReplayPlayback(false);
+			}
+			if (Pool != nullptr)
+			{
+				Pool->Release(Kart);
+			}
+		}
+		It.RemoveCurrent();
+	}
+
+	for (int32 Index = 0; Index < Frame.KartIds.Num(); ++Index)
+	{
+		bool bNewKart = !PlaybackKarts.Contains(Frame.KartIds[Index]);
+		AGoKart* Kart = GetPlaybackKart(Frame.KartIds[Index]);
+		if (Kart == nullptr) continue;
+
+		UGoKartMovementReplicator* MovementReplicator = Kart->FindComponentByClass<UGoKartMovementReplicator>();
+		if (MovementReplicator == nullptr) continue;
+		MovementReplicator->ApplyReplayState(Frame.States[Index], bSnap || bNewKart);
+	}
+}
+
+AGoKart* UGoKartReplaySubsystem::GetPlaybackKart(uint32 KartId)
+{
+	if (AGoKart** Found = PlaybackKarts.Find(KartId))
+	{
+		return *Found;
+	}
+
+	UWorld* World = GetWorld();
+	UClass* KartClass = AGoKart::StaticClass();
+	AGameModeBase* GameMode = World->GetAuthGameMode();
+	if (GameMode != nullptr && GameMode->DefaultPawnClass != nullptr && GameMode->DefaultPawnClass->IsChildOf(AGoKart::StaticClass()))
+	{
+		KartClass = GameMode->DefaultPawnClass;
+	}
+
+	UGoKartPoolSubsystem* Pool = World->GetSubsystem<UGoKartPoolSubsystem>();
+	AGoKart* Kart = Pool != nullptr ? Pool->Acquire(KartClass, FTransform::Identity) : nullptr;
+	if (Kart == nullptr) return nullptr;
+
+	//replay karts only follow the recording, they don't collide with anything
+	Kart->SetActorEnableCollision(false);
+	UGoKartMovementReplicator* MovementReplicator = Kart->FindComponentByClass<UGoKartMovementReplicator>();
+	if (MovementReplicator != nullptr)
+	{
+		MovementReplicator->SetReplayPlayback(true);
+	}
+
+	PlaybackKarts.Add(KartId, Kart);
+	return Kart;
+}
+
+static FAutoConsoleCommandWithWorldAndArgs KartReplayRecordCommand(
+	TEXT("Kart.Replay.Record"),
+	TEXT("Record a seekable replay of the race to Saved/Replays/<File>"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UGoKartReplaySubsystem* Replay = World != nullptr ? World->GetSubsystem<UGoKartReplaySubsystem>() : nullptr;
+		if (Replay == nullptr) return;
+		Replay->StartRecording(Args.Num() > 0 ? Args[0] : FString::Printf(TEXT("Race_%s.kkrp"), *FDateTime::Now().ToString()));
+	}));
+
+static FAutoConsoleCommandWithWorld KartReplayStopCommand(
+	TEXT("Kart.Replay.Stop"),
+	TEXT("Stop recording or playing a kart replay"),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		UGoKartReplaySubsystem* Replay = World != nullptr ? World->GetSubsystem<UGoKartReplaySubsystem>() : nullptr;
+		if (Replay == nullptr) return;
+		Replay->StopRecording();
+		Replay->StopPlayback();
+	}));
+
+static FAutoConsoleCommandWithWorldAndArgs KartReplayPlayCommand(
+	TEXT("Kart.Replay.Play"),
+	TEXT("Play back the kart replay Saved/Replays/<File>"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UGoKartReplaySubsystem* Replay = World != nullptr ? World->GetSubsystem<UGoKartReplaySubsystem>() : nullptr;
+		if (Replay == nullptr || Args.Num() == 0) return;
+		Replay->StartPlayback(Args[0]);
+	}));
+
+static FAutoConsoleCommandWithWorldAndArgs KartReplaySeekCommand(
+	TEXT("Kart.Replay.Seek"),
+	TEXT("Jump the playing kart replay to <Seconds>"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UGoKartReplaySubsystem* Replay = World != nullptr ? World->GetSubsystem<UGoKartReplaySubsystem>() : nullptr;
+		if (Replay == nullptr || Args.Num() == 0) return;
+		Replay->Seek(FCString::Atof(*Args[0]));
+	}));
@@ -0,0 +1,123 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "GoKartMovementReplicator.h"
+#include "GoKartReplay.generated.h"
+
+class AGoKart;
+
+//every kart's state at one instant of a recorded race
+struct FGoKartReplayFrame
+{
+	float Time = 0;
+	TArray<uint32> KartIds;
+	TArray<FGoKartState> States;
+};
+
+/*
+ * Replay file layout, little endian:
+ *   header  uint32 magic, uint32 version
+ *   chunks  float start time, float end time, int32 frame count, int32 raw size, int32 compressed size, zlib bytes
+ *   index   per chunk int64 offset, float start time, float end time
+ *   footer  int32 chunk count, int64 index offset, uint32 magic
+ * Each chunk opens with a full keyframe of every kart followed by quantized deltas, so any time can be
+ * reached by decoding a single chunk.
+ */
+struct KRAZYKARTS_API FGoKartReplayFormat
+{
+	static const uint32 Magic = 0x50524B4B; // "KKRP"
+	static const uint32 Version = 1;
+
+	struct FChunkInfo
+	{
+		int64 Offset;
+		float StartTime;
+		float EndTime;
+	};
+
+	//position deltas are stored in 1/8 cm and velocity deltas in 1/100 m/s
+	static constexpr float LocationScale = 8;
+	static constexpr float VelocityScale = 100;
+
+	static void WriteKeyframe(FArchive& Ar, const FGoKartReplayFrame& Frame, TArray<FGoKartState>& OutReconstructed);
+	//false if a kart moved too far to be stored as a delta, the chunk should be closed and a keyframe started
+	static bool CanWriteDelta(const FGoKartReplayFrame& Frame, const TArray<uint32>& ChunkKarts, const TArray<FGoKartState>& Reconstructed);
+	static void WriteDelta(FArchive& Ar, const FGoKartReplayFrame& Frame, const TArray<uint32>& ChunkKarts, TArray<FGoKartState>& InOutReconstructed);
+
+	static bool ReadIndex(FArchive& Reader, TArray<FChunkInfo>& OutChunks);
+	static bool ReadChunk(FArchive& Reader, const FChunkInfo& Chunk, TArray<FGoKartReplayFrame>& OutFrames);
+};
+
+//records an authoritative replay of the race and plays replays back through the karts' interpolation
+UCLASS()
+class KRAZYKARTS_API UGoKartReplaySubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	bool StartRecording(const FString& FileName);
+	void StopRecording();
+	bool IsRecording() const { return RecordFile.IsValid(); }
+
+	bool StartPlayback(const FString& FileName);
+	void StopPlayback();
+	void Seek(float Time);
+	bool IsPlaying() const { return PlaybackFile.IsValid(); }
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End FTickableGameObject interface
+
+private:
+	void RecordFrame();
+	void BeginChunk(const FGoKartReplayFrame& Frame);
+	void EndChunk();
+
+	void PlaybackTick(float DeltaTime);
+	bool LoadChunk(int32 ChunkIndex);
+	void ApplyFrame(const FGoKartReplayFrame& Frame, bool bSnap);
+	AGoKart* GetPlaybackKart(uint32 KartId);
+
+	static FString ResolvePath(const FString& FileName);
+
+	//recording
+	TUniquePtr<FArchive> RecordFile;
+	FString RecordPath;
+	TArray<FGoKartReplayFormat::FChunkInfo> RecordIndex;
+	TArray<uint8> ChunkData;
+	TUniquePtr<FArchive> ChunkWriter;
+	TArray<uint32> ChunkKarts;
+	TArray<FGoKartState> Reconstructed;
+	float ChunkStartTime = 0;
+	float ChunkEndTime = 0;
+	int32 ChunkFrames = 0;
+	float TimeUntilSample = 0;
+	float RecordStartTime = 0;
+	double RecordCostSeconds = 0;
+	int64 KartSamples = 0;
+
+	//seconds between recorded frames and per chunk
+	float SampleInterval = 0.05f;
+	int32 FramesPerChunk = 40;
+
+	//playback
+	TUniquePtr<FArchive> PlaybackFile;
+	TArray<FGoKartReplayFormat::FChunkInfo> PlaybackIndex;
+	TArray<FGoKartReplayFrame> PlaybackFrames;
+	int32 PlaybackChunk = INDEX_NONE;
+	int32 NextPlaybackFrame = 0;
+	float PlaybackTime = 0;
+
+	UPROPERTY()
+	TMap<uint32, AGoKart*> PlaybackKarts;
+};
@@ -0,0 +1,589 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartSpectatorStream.h"
+#include "KrazyKarts.h"
+#include "GoKart.h"
+#include "GoKartMovementComponent.h"
+#include "GoKartPool.h"
+#include "GoKartBandwidth.h"
+#include "EngineUtils.h"
+#include "GameFramework/GameModeBase.h"
+#include "GameFramework/GameStateBase.h"
+#include "GameFramework/PlayerController.h"
+#include "GameFramework/PlayerState.h"
+#include "Engine/NetConnection.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformProcess.h"
+#include "Misc/CommandLine.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "Common/UdpSocketBuilder.h"
+#include "Interfaces/IPv4/IPv4Endpoint.h"
+#include "Sockets.h"
+#include "SocketSubsystem.h"
+
+DECLARE_CYCLE_STAT(TEXT("Spectator Snapshot Encode"), STAT_KartSpectatorEncode, STATGROUP_KrazyKarts);
+DECLARE_CYCLE_STAT(TEXT("Spectator Snapshot Apply"), STAT_KartSpectatorApply, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Spectators"), STAT_KartSpectators, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Spectator Snapshot Bytes"), STAT_KartSpectatorSnapshotBytes, STATGROUP_KrazyKarts);
+
+static TAutoConsoleVariable<int32> CVarKartSpectatorStream(
+	TEXT("Kart.SpectatorStream"),
+	1,
+	TEXT("Send spectators one shared low rate snapshot of the race instead of replicating every kart to them"));
+
+static TAutoConsoleVariable<float> CVarKartSpectatorRate(
+	TEXT("Kart.SpectatorRate"),
+	10,
+	TEXT("Spectator snapshots per second"));
+
+namespace
+{
+	//first byte of every relay datagram
+	const uint8 RelaySnapshot = 'S';
+	const uint8 RelayHello = 'H';
+	const int32 MaxRelayDatagram = 65507;
+	//spectators that stay quiet for longer than this are dropped by the relay
+	const double RelaySubscriberTimeout = 10;
+
+	//relay datagrams from the server and hellos from spectators carry the shared token after the type byte, as a length byte and UTF-8
+	void WriteRelayHeader(TArray<uint8>& Datagram, uint8 Type, const TArray<uint8>& Token)
+	{
+		Datagram.Add(Type);
+		Datagram.Add((uint8)Token.Num());
+		Datagram.Append(Token);
+	}
+
+	//offset of the payload after a header carrying Token, INDEX_NONE for anything else
+	int32 ReadRelayHeader(const uint8* Datagram, int32 Num, const TArray<uint8>& Token)
+	{
+		int32 HeaderSize = 2 + Token.Num();
+		if (Token.Num() == 0 || Num < HeaderSize || Datagram[1] != Token.Num()) return INDEX_NONE;
+		if (FMemory::Memcmp(Datagram + 2, Token.GetData(), Token.Num()) != 0) return INDEX_NONE;
+		return HeaderSize;
+	}
+
+	TArray<uint8> ToRelayToken(const FString& Token)
+	{
+		FTCHARToUTF8 Utf8(*Token);
+		TArray<uint8> Bytes;
+		Bytes.Append((const uint8*)Utf8.Get(), FMath::Min(Utf8.Length(), (int32)MAX_uint8));
+		return Bytes;
+	}
+}
+
+void FGoKartSpectatorSnapshot::Serialize(FArchive& Ar)
+{
+	uint16 NumKarts = KartIds.Num();
+	Ar << Time << NumKarts;
+
+	KartIds.SetNum(NumKarts);
+	States.SetNum(NumKarts);
+	for (int32 Kart = 0; Kart < NumKarts; ++Kart)
+	{
+		FGoKartState& State = States[Kart];
+		FVector Location = State.Transform.GetLocation();
+		FRotator Rotation = State.Transform.Rotator();
+
+		int32 X = FMath::RoundToInt(Location.X), Y = FMath::RoundToInt(Location.Y), Z = FMath::RoundToInt(Location.Z);
+		uint8 Pitch = FRotator::CompressAxisToByte(Rotation.Pitch);
+		uint8 Yaw = FRotator::CompressAxisToByte(Rotation.Yaw);
+		uint8 Roll = FRotator::CompressAxisToByte(Rotation.Roll);
+		int16 VX = (int16)FMath::Clamp(FMath::RoundToInt(State.Velocity.X * 100), (int32)MIN_int16, (int32)MAX_int16);
+		int16 VY = (int16)FMath::Clamp(FMath::RoundToInt(State.Velocity.Y * 100), (int32)MIN_int16, (int32)MAX_int16);
+		int16 VZ = (int16)FMath::Clamp(FMath::RoundToInt(State.Velocity.Z * 100), (int32)MIN_int16, (int32)MAX_int16);
+		int8 Force = (int8)FMath::RoundToInt(FMath::Clamp(State.LastMove.Force, -1.f, 1.f) * 127);
+		int8 Steering = (int8)FMath::RoundToInt(FMath::Clamp(State.LastMove.SteeringCrank, -1.f, 1.f) * 127);
+
+		Ar << KartIds[Kart] << X << Y << Z << Pitch << Yaw << Roll << VX << VY << VZ << Force << Steering;
+
+		if (Ar.IsLoading())
+		{
+			Rotation = FRotator(FRotator::DecompressAxisFromByte(Pitch), FRotator::DecompressAxisFromByte(Yaw), FRotator::DecompressAxisFromByte(Roll));
+			State.Transform = FTransform(Rotation, FVector(X, Y, Z));
+			State.Velocity = FVector(VX, VY, VZ) / 100;
+			State.LastMove.Force = Force / 127.f;
+			State.LastMove.SteeringCrank = Steering / 127.f;
+		}
+	}
+}
+
+AGoKartSpectatorStream::AGoKartSpectatorStream()
+{
+	PrimaryActorTick.bCanEverTick = false;
+	bReplicates = true;
+	//snapshots go out as RPCs, there are no properties to poll
+	NetUpdateFrequency = 1;
+}
+
+bool AGoKartSpectatorStream::IsNetRelevantFor(const AActor* RealViewer, const AActor* ViewTarget, const FVector& SrcLocation) const
+{
+	//spectators on the relay already get every snapshot from it
+	return UGoKartSpectatorStreamSubsystem::IsSpectator(RealViewer) && !UGoKartSpectatorStreamSubsystem::IsRelaySubscriber(RealViewer);
+}
+
+void AGoKartSpectatorStream::Multicast_Snapshot_Implementation(const TArray<uint8>& Data)
+{
+	if (HasAuthority()) return;
+
+	UGoKartSpectatorStreamSubsystem* Spectating = GetWorld()->GetSubsystem<UGoKartSpectatorStreamSubsystem>();
+	if (Spectating == nullptr) return;
+	Spectating->ReceiveSnapshot(Data);
+}
+
+bool UGoKartSpectatorStreamSubsystem::IsSpectator(const AActor* Viewer)
+{
+	const APlayerController* Controller = Cast<APlayerController>(Viewer);
+	return Controller != nullptr && Controller->PlayerState != nullptr && Controller->PlayerState->IsOnlyASpectator();
+}
+
+bool UGoKartSpectatorStreamSubsystem::IsRelaySubscriber(const AActor* Viewer)
+{
+	const APlayerController* Controller = Cast<APlayerController>(Viewer);
+	UNetConnection* Connection = Controller != nullptr ? Controller->GetNetConnection() : nullptr;
+	return Connection != nullptr && Connection->URL.HasOption(TEXT("SpectatorRelay"));
+}
+
+bool UGoKartSpectatorStreamSubsystem::IsStreamEnabled()
+{
+	return CVarKartSpectatorStream.GetValueOnGameThread() != 0;
+}
+
+void UGoKartSpectatorStreamSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	if (InWorld.GetNetMode() != NM_Client)
+	{
+		FActorSpawnParameters SpawnParameters;
+		SpawnParameters.Name = TEXT("GoKartSpectatorStream");
+		Stream = InWorld.SpawnActor<AGoKartSpectatorStream>(SpawnParameters);
+	}
+
+	//-KartSpectatorRelay=<host:port> sends snapshots through a relay on a server, or subscribes to one on a client,
+	//-KartSpectatorRelayToken=<token> has to match the relay's, and -KartSpectatorRelayPort=<port> fixes the server's source port,
+	//a spectator on the relay joins with ?SpectatorOnly=1?SpectatorRelay so the server leaves it out of the multicast
+	FString RelayAddressString;
+	if (FParse::Value(FCommandLine::Get(), TEXT("KartSpectatorRelay="), RelayAddressString))
+	{
+		OpenRelay(RelayAddressString);
+	}
+}
+
+void UGoKartSpectatorStreamSubsystem::Deinitialize()
+{
+	CloseRelay();
+	Super::Deinitialize();
+}
+
+bool UGoKartSpectatorStreamSubsystem::OpenRelay(const FString& Address)
+{
+	FIPv4Endpoint Endpoint;
+	if (!FIPv4Endpoint::Parse(Address, Endpoint))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Bad spectator relay address %s"), *Address);
+		return false;
+	}
+
+	FString Token;
+	FParse::Value(FCommandLine::Get(), TEXT("KartSpectatorRelayToken="), Token);
+	RelayToken = ToRelayToken(Token);
+	if (RelayToken.Num() == 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("The spectator relay needs -KartSpectatorRelayToken"));
+		return false;
+	}
+
+	//the relay only takes snapshots from the endpoint it was told the server sends from
+	int32 LocalPort = 0;
+	FParse::Value(FCommandLine::Get(), TEXT("KartSpectatorRelayPort="), LocalPort);
+	RelaySocket = FUdpSocketBuilder(TEXT("GoKartSpectatorRelay"))
+		.AsNonBlocking()
+		.BoundToEndpoint(FIPv4Endpoint(FIPv4Address::Any, LocalPort))
+		.WithReceiveBufferSize(MaxRelayDatagram)
+		.Build();
+	if (RelaySocket == nullptr) return false;
+
+	RelayAddress = Endpoint.ToInternetAddr();
+	TimeUntilRelayHello = 0;
+	UE_LOG(LogTemp, Log, TEXT("Using spectator relay %s"), *Address);
+	return true;
+}
+
+void UGoKartSpectatorStreamSubsystem::CloseRelay()
+{
+	if (RelaySocket == nullptr) return;
+
+	RelaySocket->Close();
+	ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(RelaySocket);
+	RelaySocket = nullptr;
+	RelayAddress.Reset();
+}
+
+bool UGoKartSpectatorStreamSubsystem::IsTickable() const
+{
+	return !IsTemplate() && (Stream != nullptr || RelaySocket != nullptr);
+}
+
+TStatId UGoKartSpectatorStreamSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartSpectatorStreamSubsystem, STATGROUP_Tickables);
+}
+
+void UGoKartSpectatorStreamSubsystem::Tick(float DeltaTime)
+{
+	if (RelaySocket != nullptr && GetWorld()->GetNetMode() == NM_Client)
+	{
+		RelayTick(DeltaTime);
+		return;
+	}
+	if (Stream == nullptr || !IsStreamEnabled()) return;
+
+	TimeUntilSnapshot -= DeltaTime;
+	if (TimeUntilSnapshot > 0) return;
+	TimeUntilSnapshot = FMath::Max(TimeUntilSnapshot + 1 / FMath::Max(CVarKartSpectatorRate.GetValueOnGameThread(), 1.f), 0.f);
+
+	PublishSnapshot();
+}
+
+int32 UGoKartSpectatorStreamSubsystem::CountSpectators() const
+{
+	int32 Spectators = 0;
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		const APlayerController* Controller = It->Get();
+		if (IsSpectator(Controller) && !IsRelaySubscriber(Controller))
+		{
+			Spectators++;
+		}
+	}
+	return Spectators;
+}
+
+void UGoKartSpectatorStreamSubsystem::PublishSnapshot()
+{
+	int32 Spectators = CountSpectators();
+	SET_DWORD_STAT(STAT_KartSpectators, Spectators);
+	//nobody watching, nothing to encode
+	if (Spectators == 0 && RelaySocket == nullptr) return;
+
+	{
+		SCOPE_CYCLE_COUNTER(STAT_KartSpectatorEncode);
+
+		FGoKartSpectatorSnapshot Snapshot;
+		Snapshot.Time = GetWorld()->TimeSeconds;
+		for (TActorIterator<AGoKart> It(GetWorld()); It; ++It)
+		{
+			AGoKart* Kart = *It;
+			if (Kart->IsHidden()) continue;
+			UGoKartMovementComponent* MovementComponent = Kart->FindComponentByClass<UGoKartMovementComponent>();
+			if (MovementComponent == nullptr) continue;
+
+			FGoKartState& State = Snapshot.States.AddDefaulted_GetRef();
+			State.Transform = Kart->GetActorTransform();
+			State.Velocity = MovementComponent->GetVelocity();
+			State.LastMove = MovementComponent->GetLastMove();
+			Snapshot.KartIds.Add(Kart->GetUniqueID());
+		}
+
+		SnapshotData.Reset();
+		SnapshotData.Add(RelaySnapshot);
+		FMemoryWriter Writer(SnapshotData);
+		Writer.Seek(1);
+		Snapshot.Serialize(Writer);
+	}
+	SET_DWORD_STAT(STAT_KartSpectatorSnapshotBytes, SnapshotData.Num());
+
+	//the same bytes go to every spectator connection and to the relay
+	if (Spectators > 0)
+	{
+		Stream->Multicast_Snapshot(SnapshotData);
+
+		UGoKartBandwidthSubsystem* Bandwidth = GetWorld()->GetSubsystem<UGoKartBandwidthSubsystem>();
+		if (Bandwidth != nullptr)
+		{
+			Bandwidth->RecordOutgoing(Stream, TEXT("Multicast_Snapshot"), SnapshotData.Num() * 8 * Spectators);
+		}
+	}
+	if (RelaySocket != nullptr)
+	{
+		//the relay strips the token and forwards the snapshot as spectators get it from the multicast
+		RelayData.Reset();
+		WriteRelayHeader(RelayData, RelaySnapshot, RelayToken);
+		RelayData.Append(SnapshotData.GetData() + 1, SnapshotData.Num() - 1);
+		if (RelayData.Num() <= MaxRelayDatagram)
+		{
+			int32 BytesSent = 0;
+			RelaySocket->SendTo(RelayData.GetData(), RelayData.Num(), BytesSent, *RelayAddress);
+		}
+	}
+}
+
+void UGoKartSpectatorStreamSubsystem::RelayTick(float DeltaTime)
+{
+	//keep the relay's subscription alive
+	TimeUntilRelayHello -= DeltaTime;
+	if (TimeUntilRelayHello <= 0)
+	{
+		TimeUntilRelayHello = RelaySubscriberTimeout / 4;
+		TArray<uint8> Hello;
+		WriteRelayHeader(Hello, RelayHello, RelayToken);
+		int32 BytesSent = 0;
+		RelaySocket->SendTo(Hello.GetData(), Hello.Num(), BytesSent, *RelayAddress);
+	}
+
+	TSharedRef<FInternetAddr> Sender = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->CreateInternetAddr();
+	TArray<uint8> Datagram;
+	uint32 PendingSize = 0;
+	while (RelaySocket->HasPendingData(PendingSize))
+	{
+		Datagram.SetNumUninitialized(FMath::Min(PendingSize, (uint32)MaxRelayDatagram), false);
+		int32 BytesRead = 0;
+		if (!RelaySocket->RecvFrom(Datagram.GetData(), Datagram.Num(), BytesRead, *Sender)) break;
+
+		//only the relay we subscribed to may feed the display karts
+		if (!(*Sender == *RelayAddress)) continue;
+
+		Datagram.SetNum(BytesRead, false);
+		ReceiveSnapshot(Datagram);
+	}
+}
+
+void UGoKartSpectatorStreamSubsystem::ReceiveSnapshot(const TArray<uint8>& Data)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartSpectatorApply);
+	if (Data.Num() < 1 || Data[0] != RelaySnapshot) return;
+
+	FGoKartSpectatorSnapshot Snapshot;
+	FMemoryReader Reader(Data);
+	Reader.Seek(1);
+	Snapshot.Serialize(Reader);
+	if (Reader.IsError()) return;
+
+	//datagrams and unreliable multicasts can arrive late or twice, interpolating back to an old snapshot would jerk every kart
+	if (Snapshot.Time <= LastSnapshotTime) return;
+	LastSnapshotTime = Snapshot.Time;
+
+	for (auto It = DisplayKarts.CreateIterator(); It; ++It)
+	{
+		if (Snapshot.KartIds.Contains(It.Key())) continue;
+		ReleaseDisplayKart(It.Value());
+		It.RemoveCurrent();
+	}
+
+	//the karts interpolate between snapshots along the same spline as simulated proxies
+	for (int32 Index = 0; Index < Snapshot.KartIds.Num(); ++Index)
+	{
+		bool bNewKart = !DisplayKarts.Contains(Snapshot.KartIds[Index]);
+		AGoKart* Kart = GetDisplayKart(Snapshot.KartIds[Index]);
+		UGoKartMovementReplicator* MovementReplicator = Kart != nullptr ? Kart->FindComponentByClass<UGoKartMovementReplicator>() : nullptr;
+		if (MovementReplicator == nullptr) continue;
+		MovementReplicator->ApplyReplayState(Snapshot.States[Index], bNewKart);
+	}
+}
+
+void UGoKartSpectatorStreamSubsystem::LogStatus() const
+{
+	if (GetWorld()->GetNetMode() == NM_Client)
+	{
+		UE_LOG(LogTemp, Log, TEXT("Spectating %d karts%s"), DisplayKarts.Num(), RelaySocket != nullptr ? TEXT(" through a relay") : TEXT(""));
+		return;
+	}
+	UE_LOG(LogTemp, Log, TEXT("Spectator stream %s: %d spectators on the multicast, %.0f Hz, last snapshot %d bytes%s"),
+		IsStreamEnabled() ? TEXT("on") : TEXT("off"), CountSpectators(), CVarKartSpectatorRate.GetValueOnGameThread(),
+		SnapshotData.Num(), RelaySocket != nullptr ? TEXT(", relayed") : TEXT(""));
+}
+
+AGoKart* UGoKartSpectatorStreamSubsystem::GetDisplayKart(uint32 KartId)
+{
+	if (AGoKart** Found = DisplayKarts.Find(KartId))
+	{
+		return *Found;
+	}
+
+	UWorld* World = GetWorld();
+	UClass* KartClass = AGoKart::StaticClass();
+	AGameModeBase* GameMode = World->GetAuthGameMode();
+	if (GameMode != nullptr && GameMode->DefaultPawnClass != nullptr && GameMode->DefaultPawnClass->IsChildOf(AGoKart::StaticClass()))
+	{
+		KartClass = GameMode->DefaultPawnClass;
+	}
+	else if (World->GetGameState() != nullptr && World->GetGameState()->GameModeClass != nullptr)
+	{
+		//clients have no game mode, but the game state knows its class
+		const AGameModeBase* GameModeDefaults = World->GetGameState()->GameModeClass->GetDefaultObject<AGameModeBase>();
+		if (GameModeDefaults->DefaultPawnClass != nullptr && GameModeDefaults->DefaultPawnClass->IsChildOf(AGoKart::StaticClass()))
+		{
+			KartClass = GameModeDefaults->DefaultPawnClass;
+		}
+	}
+
+	UGoKartPoolSubsystem* Pool = World->GetSubsystem<UGoKartPoolSubsystem>();
+	AGoKart* Kart = Pool != nullptr ? Pool->Acquire(KartClass, FTransform::Identity) : nullptr;
+	if (Kart == nullptr) return nullptr;
+
+	Kart->SetActorEnableCollision(false);
+	UGoKartMovementReplicator* MovementReplicator = Kart->FindComponentByClass<UGoKartMovementReplicator>();
+	if (MovementReplicator != nullptr)
+	{
+		MovementReplicator->SetReplayPlayback(true);
+	}
+
+	DisplayKarts.Add(KartId, Kart);
+	return Kart;
+}
+
+void UGoKartSpectatorStreamSubsystem::ReleaseDisplayKart(AGoKart* Kart)
+{
+	if (Kart == nullptr) return;
+
+	UGoKartMovementReplicator* MovementReplicator = Kart->FindComponentByClass<UGoKartMovementReplicator>();
+	if (MovementReplicator != nullptr)
+	{
+		MovementReplicator->SetReplayPlayback(false);
+	}
+	UGoKartPoolSubsystem* Pool = GetWorld()->GetSubsystem<UGoKartPoolSubsystem>();
+	if (Pool != nullptr)
+	{
+		Pool->Release(Kart);
+	}
+}
+
+int32 UGoKartSpectatorRelayCommandlet::Main(const FString& Params)
+{
+	int32 Port = 7790;
+	FParse::Value(*Params, TEXT("Port="), Port);
+	int32 MaxSubscribers = 256;
+	FParse::Value(*Params, TEXT("MaxSubscribers="), MaxSubscribers);
+
+	//without both of these anyone could feed or subscribe to the relay and use it as a reflector
+	FString Token;
+	FParse::Value(*Params, TEXT("Token="), Token);
+	TArray<uint8> RelayToken = ToRelayToken(Token);
+	FString ServerString;
+	FParse::Value(*Params, TEXT("Server="), ServerString);
+
+	//Server=<address>:<port> when the server fixes its source port with -KartSpectatorRelayPort, otherwise any port from <address>
+	FIPv4Endpoint Server;
+	FIPv4Address ServerAddress;
+	bool bServerPort = FIPv4Endpoint::Parse(ServerString, Server);
+	if (!bServerPort && FIPv4Address::Parse(ServerString, ServerAddress))
+	{
+		Server = FIPv4Endpoint(ServerAddress, 0);
+	}
+	else if (!bServerPort)
+	{
+		UE_LOG(LogTemp, Error, TEXT("The spectator relay needs Server=<address>[:<port>] of the game server"));
+		return 1;
+	}
+	if (RelayToken.Num() == 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("The spectator relay needs Token=<token> matching the game's -KartSpectatorRelayToken"));
+		return 1;
+	}
+
+	FSocket* Socket = FUdpSocketBuilder(TEXT("GoKartSpectatorRelay"))
+		.AsNonBlocking()
+		.BoundToEndpoint(FIPv4Endpoint(FIPv4Address::Any, Port))
+		.WithReceiveBufferSize(MaxRelayDatagram * 4)
+		.Build();
+	if (Socket == nullptr)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not bind the spectator relay to port %d"), Port);
+		return 1;
+	}
+	UE_LOG(LogTemp, Log, TEXT("Spectator relay listening on port %d for %s"), Port, *ServerString);
+
+	ISocketSubsystem* Sockets = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+	TSharedRef<FInternetAddr> Sender = Sockets->CreateInternetAddr();
+	TArray<TSharedRef<FInternetAddr>> Subscribers;
+	TArray<double> LastHeard;
+	TArray<uint8> Datagram;
+	Datagram.SetNumUninitialized(MaxRelayDatagram);
+	int64 Forwarded = 0;
+	int64 Dropped = 0;
+	double NextReport = FPlatformTime::Seconds() + 10;
+
+	while (!IsEngineExitRequested())
+	{
+		double Now = FPlatformTime::Seconds();
+		uint32 PendingSize = 0;
+		while (Socket->HasPendingData(PendingSize))
+		{
+			int32 BytesRead = 0;
+			if (!Socket->RecvFrom(Datagram.GetData(), Datagram.Num(), BytesRead, *Sender) || BytesRead < 1) break;
+
+			int32 PayloadOffset = ReadRelayHeader(Datagram.GetData(), BytesRead, RelayToken);
+			if (PayloadOffset == INDEX_NONE)
+			{
+				Dropped++;
+				continue;
+			}
+
+			if (Datagram[0] == RelayHello)
+			{
+				int32 Index = Subscribers.IndexOfByPredicate([&Sender](const TSharedRef<FInternetAddr>& Subscriber) { return *Subscriber == *Sender; });
+				if (Index != INDEX_NONE)
+				{
+					LastHeard[Index] = Now;
+				}
+				else if (Subscribers.Num() < MaxSubscribers)
+				{
+					Subscribers.Add(Sender->Clone());
+					LastHeard.Add(Now);
+				}
+			}
+			else if (Datagram[0] == RelaySnapshot)
+			{
+				FIPv4Endpoint From(Sender);
+				if (From.Address != Server.Address || (Server.Port != 0 && From.Port != Server.Port))
+				{
+					Dropped++;
+					continue;
+				}
+
+				//subscribers get the snapshot without the token, in the same form as the multicast
+				Datagram[PayloadOffset - 1] = RelaySnapshot;
+				const uint8* Snapshot = Datagram.GetData() + PayloadOffset - 1;
+				int32 SnapshotSize = BytesRead - PayloadOffset + 1;
+				for (const TSharedRef<FInternetAddr>& Subscriber : Subscribers)
+				{
+					int32 BytesSent = 0;
+					Socket->SendTo(Snapshot, SnapshotSize, BytesSent, *Subscriber);
+				}
+				Forwarded += Subscribers.Num();
+			}
+		}
+
+		for (int32 Index = Subscribers.Num() - 1; Index >= 0; --Index)
+		{
+			if (Now - LastHeard[Index] > RelaySubscriberTimeout)
+			{
+				Subscribers.RemoveAtSwap(Index);
+				LastHeard.RemoveAtSwap(Index);
+			}
+		}
+
+		if (Now >= NextReport)
+		{
+			UE_LOG(LogTemp, Log, TEXT("Spectator relay: %d subscribers, %lld snapshots forwarded, %lld datagrams dropped"), Subscribers.Num(), Forwarded, Dropped);
+			NextReport = Now + 10;
+		}
+		FPlatformProcess::Sleep(0.001f);
+	}
+
+	Socket->Close();
+	Sockets->DestroySocket(Socket);
+	return 0;
+}
+
+static FAutoConsoleCommandWithWorld KartSpectatorsCommand(
+	TEXT("Kart.Spectators"),
+	TEXT("Log the spectator stream's rate and the size of the last snapshot"),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		UGoKartSpectatorStreamSubsystem* Spectating = World != nullptr ? World->GetSubsystem<UGoKartSpectatorStreamSubsystem>() : nullptr;
+		if (Spectating == nullptr) return;
+		Spectating->LogStatus();
+	}));
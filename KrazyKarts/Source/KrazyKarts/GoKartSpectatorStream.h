@@ -0,0 +1,114 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "Commandlets/Commandlet.h"
+#include "GoKartMovementReplicator.h"
+#include "GoKartSpectatorStream.generated.h"
+
+class AGoKart;
+class FSocket;
+class FInternetAddr;
+
+/*
+ * Spectator snapshot of every racing kart, little endian:
+ *   float server time, uint16 kart count
+ *   per kart uint32 id, int32 x3 location in cm, uint8 x3 rotation, int16 x3 velocity in 1/100 m/s, int8 force, int8 steering
+ */
+struct KRAZYKARTS_API FGoKartSpectatorSnapshot
+{
+	float Time = 0;
+	TArray<uint32> KartIds;
+	TArray<FGoKartState> States;
+
+	void Serialize(FArchive& Ar);
+};
+
+//the one replicated actor spectators receive instead of the karts, it carries the shared snapshot
+UCLASS(NotPlaceable)
+class KRAZYKARTS_API AGoKartSpectatorStream : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	AGoKartSpectatorStream();
+
+	virtual bool IsNetRelevantFor(const AActor* RealViewer, const AActor* ViewTarget, const FVector& SrcLocation) const override;
+
+	UFUNCTION(NetMulticast, Unreliable)
+	void Multicast_Snapshot(const TArray<uint8>& Data);
+};
+
+//encodes a low rate snapshot of the race once per interval and fans the same bytes out to every spectator
+UCLASS()
+class KRAZYKARTS_API UGoKartSpectatorStreamSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	virtual void Deinitialize() override;
+
+	//true when Viewer is a spectator's controller and should get the stream rather than the karts
+	static bool IsSpectator(const AActor* Viewer);
+	//true when Viewer's connection joined with ?SpectatorRelay and takes the snapshots from the relay instead of the multicast
+	static bool IsRelaySubscriber(const AActor* Viewer);
+	static bool IsStreamEnabled();
+
+	void ReceiveSnapshot(const TArray<uint8>& Data);
+	void LogStatus() const;
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End FTickableGameObject interface
+
+private:
+	void PublishSnapshot();
+	int32 CountSpectators() const;
+
+	bool OpenRelay(const FString& Address);
+	void CloseRelay();
+	void RelayTick(float DeltaTime);
+
+	AGoKart* GetDisplayKart(uint32 KartId);
+	void ReleaseDisplayKart(AGoKart* Kart);
+
+	UPROPERTY()
+	AGoKartSpectatorStream* Stream;
+
+	float TimeUntilSnapshot = 0;
+	TArray<uint8> SnapshotData;
+	//server time of the newest snapshot applied on a spectator
+	float LastSnapshotTime = -1;
+
+	//optional relay process that takes one copy of each snapshot and fans it out itself
+	FSocket* RelaySocket = nullptr;
+	TSharedPtr<FInternetAddr> RelayAddress;
+	//shared secret the relay checks on every snapshot and hello, UTF-8
+	TArray<uint8> RelayToken;
+	//the snapshot with the relay header in front of it
+	TArray<uint8> RelayData;
+	float TimeUntilRelayHello = 0;
+
+	//client side karts driven by the snapshots
+	UPROPERTY()
+	TMap<uint32, AGoKart*> DisplayKarts;
+};
+
+//forwards snapshots from the configured server to every spectator that has said hello in the last few seconds, both have to carry the shared token
+//run with -run=GoKartSpectatorRelay Server=<address>[:<port>] Token=<token> [Port=<port>] [MaxSubscribers=<count>]
+UCLASS()
+class KRAZYKARTS_API UGoKartSpectatorRelayCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	virtual int32 Main(const FString& Params) override;
+};
@@ -0,0 +1,87 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartStatePublisher.h"
+#include "GoKartMovementReplicator.h"
+#include "GoKartAllocations.h"
+#include "KrazyKarts.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+
+DECLARE_CYCLE_STAT(TEXT("State Publish"), STAT_KartStatePublish, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("States Published"), STAT_KartStatesPublished, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("States Deferred"), STAT_KartStatesDeferred, STATGROUP_KrazyKarts);
+
+static TAutoConsoleVariable<float> CVarKartStatePublishBudget(
+	TEXT("Kart.StatePublishBudgetMs"),
+	1.0f,
+	TEXT("Milliseconds per tick the server spends publishing kart state before deferring low priority karts to later frames"));
+
+static TAutoConsoleVariable<float> CVarKartStateMaxDelay(
+	TEXT("Kart.StateMaxDelay"),
+	0.1f,
+	TEXT("Seconds a kart's state may be deferred before it is published regardless of the budget"));
+
+void UGoKartStatePublisherSubsystem::MarkDirty(UGoKartMovementReplicator* Replicator)
+{
+	if (Replicator == nullptr || Replicator->IsQueuedForPublish()) return;
+
+	Replicator->SetQueuedForPublish(true);
+	FDirtyKart& Dirty = DirtyKarts.AddDefaulted_GetRef();
+	Dirty.Replicator = Replicator;
+}
+
+bool UGoKartStatePublisherSubsystem::IsTickable() const
+{
+	return !IsTemplate() && DirtyKarts.Num() > 0;
+}
+
+TStatId UGoKartStatePublisherSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartStatePublisherSubsystem, STATGROUP_Tickables);
+}
+
+void UGoKartStatePublisherSubsystem::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartStatePublish);
+	LLM_SCOPE_BYTAG(KrazyKarts_Replication);
+	FGoKartAllocationScope AllocationScope;
+
+	float Now = GetWorld()->TimeSeconds;
+	float MaxDelay = CVarKartStateMaxDelay.GetValueOnGameThread();
+
+	DirtyKarts.RemoveAllSwap([](const FDirtyKart& Dirty) { return !Dirty.Replicator.IsValid(); });
+
+	//the longer a kart has waited the more urgent it is, karts players are driving count double
+	//karts past the max delay go first whatever their priority, so a bot behind the player karts can't be starved by the budget
+	for (FDirtyKart& Dirty : DirtyKarts)
+	{
+		float Waited = Now - Dirty.Replicator->GetLastPublishTime();
+		Dirty.Priority = Dirty.Replicator->IsPlayerControlled() ? Waited * 2 : Waited;
+		Dirty.bOverdue = Waited >= MaxDelay;
+	}
+	DirtyKarts.Sort([](const FDirtyKart& A, const FDirtyKart& B)
+	{
+		if (A.bOverdue != B.bOverdue) return A.bOverdue;
+		return A.Priority > B.Priority;
+	});
+
+	double Deadline = FPlatformTime::Seconds() + CVarKartStatePublishBudget.GetValueOnGameThread() / 1000.0;
+	int32 Published = 0;
+	for (; Published < DirtyKarts.Num(); ++Published)
+	{
+		UGoKartMovementReplicator* Replicator = DirtyKarts[Published].Replicator.Get();
+
+		//always make progress, and never let a kart go stale past the max delay
+		//overdue karts are all at the front, so once over budget everything left can wait for a later frame
+		bool bOverBudget = Published > 0 && FPlatformTime::Seconds() > Deadline;
+		if (bOverBudget && !DirtyKarts[Published].bOverdue) break;
+
+		Replicator->PublishServerState();
+		Replicator->SetQueuedForPublish(false);
+	}
+
+	SET_DWORD_STAT(STAT_KartStatesPublished, Published);
+	SET_DWORD_STAT(STAT_KartStatesDeferred, DirtyKarts.Num() - Published);
+	DirtyKarts.RemoveAt(0, Published, false);
+}
@@ -0,0 +1,38 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "GoKartStatePublisher.generated.h"
+
+class UGoKartMovementReplicator;
+
+//writes every dirty kart's ServerState once per tick, spreading low priority karts over frames within a time budget
+UCLASS()
+class KRAZYKARTS_API UGoKartStatePublisherSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	void MarkDirty(UGoKartMovementReplicator* Replicator);
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End FTickableGameObject interface
+
+private:
+	struct FDirtyKart
+	{
+		TWeakObjectPtr<UGoKartMovementReplicator> Replicator;
+		float Priority;
+		//waited longer than Kart.StateMaxDelay, published this tick regardless of the budget
+		bool bOverdue;
+	};
+
+	TArray<FDirtyKart> DirtyKarts;
+};
@@ -0,0 +1,293 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartTelemetry.h"
+#include "KrazyKarts.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/Compression.h"
+#include "Misc/CommandLine.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+DECLARE_CYCLE_STAT(TEXT("Telemetry Record"), STAT_KartTelemetryRecord, STATGROUP_KrazyKarts);
+
+bool FGoKartTelemetryFile::ReadIndex(FArchive& Reader, TArray<FChunkInfo>& OutChunks)
+{
+	const int64 FooterSize = sizeof(int32) + sizeof(int64) + sizeof(uint32);
+	if (Reader.TotalSize() < FooterSize) return false;
+
+	uint32 HeaderMagic = 0, HeaderVersion = 0, SampleSize = 0;
+	Reader.Seek(0);
+	Reader << HeaderMagic << HeaderVersion << SampleSize;
+	if (HeaderMagic != Magic || HeaderVersion != Version || SampleSize != sizeof(FGoKartTelemetrySample)) return false;
+
+	int32 NumChunks = 0;
+	int64 IndexOffset = 0;
+	uint32 FooterMagic = 0;
+	Reader.Seek(Reader.TotalSize() - FooterSize);
+	Reader << NumChunks << IndexOffset << FooterMagic;
+	if (FooterMagic != Magic || NumChunks < 0) return false;
+
+	OutChunks.SetNum(NumChunks);
+	Reader.Seek(IndexOffset);
+	for (FChunkInfo& Chunk : OutChunks)
+	{
+		Reader << Chunk.Offset << Chunk.FirstTime << Chunk.LastTime;
+	}
+	return !Reader.IsError();
+}
+
+bool FGoKartTelemetryFile::ReadChunk(FArchive& Reader, const FChunkInfo& Chunk, TArray<FGoKartTelemetrySample>& OutSamples)
+{
+	uint32 NumSamples = 0;
+	float FirstTime, LastTime;
+	int32 RawSize = 0, CompressedSize = 0;
+
+	Reader.Seek(Chunk.Offset);
+	Reader << NumSamples << FirstTime << LastTime << RawSize << CompressedSize;
+	if (RawSize != int32(NumSamples * sizeof(FGoKartTelemetrySample)) || CompressedSize <= 0) return false;
+
+	TArray<uint8> Compressed;
+	Compressed.SetNumUninitialized(CompressedSize);
+	Reader.Serialize(Compressed.GetData(), CompressedSize);
+
+	OutSamples.SetNumUninitialized(NumSamples);
+	return FCompression::UncompressMemory(NAME_Zlib, OutSamples.GetData(), RawSize, Compressed.GetData(), CompressedSize);
+}
+
+bool FGoKartTelemetryFile::ConvertToCsv(const FString& InPath, const FString& OutPath)
+{
+	TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*InPath));
+	if (!Reader.IsValid()) return false;
+
+	TArray<FChunkInfo> Chunks;
+	if (!ReadIndex(*Reader, Chunks)) return false;
+
+	FString Csv = TEXT("time,kart,x,y,z,qx,qy,qz,qw,vx,vy,vz,force,steering,correction,rtt\n");
+	TArray<FGoKartTelemetrySample> Samples;
+	for (const FChunkInfo& Chunk : Chunks)
+	{
+		if (!ReadChunk(*Reader, Chunk, Samples)) return false;
+
+		for (const FGoKartTelemetrySample& Sample : Samples)
+		{
+			Csv += FString::Printf(TEXT("%.4f,%u,%.2f,%.2f,%.2f,%.5f,%.5f,%.5f,%.5f,%.4f,%.4f,%.4f,%.3f,%.3f,%.2f,%.4f\n"),
+				Sample.Time, Sample.KartId,
+				Sample.Location.X, Sample.Location.Y, Sample.Location.Z,
+				Sample.Rotation.X, Sample.Rotation.Y, Sample.Rotation.Z, Sample.Rotation.W,
+				Sample.Velocity.X, Sample.Velocity.Y, Sample.Velocity.Z,
+				Sample.Force, Sample.SteeringCrank, Sample.CorrectionError, Sample.RoundTripTime);
+		}
+	}
+	return FFileHelper::SaveStringToFile(Csv, *OutPath);
+}
+
+FGoKartTelemetryWriter::FGoKartTelemetryWriter(const FString& InPath, uint32 RingCapacity)
+	: Path(InPath)
+	, Ring(RingCapacity)
+{
+}
+
+FGoKartTelemetryWriter::~FGoKartTelemetryWriter()
+{
+	if (Thread != nullptr)
+	{
+		Thread->Kill(true);
+		delete Thread;
+	}
+}
+
+bool FGoKartTelemetryWriter::Start()
+{
+	File.Reset(IFileManager::Get().CreateFileWriter(*Path));
+	if (!File.IsValid()) return false;
+
+	uint32 HeaderMagic = FGoKartTelemetryFile::Magic;
+	uint32 HeaderVersion = FGoKartTelemetryFile::Version;
+	uint32 SampleSize = sizeof(FGoKartTelemetrySample);
+	*File << HeaderMagic << HeaderVersion << SampleSize;
+
+	Chunk.Reserve(SamplesPerChunk);
+	Thread = FRunnableThread::Create(this, TEXT("GoKartTelemetryWriter"), 0, TPri_BelowNormal);
+	return Thread != nullptr;
+}
+
+bool FGoKartTelemetryWriter::Record(const FGoKartTelemetrySample& Sample)
+{
+	if (!Ring.Push(Sample))
+	{
+		DroppedSamples++;
+		return false;
+	}
+	return true;
+}
+
+uint32 FGoKartTelemetryWriter::Run()
+{
+	while (!bStopping)
+	{
+		Drain();
+		FPlatformProcess::Sleep(0.01f);
+	}
+
+	//whatever was recorded before stopping still goes to disk
+	Drain();
+	if (Chunk.Num() > 0)
+	{
+		WriteChunk();
+	}
+	WriteIndex();
+	File->Close();
+	return 0;
+}
+
+void FGoKartTelemetryWriter::Drain()
+{
+	FGoKartTelemetrySample Sample;
+	while (Ring.Pop(Sample))
+	{
+		Chunk.Add(Sample);
+		if (Chunk.Num() >= SamplesPerChunk)
+		{
+			WriteChunk();
+		}
+	}
+}
+
+void FGoKartTelemetryWriter::WriteChunk()
+{
+	int32 RawSize = Chunk.Num() * sizeof(FGoKartTelemetrySample);
+	int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Zlib, RawSize);
+	CompressedBuffer.SetNumUninitialized(CompressedSize, false);
+	if (!FCompression::CompressMemory(NAME_Zlib, CompressedBuffer.GetData(), CompressedSize, Chunk.GetData(), RawSize))
+	{
+		Chunk.Reset();
+		return;
+	}
+
+	FGoKartTelemetryFile::FChunkInfo& Info = ChunkIndex.AddDefaulted_GetRef();
+	Info.Offset = File->Tell();
+	Info.FirstTime = Chunk[0].Time;
+	Info.LastTime = Chunk.Last().Time;
+
+	uint32 NumSamples = Chunk.Num();
+	*File << NumSamples << Info.FirstTime << Info.LastTime << RawSize << CompressedSize;
+	File->Serialize(CompressedBuffer.GetData(), CompressedSize);
+
+	Chunk.Reset();
+}
+
+void FGoKartTelemetryWriter::WriteIndex()
+{
+	int64 IndexOffset = File->Tell();
+	for (FGoKartTelemetryFile::FChunkInfo& Info : ChunkIndex)
+	{
+		*File << Info.Offset << Info.FirstTime << Info.LastTime;
+	}
+
+	int32 NumChunks = ChunkIndex.Num();
+	uint32 FooterMagic = FGoKartTelemetryFile::Magic;
+	*File << NumChunks << IndexOffset << FooterMagic;
+}
+
+void UGoKartTelemetrySubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	//-KartTelemetry=<file> records from the start of play
+	FString FileName;
+	if (GetWorld()->IsGameWorld() && FParse::Value(FCommandLine::Get(), TEXT("KartTelemetry="), FileName))
+	{
+		StartRecording(FileName);
+	}
+}
+
+void UGoKartTelemetrySubsystem::Deinitialize()
+{
+	StopRecording();
+	Super::Deinitialize();
+}
+
+bool UGoKartTelemetrySubsystem::StartRecording(const FString& FileName)
+{
+	StopRecording();
+
+	FString Path = FPaths::IsRelative(FileName) ? FPaths::ProjectSavedDir() / TEXT("Telemetry") / FileName : FileName;
+	//a second of samples for 64 karts at 120Hz
+	Writer = MakeUnique<FGoKartTelemetryWriter>(Path, 64 * 128);
+	if (!Writer->Start())
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not start telemetry recording to %s"), *Path);
+		Writer.Reset();
+		return false;
+	}
+	UE_LOG(LogTemp, Log, TEXT("Recording kart telemetry to %s"), *Path);
+	return true;
+}
+
+void UGoKartTelemetrySubsystem::StopRecording()
+{
+	if (!Writer.IsValid()) return;
+
+	if (Writer->GetDroppedSamples() > 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Kart telemetry dropped %u samples"), Writer->GetDroppedSamples());
+	}
+	//destroying the writer stops its thread, which flushes the last chunk and the index
+	Writer.Reset();
+}
+
+void UGoKartTelemetrySubsystem::Record(const FGoKartTelemetrySample& Sample)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartTelemetryRecord);
+
+	if (Writer.IsValid())
+	{
+		Writer->Record(Sample);
+	}
+}
+
+int32 UGoKartTelemetryCommandlet::Main(const FString& Params)
+{
+	FString InPath, OutPath;
+	if (!FParse::Value(*Params, TEXT("In="), InPath))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Usage: -run=GoKartTelemetry -In=<file> [-Out=<file.csv>]"));
+		return 1;
+	}
+	if (!FParse::Value(*Params, TEXT("Out="), OutPath))
+	{
+		OutPath = FPaths::ChangeExtension(InPath, TEXT("csv"));
+	}
+
+	if (!FGoKartTelemetryFile::ConvertToCsv(InPath, OutPath))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not convert %s"), *InPath);
+		return 1;
+	}
+	UE_LOG(LogTemp, Log, TEXT("Wrote %s"), *OutPath);
+	return 0;
+}
+
+static FAutoConsoleCommandWithWorldAndArgs KartTelemetryStartCommand(
+	TEXT("Kart.Telemetry.Start"),
+	TEXT("Record per tick kart telemetry to Saved/Telemetry/<File>"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UGoKartTelemetrySubsystem* Telemetry = World != nullptr ? World->GetSubsystem<UGoKartTelemetrySubsystem>() : nullptr;
+		if (Telemetry == nullptr) return;
+		Telemetry->StartRecording(Args.Num() > 0 ? Args[0] : FString::Printf(TEXT("Karts_%s.kktl"), *FDateTime::Now().ToString()));
+	}));
+
+static FAutoConsoleCommandWithWorld KartTelemetryStopCommand(
+	TEXT("Kart.Telemetry.Stop"),
+	TEXT("Stop recording kart telemetry and finish the file"),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		UGoKartTelemetrySubsystem* Telemetry = World != nullptr ? World->GetSubsystem<UGoKartTelemetrySubsystem>() : nullptr;
+		if (Telemetry == nullptr) return;
+		Telemetry->StopRecording();
+	}));
@@ -0,0 +1,163 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "Templates/Atomic.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Commandlets/Commandlet.h"
+#include "GoKartTelemetry.generated.h"
+
+//one kart on one tick, written to disk as raw bytes so it must stay plain data
+struct FGoKartTelemetrySample
+{
+	float Time;
+	uint32 KartId;
+	FVector Location;
+	FQuat Rotation;
+	FVector Velocity;
+	float Force;
+	float SteeringCrank;
+	//distance in cm the last server correction moved the kart, owning clients only
+	float CorrectionError;
+	float RoundTripTime;
+};
+
+//fixed size ring for exactly one producer thread and one consumer thread, no locks
+template<typename T>
+class TGoKartSpscRing
+{
+public:
+	explicit TGoKartSpscRing(uint32 InCapacity)
+		: Capacity(FMath::RoundUpToPowerOfTwo(InCapacity))
+		, Mask(Capacity - 1)
+	{
+		Items.SetNumUninitialized(Capacity);
+	}
+
+	//producer side, returns false and drops the item when the consumer has fallen behind
+	bool Push(const T& Item)
+	{
+		uint32 Write = WriteIndex.Load(EMemoryOrder::Relaxed);
+		if (Write - ReadIndex.Load() >= Capacity) return false;
+
+		Items[Write & Mask] = Item;
+		WriteIndex.Store(Write + 1);
+		return true;
+	}
+
+	//consumer side
+	bool Pop(T& OutItem)
+	{
+		uint32 Read = ReadIndex.Load(EMemoryOrder::Relaxed);
+		if (Read == WriteIndex.Load()) return false;
+
+		OutItem = Items[Read & Mask];
+		ReadIndex.Store(Read + 1);
+		return true;
+	}
+
+private:
+	TArray<T> Items;
+	uint32 Capacity;
+	uint32 Mask;
+
+	//kept on separate cache lines so the two threads don't fight over them
+	alignas(PLATFORM_CACHE_LINE_SIZE) TAtomic<uint32> WriteIndex { 0 };
+	alignas(PLATFORM_CACHE_LINE_SIZE) TAtomic<uint32> ReadIndex { 0 };
+};
+
+/*
+ * Telemetry file layout, little endian:
+ *   header  uint32 magic, uint32 version, uint32 sample size
+ *   chunks  uint32 sample count, float first time, float last time, int32 raw size, int32 compressed size, zlib bytes
+ *   index   per chunk int64 offset, float first time, float last time
+ *   footer  int32 chunk count, int64 index offset, uint32 magic
+ * The index lets a reader jump straight to the chunk holding any time.
+ */
+struct KRAZYKARTS_API FGoKartTelemetryFile
+{
+	static const uint32 Magic = 0x4C544B4B; // "KKTL"
+	static const uint32 Version = 1;
+
+	struct FChunkInfo
+	{
+		int64 Offset;
+		float FirstTime;
+		float LastTime;
+	};
+
+	static bool ReadIndex(FArchive& Reader, TArray<FChunkInfo>& OutChunks);
+	static bool ReadChunk(FArchive& Reader, const FChunkInfo& Chunk, TArray<FGoKartTelemetrySample>& OutSamples);
+	static bool ConvertToCsv(const FString& InPath, const FString& OutPath);
+};
+
+//drains the ring on its own thread and writes compressed chunks
+class FGoKartTelemetryWriter : public FRunnable
+{
+public:
+	FGoKartTelemetryWriter(const FString& InPath, uint32 RingCapacity);
+	virtual ~FGoKartTelemetryWriter();
+
+	bool Start();
+	//game thread only
+	bool Record(const FGoKartTelemetrySample& Sample);
+
+	uint32 GetDroppedSamples() const { return DroppedSamples; }
+	const FString& GetPath() const { return Path; }
+
+	// Begin FRunnable interface
+	virtual uint32 Run() override;
+	virtual void Stop() override { bStopping = true; }
+	// End FRunnable interface
+
+private:
+	void Drain();
+	void WriteChunk();
+	void WriteIndex();
+
+	static const int32 SamplesPerChunk = 4096;
+
+	FString Path;
+	TGoKartSpscRing<FGoKartTelemetrySample> Ring;
+	FRunnableThread* Thread = nullptr;
+	TAtomic<bool> bStopping { false };
+	uint32 DroppedSamples = 0;
+
+	//writer thread only
+	TUniquePtr<FArchive> File;
+	TArray<FGoKartTelemetrySample> Chunk;
+	TArray<FGoKartTelemetryFile::FChunkInfo> ChunkIndex;
+	TArray<uint8> CompressedBuffer;
+};
+
+//per world telemetry recording fed by the kart movement components
+UCLASS()
+class KRAZYKARTS_API UGoKartTelemetrySubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	bool StartRecording(const FString& FileName);
+	void StopRecording();
+	bool IsRecording() const { return Writer.IsValid(); }
+
+	void Record(const FGoKartTelemetrySample& Sample);
+
+private:
+	TUniquePtr<FGoKartTelemetryWriter> Writer;
+};
+
+//converts a telemetry file to CSV: -run=GoKartTelemetry -In=<file> -Out=<file.csv>
+UCLASS()
+class UGoKartTelemetryCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	virtual int32 Main(const FString& Params) override;
+};
@@ -0,0 +1,165 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartTrack.h"
+#include "Components/SplineComponent.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+
+void FGoKartTrackTable::Bake(const USplineComponent* Spline, float Spacing, float CurvatureLookAhead)
+{
+	Locations.Reset();
+	Directions.Reset();
+	Curvatures.Reset();
+	MaxCurvaturesAhead.Reset();
+
+	if (Spline == nullptr || Spacing <= 0) return;
+
+	SampleSpacing = Spacing;
+	Length = Spline->GetSplineLength();
+	bClosedLoop = Spline->IsClosedLoop();
+
+	int32 NumSamples = FMath::Max(FMath::FloorToInt(Length / SampleSpacing), 2);
+	Locations.Reserve(NumSamples);
+	Directions.Reserve(NumSamples);
+	for (int32 Index = 0; Index < NumSamples; ++Index)
+	{
+		float Distance = Index * SampleSpacing;
+		Locations.Add(Spline->GetLocationAtDistanceAlongSpline(Distance, ESplineCoordinateSpace::World));
+		Directions.Add(Spline->GetDirectionAtDistanceAlongSpline(Distance, ESplineCoordinateSpace::World));
+	}
+
+	Curvatures.SetNumZeroed(NumSamples);
+	for (int32 Index = 0; Index < NumSamples; ++Index)
+	{
+		const FVector& Direction = Directions[Index];
+		const FVector& Next = Directions[Advance(Index, SampleSpacing)];
+		float Angle = FMath::Acos(FMath::Clamp(FVector::DotProduct(Direction, Next), -1.f, 1.f));
+		float Sign = FVector::CrossProduct(Direction, Next).Z >= 0 ? 1.f : -1.f;
+		Curvatures[Index] = Sign * Angle / SampleSpacing;
+	}
+
+	int32 Window = FMath::Max(FMath::CeilToInt(CurvatureLookAhead / SampleSpacing), 1);
+	MaxCurvaturesAhead.SetNumZeroed(NumSamples);
+	for (int32 Index = 0; Index < NumSamples; ++Index)
+	{
+		float MaxCurvature = 0;
+		for (int32 Offset = 0; Offset < Window; ++Offset)
+		{
+			MaxCurvature = FMath::Max(MaxCurvature, FMath::Abs(Curvatures[Advance(Index, Offset * SampleSpacing)]));
+		}
+		MaxCurvaturesAhead[Index] = MaxCurvature;
+	}
+}
+
+int32 FGoKartTrackTable::FindNearest(const FVector& Location, int32 HintIndex) const
+{
+	if (Num() == 0) return INDEX_NONE;
+
+	if (!Locations.IsValidIndex(HintIndex))
+	{
+		int32 Nearest = 0;
+		float NearestDistSq = MAX_flt;
+		for (int32 Index = 0; Index < Num(); ++Index)
+		{
+			float DistSq = FVector::DistSquared(Locations[Index], Location);
+			if (DistSq < NearestDistSq)
+			{
+				NearestDistSq = DistSq;
+				Nearest = Index;
+			}
+		}
+		return Nearest;
+	}
+
+	//karts only move a few samples per tick, so walk downhill from last tick's answer
+	int32 Nearest = HintIndex;
+	float NearestDistSq = FVector::DistSquared(Locations[Nearest], Location);
+	for (int32 Step : { 1, -1 })
+	{
+		while (true)
+		{
+			int32 Candidate = Advance(Nearest, Step * SampleSpacing);
+			float DistSq = FVector::DistSquared(Locations[Candidate], Location);
+			if (Candidate == Nearest || DistSq >= NearestDistSq) break;
+			Nearest = Candidate;
+			NearestDistSq = DistSq;
+		}
+	}
+	return Nearest;
+}
+
+int32 FGoKartTrackTable::Advance(int32 Index, float Distance) const
+{
+	int32 Target = Index + FMath::RoundToInt(Distance / SampleSpacing);
+	if (bClosedLoop)
+	{
+		return ((Target % Num()) + Num()) % Num();
+	}
+	return FMath::Clamp(Target, 0, Num() - 1);
+}
+
+float FGoKartTrackTable::ProjectDistance(const FVector& Location, int32 NearestIndex) const
+{
+	if (!Locations.IsValidIndex(NearestIndex)) return 0;
+
+	//samples are a spacing apart, so the projection stays within one spacing either side of the nearest
+	float Along = FVector::DotProduct(Location - Locations[NearestIndex], Directions[NearestIndex]);
+	float Distance = GetDistance(NearestIndex) + FMath::Clamp(Along, -SampleSpacing, SampleSpacing);
+
+	float TableLength = GetTableLength();
+	if (bClosedLoop)
+	{
+		return FMath::Fmod(Distance + TableLength, TableLength);
+	}
+	return FMath::Clamp(Distance, 0.f, TableLength);
+}
+
+AGoKartTrack::AGoKartTrack()
+{
+	PrimaryActorTick.bCanEverTick = false;
+
+	RacingLine = CreateDefaultSubobject<USplineComponent>(TEXT("RacingLine"));
+	RacingLine->SetClosedLoop(true);
+	RootComponent = RacingLine;
+
+	Centerline = CreateDefaultSubobject<USplineComponent>(TEXT("Centerline"));
+	Centerline->SetClosedLoop(true);
+	Centerline->SetupAttachment(RacingLine);
+}
+
+void AGoKartTrack::OnConstruction(const FTransform& Transform)
+{
+	Super::OnConstruction(Transform);
+	BakeTables();
+}
+
+void AGoKartTrack::BeginPlay()
+{
+	Super::BeginPlay();
+	BakeTables();
+}
+
+void AGoKartTrack::BakeTables()
+{
+	RacingLineTable.Bake(RacingLine, SampleSpacing, CurvatureLookAhead);
+	CenterlineTable.Bake(Centerline->GetNumberOfSplinePoints() >= 3 ? Centerline : RacingLine, SampleSpacing, CurvatureLookAhead);
+
+	CheckpointIndices.Reset();
+	int32 Gates = FMath::Clamp(NumCheckpoints, 1, CenterlineTable.Num());
+	for (int32 Gate = 0; Gate < Gates; ++Gate)
+	{
+		CheckpointIndices.Add(Gate * CenterlineTable.Num() / Gates);
+	}
+}
+
+AGoKartTrack* AGoKartTrack::Find(UWorld* World)
+{
+	if (World == nullptr) return nullptr;
+
+	for (TActorIterator<AGoKartTrack> It(World); It; ++It)
+	{
+		return *It;
+	}
+	return nullptr;
+}
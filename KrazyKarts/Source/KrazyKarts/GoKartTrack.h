@@ -0,0 +1,92 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "GoKartTrack.generated.h"
+
+class USplineComponent;
+
+//a spline baked into evenly spaced samples so that queries never have to project onto the spline itself
+struct KRAZYKARTS_API FGoKartTrackTable
+{
+	TArray<FVector> Locations;
+	TArray<FVector> Directions;
+	//signed curvature in 1/cm, positive when the line turns right
+	TArray<float> Curvatures;
+	//largest absolute curvature within the look ahead window after each sample
+	TArray<float> MaxCurvaturesAhead;
+
+	float SampleSpacing = 100;
+	float Length = 0;
+	bool bClosedLoop = true;
+
+	void Bake(const USplineComponent* Spline, float Spacing, float CurvatureLookAhead);
+
+	int32 Num() const { return Locations.Num(); }
+	float GetDistance(int32 Index) const { return Index * SampleSpacing; }
+	//length covered by the samples, where a closed loop wraps back to zero
+	float GetTableLength() const { return bClosedLoop ? Num() * SampleSpacing : (Num() - 1) * SampleSpacing; }
+
+	//nearest sample to Location, walking from HintIndex when it is valid so tracking a kart is O(1) per tick
+	int32 FindNearest(const FVector& Location, int32 HintIndex) const;
+	//index of the sample Distance cm further along the track
+	int32 Advance(int32 Index, float Distance) const;
+	//arc length of Location projected onto the track next to its nearest sample
+	float ProjectDistance(const FVector& Location, int32 NearestIndex) const;
+};
+
+//a racing track described by splines placed in the level
+UCLASS()
+class KRAZYKARTS_API AGoKartTrack : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	AGoKartTrack();
+
+	virtual void OnConstruction(const FTransform& Transform) override;
+	virtual void BeginPlay() override;
+
+	const FGoKartTrackTable& GetRacingLineTable() const { return RacingLineTable; }
+	const FGoKartTrackTable& GetCenterlineTable() const { return CenterlineTable; }
+
+	//sample indices of the checkpoint gates on the centerline, the first one is the start and finish line
+	const TArray<int32>& GetCheckpoints() const { return CheckpointIndices; }
+	float GetCheckpointHalfWidth() const { return CheckpointHalfWidth; }
+
+	//first track in the world, or nullptr if the level doesn't have one
+	static AGoKartTrack* Find(UWorld* World);
+
+private:
+	void BakeTables();
+
+	//line the AI drivers follow
+	UPROPERTY(VisibleAnywhere)
+	USplineComponent* RacingLine;
+
+	//middle of the road, race progress is measured along it. Left with fewer than three points the racing line is used
+	UPROPERTY(VisibleAnywhere)
+	USplineComponent* Centerline;
+
+	//gates spread evenly along the centerline, including the start and finish line at its first point
+	UPROPERTY(EditAnywhere)
+	int32 NumCheckpoints = 8;
+
+	//half the width of a checkpoint gate in cm, it has to span the road
+	UPROPERTY(EditAnywhere)
+	float CheckpointHalfWidth = 1500;
+
+	//distance between baked samples in cm
+	UPROPERTY(EditAnywhere)
+	float SampleSpacing = 100;
+
+	//how far ahead corners are looked for when baking the curvature window, in cm
+	UPROPERTY(EditAnywhere)
+	float CurvatureLookAhead = 3000;
+
+	FGoKartTrackTable RacingLineTable;
+	FGoKartTrackTable CenterlineTable;
+	TArray<int32> CheckpointIndices;
+};
@@ -0,0 +1,255 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GoKartTrust.h"
+#include "KrazyKarts.h"
+#include "GoKartAllocations.h"
+#include "GoKart.h"
+#include "GoKartTrack.h"
+#include "GoKartRaceInstances.h"
+#include "HAL/IConsoleManager.h"
+
+DECLARE_CYCLE_STAT(TEXT("Trust Checks"), STAT_KartTrustChecks, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Trusted Moves Passed"), STAT_KartTrustPassed, STATGROUP_KrazyKarts);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Trusted Moves Failed"), STAT_KartTrustFailed, STATGROUP_KrazyKarts);
+
+static TAutoConsoleVariable<int32> CVarKartTrustClients(
+	TEXT("Kart.TrustClients"),
+	0,
+	TEXT("Let clients simulate their own karts and only check the results against a physics envelope on the server"));
+
+static TAutoConsoleVariable<float> CVarKartTrustTolerance(
+	TEXT("Kart.TrustTolerance"),
+	1.25f,
+	TEXT("Factor applied once to each limit of the physics envelope: the kart's drive, the distance it can travel and how far it can turn"));
+
+static TAutoConsoleVariable<float> CVarKartTrustTrackHalfWidth(
+	TEXT("Kart.TrustTrackHalfWidth"),
+	3000,
+	TEXT("Furthest a trusted kart may be from the racing line in cm, 0 disables the check"));
+
+static TAutoConsoleVariable<float> CVarKartTrustTrackHeight(
+	TEXT("Kart.TrustTrackHeight"),
+	500,
+	TEXT("Furthest a trusted kart may be above or below the nearest racing line sample in cm, 0 disables the check"));
+
+static TAutoConsoleVariable<float> CVarKartTrustMaxSlope(
+	TEXT("Kart.TrustMaxSlope"),
+	35,
+	TEXT("Steepest climb or drop in degrees, and the most a trusted kart may pitch or roll"));
+
+static TAutoConsoleVariable<float> CVarKartTrustPenalty(
+	TEXT("Kart.TrustPenalty"),
+	5,
+	TEXT("Seconds a kart that failed a check is simulated in full by the server"));
+
+namespace
+{
+	//slack for quantization and frame timing, in m/s per second and cm per second so it adds up to the same over any frame rate
+	const float SpeedSlack = 1;
+	const float DistanceSlack = 10;
+	//the reported rotation is quantized once per state, so this one is per move
+	const float TurnSlack = 0.02f;
+}
+
+bool UGoKartTrustSubsystem::IsEnabled() const
+{
+	return CVarKartTrustClients.GetValueOnGameThread() != 0;
+}
+
+bool UGoKartTrustSubsystem::IsTickable() const
+{
+	return !IsTemplate() && Checks.Num() > 0;
+}
+
+TStatId UGoKartTrustSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGoKartTrustSubsystem, STATGROUP_Tickables);
+}
+
+void UGoKartTrustSubsystem::QueueCheck(UGoKartMovementReplicator* Replicator, const FGoKartMove& Move, const FGoKartClientState& State)
+{
+	FCheck& Check = Checks.AddDefaulted_GetRef();
+	Check.Replicator = Replicator;
+	Check.Move = Move;
+	Check.State = State;
+}
+
+void UGoKartTrustSubsystem::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartTrustChecks);
+	LLM_SCOPE_BYTAG(KrazyKarts_Replication);
+	FGoKartAllocationScope AllocationScope;
+
+	Gather();
+	Evaluate();
+	Apply();
+	Checks.Reset();
+}
+
+void UGoKartTrustSubsystem::Gather()
+{
+	int32 Num = Checks.Num();
+	FromLocations.SetNumUninitialized(Num, false);
+	FromYaws.SetNumUninitialized(Num, false);
+	FromSpeeds.SetNumUninitialized(Num, false);
+	MaxForces.SetNumUninitialized(Num, false);
+	Masses.SetNumUninitialized(Num, false);
+	DragCoefficients.SetNumUninitialized(Num, false);
+	TurningRadii.SetNumUninitialized(Num, false);
+	ContactSpeeds.SetNumUninitialized(Num, false);
+	ContactPushes.SetNumUninitialized(Num, false);
+	TrackPoints.SetNumUninitialized(Num, false);
+	Passed.SetNumUninitialized(Num, false);
+
+	bool bTrackChecks = CVarKartTrustTrackHalfWidth.GetValueOnGameThread() > 0 || CVarKartTrustTrackHeight.GetValueOnGameThread() > 0;
+	AGoKartTrack* Track = bTrackChecks ? AGoKartTrack::Find(GetWorld()) : nullptr;
+	const FGoKartTrackTable* Table = Track != nullptr && Track->GetRacingLineTable().Num() > 0 ? &Track->GetRacingLineTable() : nullptr;
+	UGoKartRaceInstanceSubsystem* Instances = GetWorld()->GetSubsystem<UGoKartRaceInstanceSubsystem>();
+
+	//a kart with two moves in the batch starts its second from the state it claimed for the first
+	PreviousCheck.Reset();
+
+	for (int32 Index = 0; Index < Num; ++Index)
+	{
+		UGoKartMovementReplicator* Replicator = Checks[Index].Replicator.Get();
+		AActor* Kart = Replicator != nullptr ? Replicator->GetOwner() : nullptr;
+		UGoKartMovementComponent* MovementComponent = Kart != nullptr ? Kart->FindComponentByClass<UGoKartMovementComponent>() : nullptr;
+		if (MovementComponent == nullptr)
+		{
+			Checks[Index].Replicator = nullptr;
+			continue;
+		}
+
+		if (int32* Previous = PreviousCheck.Find(Replicator))
+		{
+			const FGoKartClientState& PreviousState = Checks[*Previous].State;
+			FromLocations[Index] = PreviousState.Location;
+			FromYaws[Index] = PreviousState.Rotation.Yaw;
+			FromSpeeds[Index] = PreviousState.Velocity.Size();
+			//the pending bump went into the first move
+			ContactSpeeds[Index] = 0;
+			ContactPushes[Index] = 0;
+		}
+		else
+		{
+			FromLocations[Index] = Kart->GetActorLocation();
+			FromYaws[Index] = Kart->GetActorRotation().Yaw;
+			FromSpeeds[Index] = MovementComponent->GetVelocity().Size();
+			ContactSpeeds[Index] = MovementComponent->GetPendingContactVelocity().Size();
+			ContactPushes[Index] = MovementComponent->GetPendingContactOffset().Size();
+		}
+		PreviousCheck.Add(Replicator, Index);
+
+		MaxForces[Index] = MovementComponent->GetMaxForce();
+		Masses[Index] = FMath::Max(MovementComponent->GetMass(), KINDA_SMALL_NUMBER);
+		DragCoefficients[Index] = MovementComponent->GetDragCoefficient();
+		TurningRadii[Index] = FMath::Max(MovementComponent->GetMinTurningRadius(), KINDA_SMALL_NUMBER);
+
+		TrackPoints[Index] = Checks[Index].State.Location;
+		AGoKart* GoKart = Cast<AGoKart>(Kart);
+		if (Table != nullptr && GoKart != nullptr)
+		{
+			//the racing line is baked for the first instance, the others are offset copies
+			FGoKartRaceInstance* Instance = Instances != nullptr ? Instances->FindInstance(GoKart->GetRaceInstance()) : nullptr;
+			FVector Origin = Instance != nullptr ? Instance->Origin : FVector::ZeroVector;
+			int32& Hint = TrackHints.FindOrAdd(Replicator, INDEX_NONE);
+			Hint = Table->FindNearest(Checks[Index].State.Location - Origin, Hint);
+			TrackPoints[Index] = Table->Locations[Hint] + Origin;
+		}
+	}
+}
+
+void UGoKartTrustSubsystem::Evaluate()
+{
+	float Tolerance = CVarKartTrustTolerance.GetValueOnGameThread();
+	float TrackHalfWidth = CVarKartTrustTrackHalfWidth.GetValueOnGameThread();
+	float TrackHeight = CVarKartTrustTrackHeight.GetValueOnGameThread();
+	float MaxSlope = FMath::Clamp(CVarKartTrustMaxSlope.GetValueOnGameThread(), 0.f, 89.f);
+	float MaxClimb = FMath::Tan(FMath::DegreesToRadians(MaxSlope));
+	float MaxSlopeSine = FMath::Sin(FMath::DegreesToRadians(MaxSlope));
+	float Gravity = -GetWorld()->GetGravityZ() / 100;
+
+	for (int32 Index = 0; Index < Checks.Num(); ++Index)
+	{
+		const FCheck& Check = Checks[Index];
+		float DeltaTime = Check.Move.DeltaTime;
+		float ToSpeed = Check.State.Velocity.Size();
+		float FastestSpeed = FMath::Max(FromSpeeds[Index], ToSpeed);
+		float SlowestSpeed = FMath::Min(FromSpeeds[Index], ToSpeed);
+
+		//gravity only helps the engine by as much as the kart actually dropped over the move
+		float Travel = FVector::Dist(FromLocations[Index], Check.State.Location);
+		float Drop = FMath::Max(FromLocations[Index].Z - Check.State.Location.Z, 0.f);
+		float SlopeSine = Travel > KINDA_SMALL_NUMBER ? FMath::Min(Drop / Travel, MaxSlopeSine) : 0;
+		float Drive = (MaxForces[Index] + Masses[Index] * Gravity * SlopeSine) * Tolerance;
+
+		//walls and brakes only ever take speed away, so only gains are limited
+		//air resistance grows with speed and cancels the drive at the top speed, past it the kart has to be slowing down
+		float MaxGain = (Drive - DragCoefficients[Index] * SlowestSpeed * SlowestSpeed) / Masses[Index] + SpeedSlack;
+		bool bAcceleration = ToSpeed - FromSpeeds[Index] <= MaxGain * DeltaTime + ContactSpeeds[Index] * Tolerance;
+		float MaxTravel = ((FastestSpeed * 100 + DistanceSlack) * DeltaTime + ContactPushes[Index]) * Tolerance;
+		bool bDistance = FVector::Dist2D(FromLocations[Index], Check.State.Location) <= MaxTravel;
+		//the ground can't take the kart up or down faster than the steepest slope at its speed
+		bool bClimb = FMath::Abs(Check.State.Location.Z - FromLocations[Index].Z) <= MaxTravel * MaxClimb;
+		float Turn = FMath::DegreesToRadians(FMath::Abs(FRotator::NormalizeAxis(Check.State.Rotation.Yaw - FromYaws[Index])));
+		bool bTurn = Turn <= FastestSpeed * DeltaTime / TurningRadii[Index] * Tolerance + TurnSlack;
+		//karts only tilt to follow the ground
+		bool bTilt = FMath::Abs(FRotator::NormalizeAxis(Check.State.Rotation.Pitch)) <= MaxSlope * Tolerance
+			&& FMath::Abs(FRotator::NormalizeAxis(Check.State.Rotation.Roll)) <= MaxSlope * Tolerance;
+		bool bOnTrack = TrackHalfWidth <= 0 || FVector::Dist2D(TrackPoints[Index], Check.State.Location) <= TrackHalfWidth;
+		bool bTrackHeight = TrackHeight <= 0 || FMath::Abs(Check.State.Location.Z - TrackPoints[Index].Z) <= TrackHeight;
+
+		Passed[Index] = bAcceleration && bDistance && bClimb && bTurn && bTilt && bOnTrack && bTrackHeight;
+	}
+}
+
+void UGoKartTrustSubsystem::Apply()
+{
+	float Penalty = CVarKartTrustPenalty.GetValueOnGameThread();
+	int32 BatchPassed = 0, BatchFailed = 0;
+
+	//once a kart fails, the rest of its moves this tick are simulated from the authoritative state
+	Failed.Reset();
+
+	for (int32 Index = 0; Index < Checks.Num(); ++Index)
+	{
+		UGoKartMovementReplicator* Replicator = Checks[Index].Replicator.Get();
+		if (Replicator == nullptr) continue;
+
+		if (Passed[Index] && !Failed.Contains(Replicator))
+		{
+			Replicator->AcceptClientState(Checks[Index].Move, Checks[Index].State);
+			BatchPassed++;
+			continue;
+		}
+
+		if (!Failed.Contains(Replicator))
+		{
+			UE_LOG(LogTemp, Warning, TEXT("%s failed the trusted move check, simulating it for %.0f s"), *Replicator->GetOwner()->GetName(), Penalty);
+			Failed.Add(Replicator);
+		}
+		Replicator->RejectClientState(Checks[Index].Move, Penalty);
+		BatchFailed++;
+	}
+
+	NumPassed += BatchPassed;
+	NumFailed += BatchFailed;
+	SET_DWORD_STAT(STAT_KartTrustPassed, BatchPassed);
+	SET_DWORD_STAT(STAT_KartTrustFailed, BatchFailed);
+}
+
+void UGoKartTrustSubsystem::LogSummary() const
+{
+	UE_LOG(LogTemp, Log, TEXT("Trusted clients %s: %lld moves passed, %lld failed"), IsEnabled() ? TEXT("on") : TEXT("off"), NumPassed, NumFailed);
+}
+
+static FAutoConsoleCommandWithWorld KartTrustCommand(
+	TEXT("Kart.Trust"),
+	TEXT("Log how many trusted moves passed and failed the server's envelope check"),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		UGoKartTrustSubsystem* Trust = World != nullptr ? World->GetSubsystem<UGoKartTrustSubsystem>() : nullptr;
+		if (Trust == nullptr) return;
+		Trust->LogSummary();
+	}));
@@ -0,0 +1,68 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "GoKartMovementReplicator.h"
+#include "GoKartTrust.generated.h"
+
+//checks the states trusted clients report against a cheap physics envelope once per tick, instead of re-simulating their moves
+UCLASS()
+class KRAZYKARTS_API UGoKartTrustSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	//Kart.TrustClients, server side
+	bool IsEnabled() const;
+
+	void QueueCheck(UGoKartMovementReplicator* Replicator, const FGoKartMove& Move, const FGoKartClientState& State);
+	void LogSummary() const;
+
+	// Begin FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End FTickableGameObject interface
+
+private:
+	struct FCheck
+	{
+		TWeakObjectPtr<UGoKartMovementReplicator> Replicator;
+		FGoKartMove Move;
+		FGoKartClientState State;
+	};
+
+	void Gather();
+	void Evaluate();
+	void Apply();
+
+	TArray<FCheck> Checks;
+
+	//structure of arrays filled by Gather, one entry per check
+	TArray<FVector> FromLocations;
+	TArray<float> FromYaws;
+	TArray<float> FromSpeeds;
+	TArray<float> MaxForces;
+	TArray<float> Masses;
+	TArray<float> DragCoefficients;
+	TArray<float> TurningRadii;
+	//the server's own contact response, a bump may add this much speed and push on top of the envelope
+	TArray<float> ContactSpeeds;
+	TArray<float> ContactPushes;
+	TArray<FVector> TrackPoints;
+	TArray<bool> Passed;
+
+	//per tick bookkeeping, members so their allocations are reused
+	TMap<UGoKartMovementReplicator*, int32> PreviousCheck;
+	TSet<UGoKartMovementReplicator*> Failed;
+
+	//last nearest racing line sample per kart
+	TMap<TWeakObjectPtr<UGoKartMovementReplicator>, int32> TrackHints;
+
+	int64 NumPassed = 0;
+	int64 NumFailed = 0;
+};
@@ -3,5 +3,9 @@
 #include "KrazyKarts.h"
 #include "Modules/ModuleManager.h"
 
+LLM_DEFINE_TAG(KrazyKarts_Simulation);
+LLM_DEFINE_TAG(KrazyKarts_Replication);
+LLM_DEFINE_TAG(KrazyKarts_Interpolation);
+
 IMPLEMENT_PRIMARY_GAME_MODULE( FDefaultGameModuleImpl, KrazyKarts, "KrazyKarts" );
  
\ No newline at end of file
@@ -2,4 +2,14 @@
 
 #pragma once
 
-#include "CoreMinimal.h"
\ No newline at end of file
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "HAL/LowLevelMemTracker.h"
+
+// Cycle counters for the kart game code; view in game with "stat KrazyKarts"
+DECLARE_STATS_GROUP(TEXT("KrazyKarts"), STATGROUP_KrazyKarts, STATCAT_Advanced);
+
+// Memory tags for the kart tick pipeline; view with -LLM and "stat LLMFULL"
+LLM_DECLARE_TAG(KrazyKarts_Simulation);
+LLM_DECLARE_TAG(KrazyKarts_Replication);
+LLM_DECLARE_TAG(KrazyKarts_Interpolation);
@@ -3,9 +3,147 @@
 #include "KrazyKartsGameMode.h"
 #include "KrazyKartsPawn.h"
 #include "KrazyKartsHud.h"
+#include "GoKart.h"
+#include "GoKartRaceInstances.h"
+#include "GoKartPool.h"
+#include "GoKartJoinSync.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerState.h"
+#include "GameFramework/Controller.h"
+#include "HAL/IConsoleManager.h"
 
 AKrazyKartsGameMode::AKrazyKartsGameMode()
 {
 	DefaultPawnClass = AKrazyKartsPawn::StaticClass();
 	HUDClass = AKrazyKartsHud::StaticClass();
+
+	MaxPlayersPerRace = 12;
+	// 7 x 7 instances of 2.5 km each, all inside HALF_WORLD_MAX
+	RaceInstanceSpacing = 250000.f;
+	PrewarmedKarts = 12;
+}
+
+void AKrazyKartsGameMode::BeginPlay()
+{
+	Super::BeginPlay();
+
+	UGoKartPoolSubsystem* Pool = GetWorld()->GetSubsystem<UGoKartPoolSubsystem>();
+	TSubclassOf<AGoKart> KartClass = *DefaultPawnClass;
+	if ((Pool != nullptr) && (KartClass != nullptr))
+	{
+		Pool->Prewarm(KartClass, PrewarmedKarts);
+	}
+}
+
+void AKrazyKartsGameMode::PreLogin(const FString& Options, const FString& Address, const FUniqueNetIdRepl& UniqueId, FString& ErrorMessage)
+{
+	Super::PreLogin(Options, Address, UniqueId, ErrorMessage);
+
+	// Every instance is full and another one would not fit inside the world
+	UGoKartRaceInstanceSubsystem* Instances = GetWorld()->GetSubsystem<UGoKartRaceInstanceSubsystem>();
+	if (ErrorMessage.IsEmpty() && (Instances != nullptr) && (Instances->HasRoom(MaxPlayersPerRace, RaceInstanceSpacing) == false))
+	{
+		ErrorMessage = TEXT("Server full");
+	}
+}
+
+APawn* AKrazyKartsGameMode::SpawnDefaultPawnAtTransform_Implementation(AController* NewPlayer, const FTransform& SpawnTransform)
+{
+	UGoKartRaceInstanceSubsystem* Instances = GetWorld()->GetSubsystem<UGoKartRaceInstanceSubsystem>();
+	if (Instances == nullptr)
+	{
+		return Super::SpawnDefaultPawnAtTransform_Implementation(NewPlayer, SpawnTransform);
+	}
+
+	// Each race instance gets its own offset copy of the start positions
+	int32 InstanceId = Instances->AssignPlayer(NewPlayer, MaxPlayersPerRace, RaceInstanceSpacing);
+	if (InstanceId == INDEX_NONE)
+	{
+		return nullptr;
+	}
+	FTransform InstanceTransform = SpawnTransform;
+	InstanceTransform.AddToTranslation(Instances->FindInstance(InstanceId)->Origin);
+
+	// Karts come out of the pool, anything else is spawned as usual
+	UGoKartPoolSubsystem* Pool = GetWorld()->GetSubsystem<UGoKartPoolSubsystem>();
+	TSubclassOf<AGoKart> KartClass = GetDefaultPawnClassForController(NewPlayer);
+	APawn* Pawn = ((Pool != nullptr) && (KartClass != nullptr))
+		? Pool->Acquire(KartClass, InstanceTransform)
+		: Super::SpawnDefaultPawnAtTransform_Implementation(NewPlayer, InstanceTransform);
+
+	Instances->AddKart(Cast<AGoKart>(Pawn), InstanceId);
+	return Pawn;
+}
+
+void AKrazyKartsGameMode::PostLogin(APlayerController* NewPlayer)
+{
+	Super::PostLogin(NewPlayer);
+
+	// The new kart exists now, give its player the rest of the race in one go
+	UGoKartJoinSyncSubsystem* JoinSync = GetWorld()->GetSubsystem<UGoKartJoinSyncSubsystem>();
+	if (JoinSync != nullptr)
+	{
+		JoinSync->SendJoinSnapshot(NewPlayer);
+	}
+}
+
+void AKrazyKartsGameMode::Logout(AController* Exiting)
+{
+	UGoKartRaceInstanceSubsystem* Instances = GetWorld()->GetSubsystem<UGoKartRaceInstanceSubsystem>();
+	if (Instances != nullptr)
+	{
+		Instances->RemovePlayer(Exiting);
+	}
+
+	// Park the kart instead of letting the controller destroy it on the way out
+	UGoKartPoolSubsystem* Pool = GetWorld()->GetSubsystem<UGoKartPoolSubsystem>();
+	AGoKart* Kart = Cast<AGoKart>(Exiting->GetPawn());
+	if ((Pool != nullptr) && (Kart != nullptr))
+	{
+		Exiting->UnPossess();
+		Pool->Release(Kart);
+	}
+
+	Super::Logout(Exiting);
 }
+
+void AKrazyKartsGameMode::RestartRace()
+{
+	const double StartTime = FPlatformTime::Seconds();
+
+	UGoKartPoolSubsystem* Pool = GetWorld()->GetSubsystem<UGoKartPoolSubsystem>();
+	TArray<AController*> Players;
+	for (FConstControllerIterator It = GetWorld()->GetControllerIterator(); It; ++It)
+	{
+		AController* Controller = It->Get();
+		if (Controller == nullptr || Controller->PlayerState == nullptr || Controller->PlayerState->IsOnlyASpectator())
+		{
+			continue;
+		}
+
+		AGoKart* Kart = Cast<AGoKart>(Controller->GetPawn());
+		if ((Pool != nullptr) && (Kart != nullptr))
+		{
+			Controller->UnPossess();
+			Pool->Release(Kart);
+		}
+		Players.Add(Controller);
+	}
+
+	for (AController* Controller : Players)
+	{
+		RestartPlayer(Controller);
+	}
+
+	UE_LOG(LogTemp, Log, TEXT("Restarted race for %d players in %.2f ms"), Players.Num(), (FPlatformTime::Seconds() - StartTime) * 1000.0);
+}
+
+static FAutoConsoleCommandWithWorld KartRestartRaceCommand(
+	TEXT("Kart.RestartRace"),
+	TEXT("Put every player back on the grid with pooled karts and log how long it took"),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		AKrazyKartsGameMode* GameMode = World != nullptr ? World->GetAuthGameMode<AKrazyKartsGameMode>() : nullptr;
+		if (GameMode == nullptr) return;
+		GameMode->RestartRace();
+	}));
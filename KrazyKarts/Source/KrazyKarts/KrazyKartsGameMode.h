@@ -10,6 +10,28 @@ class AKrazyKartsGameMode : public AGameModeBase
 
 public:
 	AKrazyKartsGameMode();
+
+	virtual void PreLogin(const FString& Options, const FString& Address, const FUniqueNetIdRepl& UniqueId, FString& ErrorMessage) override;
+	virtual APawn* SpawnDefaultPawnAtTransform_Implementation(AController* NewPlayer, const FTransform& SpawnTransform) override;
+	virtual void PostLogin(APlayerController* NewPlayer) override;
+	virtual void Logout(AController* Exiting) override;
+	virtual void BeginPlay() override;
+
+	/** Put every player back on the grid with a fresh kart from the pool, without reloading the map */
+	void RestartRace();
+
+protected:
+	/** Players per race instance, once an instance is full the next player opens a new one */
+	UPROPERTY(EditDefaultsOnly, Category = "Race Instances")
+	int32 MaxPlayersPerRace;
+
+	/** Distance between neighbouring race instances on the instance grid, each instance's track has to fit in a square this wide */
+	UPROPERTY(EditDefaultsOnly, Category = "Race Instances")
+	float RaceInstanceSpacing;
+
+	/** Karts spawned and parked when the match starts, so players joining later don't cause a spawn hitch */
+	UPROPERTY(EditDefaultsOnly, Category = "Kart Pool")
+	int32 PrewarmedKarts;
 };
 
 
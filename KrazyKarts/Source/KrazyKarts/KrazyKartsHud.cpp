@@ -1,6 +1,7 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "KrazyKartsHud.h"
+#include "KrazyKarts.h"
 #include "KrazyKartsPawn.h"
 #include "WheeledVehicle.h"
 #include "RenderResource.h"
@@ -9,8 +10,8 @@
 #include "WheeledVehicleMovementComponent.h"
 #include "Engine/Font.h"
 #include "CanvasItem.h"
-#include "UObject/ConstructorHelpers.h"
 #include "Engine/Engine.h"
+#include "GoKartAssetPreload.h"
 
 #define LOCTEXT_NAMESPACE "VehicleHUD"
 
@@ -18,16 +19,42 @@
 #define HMD_MODULE_INCLUDED 0
 #endif
 
+DECLARE_CYCLE_STAT(TEXT("Draw HUD"), STAT_KartDrawHUD, STATGROUP_KrazyKarts);
+
 AKrazyKartsHud::AKrazyKartsHud()
 {
-	static ConstructorHelpers::FObjectFinder<UFont> Font(TEXT("/Engine/EngineFonts/RobotoDistanceField"));
-	HUDFont = Font.Object;
+	HUDFontAsset = FSoftObjectPath(TEXT("/Engine/EngineFonts/RobotoDistanceField.RobotoDistanceField"));
+	HUDFont = nullptr;
+
+	HUDItemsRevision = 0;
+	HUDItemsCanvasSize = FIntPoint::ZeroValue;
+}
+
+void AKrazyKartsHud::GetPreloadAssets(TArray<FSoftObjectPath>& OutAssets) const
+{
+	if (HUDFontAsset.IsNull() == false)
+	{
+		OutAssets.AddUnique(HUDFontAsset.ToSoftObjectPath());
+	}
+}
+
+void AKrazyKartsHud::BeginPlay()
+{
+	Super::BeginPlay();
+
+	HUDFont = Cast<UFont>(UGoKartAssetPreloadSubsystem::ResolveAsset(HUDFontAsset.ToSoftObjectPath()));
+	if (HUDFont == nullptr)
+	{
+		HUDFont = GEngine->GetLargeFont();
+	}
 }
 
 void AKrazyKartsHud::DrawHUD()
 {
 	Super::DrawHUD();
 
+	SCOPE_CYCLE_COUNTER(STAT_KartDrawHUD);
+
 	// Calculate ratio from 720p
 	const float HUDXRatio = Canvas->SizeX / 1280.f;
 	const float HUDYRatio = Canvas->SizeY / 720.f;
@@ -43,20 +70,38 @@ void AKrazyKartsHud::DrawHUD()
 		AKrazyKartsPawn* Vehicle = Cast<AKrazyKartsPawn>(GetOwningPawn());
 		if ((Vehicle != nullptr) && (Vehicle->bInCarCameraActive == false))
 		{
-			FVector2D ScaleVec(HUDYRatio * 1.4f, HUDYRatio * 1.4f);
+			const FIntPoint CanvasSize(Canvas->SizeX, Canvas->SizeY);
+			if ((HUDItemsVehicle.Get() != Vehicle) || (HUDItemsRevision != Vehicle->HUDStringsRevision) || (HUDItemsCanvasSize != CanvasSize) || (HUDItems.Num() == 0))
+			{
+				RebuildHUDItems(Vehicle, HUDXRatio, HUDYRatio);
+				HUDItemsCanvasSize = CanvasSize;
+			}
 
-			// Speed
-			FCanvasTextItem SpeedTextItem(FVector2D(HUDXRatio * 805.f, HUDYRatio * 455), Vehicle->SpeedDisplayString, HUDFont, FLinearColor::White);
-			SpeedTextItem.Scale = ScaleVec;
-			Canvas->DrawItem(SpeedTextItem);
-
-			// Gear
-			FCanvasTextItem GearTextItem(FVector2D(HUDXRatio * 805.f, HUDYRatio * 500.f), Vehicle->GearDisplayString, HUDFont, Vehicle->bInReverseGear == false ? Vehicle->GearDisplayColor : Vehicle->GearDisplayReverseColor);
-			GearTextItem.Scale = ScaleVec;
-			Canvas->DrawItem(GearTextItem);
+			for (FCanvasTextItem& Item : HUDItems)
+			{
+				Canvas->DrawItem(Item);
+			}
 		}
 	}
 }
 
+void AKrazyKartsHud::RebuildHUDItems(const AKrazyKartsPawn* Vehicle, float HUDXRatio, float HUDYRatio)
+{
+	HUDItems.Reset();
+
+	FVector2D ScaleVec(HUDYRatio * 1.4f, HUDYRatio * 1.4f);
+
+	// Speed
+	FCanvasTextItem& SpeedTextItem = HUDItems.Emplace_GetRef(FVector2D(HUDXRatio * 805.f, HUDYRatio * 455), Vehicle->SpeedDisplayString, HUDFont, FLinearColor::White);
+	SpeedTextItem.Scale = ScaleVec;
+
+	// Gear
+	FCanvasTextItem& GearTextItem = HUDItems.Emplace_GetRef(FVector2D(HUDXRatio * 805.f, HUDYRatio * 500.f), Vehicle->GearDisplayString, HUDFont, Vehicle->bInReverseGear == false ? Vehicle->GearDisplayColor : Vehicle->GearDisplayReverseColor);
+	GearTextItem.Scale = ScaleVec;
+
+	HUDItemsVehicle = Vehicle;
+	HUDItemsRevision = Vehicle->HUDStringsRevision;
+}
+
 
 #undef LOCTEXT_NAMESPACE
@@ -1,6 +1,7 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 #pragma once
 #include "GameFramework/HUD.h"
+#include "CanvasItem.h"
 #include "KrazyKartsHud.generated.h"
 
 
@@ -16,7 +17,29 @@ public:
 	UPROPERTY()
 	UFont* HUDFont;
 
+	/** Soft reference to the font, resolved from the asset preload when play begins */
+	UPROPERTY(EditDefaultsOnly, Category = HUD)
+	TSoftObjectPtr<UFont> HUDFontAsset;
+
+	/** Add the soft referenced assets the hud needs */
+	void GetPreloadAssets(TArray<FSoftObjectPath>& OutAssets) const;
+
 	// Begin AHUD interface
 	virtual void DrawHUD() override;
 	// End AHUD interface
+
+protected:
+	virtual void BeginPlay() override;
+
+private:
+	/** Rebuild the retained text items from the vehicle's current strings */
+	void RebuildHUDItems(const class AKrazyKartsPawn* Vehicle, float HUDXRatio, float HUDYRatio);
+
+	/** Text items drawn every frame, only rebuilt when their inputs change */
+	TArray<FCanvasTextItem> HUDItems;
+
+	/** Inputs the retained items were built from */
+	TWeakObjectPtr<const class AKrazyKartsPawn> HUDItemsVehicle;
+	uint32 HUDItemsRevision;
+	FIntPoint HUDItemsCanvasSize;
 };
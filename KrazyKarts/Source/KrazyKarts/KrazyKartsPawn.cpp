@@ -1,8 +1,10 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "KrazyKartsPawn.h"
+#include "KrazyKarts.h"
 #include "KrazyKartsWheelFront.h"
 #include "KrazyKartsWheelRear.h"
+#include "KrazyKartsVehicleMovement.h"
 #include "KrazyKartsHud.h"
 #include "Components/SkeletalMeshComponent.h"
 #include "GameFramework/SpringArmComponent.h"
@@ -11,10 +13,16 @@
 #include "WheeledVehicleMovementComponent4W.h"
 #include "Engine/SkeletalMesh.h"
 #include "Engine/Engine.h"
-#include "UObject/ConstructorHelpers.h"
 #include "Components/TextRenderComponent.h"
 #include "Materials/Material.h"
 #include "GameFramework/Controller.h"
+#include "GameFramework/PlayerController.h"
+#include "Engine/World.h"
+#include "GoKartMovementComponent.h"
+#include "GoKartAssetPreload.h"
+#include "Animation/AnimInstance.h"
+#include "Net/UnrealNetwork.h"
+#include "Internationalization/Internationalization.h"
 
 #ifndef HMD_MODULE_INCLUDED
 #define HMD_MODULE_INCLUDED 0
@@ -31,16 +39,79 @@ const FName AKrazyKartsPawn::LookRightBinding("LookRight");
 
 #define LOCTEXT_NAMESPACE "VehiclePawn"
 
-PRAGMA_DISABLE_DEPRECATION_WARNINGS
+DECLARE_CYCLE_STAT(TEXT("Pawn HUD Strings"), STAT_KartPawnHUDStrings, STATGROUP_KrazyKarts);
+DECLARE_CYCLE_STAT(TEXT("Physics LOD"), STAT_KartPhysicsLOD, STATGROUP_KrazyKarts);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Vehicles On Lite Physics"), STAT_KartLitePhysicsVehicles, STATGROUP_KrazyKarts);
 
-AKrazyKartsPawn::AKrazyKartsPawn()
+namespace
 {
-	// Car mesh
-	static ConstructorHelpers::FObjectFinder<USkeletalMesh> CarMesh(TEXT("/Game/Vehicle/Sedan/Sedan_SkelMesh.Sedan_SkelMesh"));
-	GetMesh()->SetSkeletalMesh(CarMesh.Object);
+	// Speeds and gears up to these values get a pre-built string, anything above is formatted on demand
+	const int32 MaxCachedSpeed = 400;
+	const int32 MaxCachedGear = 9;
+
+	// Pre-built strings, shared by every vehicle and thrown away whenever the culture changes
+	TArray<FText> SpeedTexts;
+	TArray<FText> GearTexts;
+
+	void BuildHUDTexts()
+	{
+		static bool bListeningForCulture = false;
+		if (bListeningForCulture == false)
+		{
+			FInternationalization::Get().OnCultureChanged().AddLambda([]()
+			{
+				SpeedTexts.Reset();
+				GearTexts.Reset();
+			});
+			bListeningForCulture = true;
+		}
+
+		if (SpeedTexts.Num() == 0)
+		{
+			// Using FText because this is display text that should be localizable
+			SpeedTexts.Reserve(MaxCachedSpeed + 1);
+			for (int32 Speed = 0; Speed <= MaxCachedSpeed; ++Speed)
+			{
+				SpeedTexts.Add(FText::Format(LOCTEXT("SpeedFormat", "{0} km/h"), FText::AsNumber(Speed)));
+			}
+		}
 
-	static ConstructorHelpers::FClassFinder<UObject> AnimBPClass(TEXT("/Game/Vehicle/Sedan/Sedan_AnimBP"));
-	GetMesh()->SetAnimInstanceClass(AnimBPClass.Class);
+		if (GearTexts.Num() == 0)
+		{
+			GearTexts.Reserve(MaxCachedGear + 1);
+			GearTexts.Add(LOCTEXT("N", "N"));
+			for (int32 Forward = 1; Forward <= MaxCachedGear; ++Forward)
+			{
+				GearTexts.Add(FText::AsNumber(Forward));
+			}
+		}
+	}
+
+	FText GetSpeedText(int32 KPH)
+	{
+		BuildHUDTexts();
+		return SpeedTexts.IsValidIndex(KPH) ? SpeedTexts[KPH] : FText::Format(LOCTEXT("SpeedFormat", "{0} km/h"), FText::AsNumber(KPH));
+	}
+
+	FText GetGearText(int32 Gear)
+	{
+		if (Gear < 0)
+		{
+			return LOCTEXT("ReverseGear", "R");
+		}
+		BuildHUDTexts();
+		return GearTexts.IsValidIndex(Gear) ? GearTexts[Gear] : FText::AsNumber(Gear);
+	}
+}
+
+PRAGMA_DISABLE_DEPRECATION_WARNINGS
+
+AKrazyKartsPawn::AKrazyKartsPawn(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer.SetDefaultSubobjectClass<UKrazyKartsVehicleMovement>(AWheeledVehicle::VehicleMovementComponentName))
+{
+	// Car mesh and animation, applied in PostInitializeComponents once the preload has them in memory
+	CarMeshAsset = FSoftObjectPath(TEXT("/Game/Vehicle/Sedan/Sedan_SkelMesh.Sedan_SkelMesh"));
+	AnimClassAsset = FSoftObjectPath(TEXT("/Game/Vehicle/Sedan/Sedan_AnimBP.Sedan_AnimBP_C"));
 	
 	// Simulation
 	UWheeledVehicleMovementComponent4W* Vehicle4W = CastChecked<UWheeledVehicleMovementComponent4W>(GetVehicleMovement());
@@ -93,13 +164,10 @@ AKrazyKartsPawn::AKrazyKartsPawn()
 	InternalCamera->SetupAttachment(InternalCameraBase);
 
 	//Setup TextRenderMaterial
-	static ConstructorHelpers::FObjectFinder<UMaterial> TextMaterial(TEXT("Material'/Engine/EngineMaterials/AntiAliasedTextMaterialTranslucent.AntiAliasedTextMaterialTranslucent'"));
-	
-	UMaterialInterface* Material = TextMaterial.Object;
+	TextMaterialAsset = FSoftObjectPath(TEXT("/Engine/EngineMaterials/AntiAliasedTextMaterialTranslucent.AntiAliasedTextMaterialTranslucent"));
 
 	// Create text render component for in car speed display
 	InCarSpeed = CreateDefaultSubobject<UTextRenderComponent>(TEXT("IncarSpeed"));
-	InCarSpeed->SetTextMaterial(Material);
 	InCarSpeed->SetRelativeLocation(FVector(70.0f, -75.0f, 99.0f));
 	InCarSpeed->SetRelativeRotation(FRotator(18.0f, 180.0f, 0.0f));
 	InCarSpeed->SetupAttachment(GetMesh());
@@ -107,7 +175,6 @@ AKrazyKartsPawn::AKrazyKartsPawn()
 
 	// Create text render component for in car gear display
 	InCarGear = CreateDefaultSubobject<UTextRenderComponent>(TEXT("IncarGear"));
-	InCarGear->SetTextMaterial(Material);
 	InCarGear->SetRelativeLocation(FVector(66.0f, -9.0f, 95.0f));	
 	InCarGear->SetRelativeRotation(FRotator(25.0f, 180.0f,0.0f));
 	InCarGear->SetRelativeScale3D(FVector(1.0f, 0.4f, 0.4f));
@@ -122,6 +189,24 @@ AKrazyKartsPawn::AKrazyKartsPawn()
 	GearDisplayColor = FColor(255, 255, 255, 255);
 
 	bInReverseGear = false;
+
+	// Kinematic model, only ticks while the wheeled simulation is switched off
+	LiteMovement = CreateDefaultSubobject<UGoKartMovementComponent>(TEXT("LiteMovement"));
+	LiteMovement->PrimaryComponentTick.bStartWithTickEnabled = false;
+
+	FullPhysicsDistance = 5000.f;
+	LitePhysicsDistance = 6000.f;
+	ContactHoldTime = 2.f;
+	PhysicsLODInterval = 0.25f;
+	bUsingLitePhysics = false;
+	LastContactTime = -BIG_NUMBER;
+	TimeUntilPhysicsLODCheck = 0.f;
+
+	// Nothing displayed yet, so the first tick always builds the strings
+	DisplayedSpeed = INDEX_NONE;
+	DisplayedGear = MAX_int32;
+	HUDStringsRevision = 0;
+	bInCarHUDDirty = true;
 }
 
 void AKrazyKartsPawn::SetupPlayerInputComponent(class UInputComponent* PlayerInputComponent)
@@ -196,14 +281,27 @@ void AKrazyKartsPawn::Tick(float Delta)
 {
 	Super::Tick(Delta);
 
+	UpdatePhysicsLOD(Delta);
+	if (bUsingLitePhysics == true)
+	{
+		CopyInputsToLiteMovement();
+	}
+
 	// Setup the flag to say we are in reverse gear
 	bInReverseGear = GetVehicleMovement()->GetCurrentGear() < 0;
 	
-	// Update the strings used in the hud (incar and onscreen)
-	UpdateHUDStrings();
+	{
+		SCOPE_CYCLE_COUNTER(STAT_KartPawnHUDStrings);
 
-	// Set the string in the incar hud
-	SetupInCarHUD();
+		// Update the strings used in the hud (incar and onscreen)
+		if (UpdateHUDStrings())
+		{
+			bInCarHUDDirty = true;
+		}
+
+		// Set the string in the incar hud
+		SetupInCarHUD();
+	}
 
 	bool bHMDActive = false;
 #if HMD_MODULE_INCLUDED
@@ -224,6 +322,55 @@ void AKrazyKartsPawn::Tick(float Delta)
 	}
 }
 
+void AKrazyKartsPawn::GetPreloadAssets(TArray<FSoftObjectPath>& OutAssets) const
+{
+	for (const FSoftObjectPath& Path : { CarMeshAsset.ToSoftObjectPath(), AnimClassAsset.ToSoftObjectPath(), TextMaterialAsset.ToSoftObjectPath() })
+	{
+		if (Path.IsNull() == false)
+		{
+			OutAssets.AddUnique(Path);
+		}
+	}
+}
+
+void AKrazyKartsPawn::PostInitializeComponents()
+{
+	ApplyVehicleAssets();
+
+	Super::PostInitializeComponents();
+}
+
+void AKrazyKartsPawn::ApplyVehicleAssets()
+{
+	// Subclasses that set their own mesh keep it
+	if (GetMesh()->SkeletalMesh == nullptr)
+	{
+		USkeletalMesh* CarMesh = Cast<USkeletalMesh>(UGoKartAssetPreloadSubsystem::ResolveAsset(CarMeshAsset.ToSoftObjectPath()));
+		if (CarMesh != nullptr)
+		{
+			GetMesh()->SetSkeletalMesh(CarMesh);
+			// The vehicle was set up against the empty mesh when its components registered
+			GetVehicleMovement()->RecreatePhysicsState();
+		}
+	}
+
+	if (GetMesh()->GetAnimClass() == nullptr)
+	{
+		UClass* AnimClass = Cast<UClass>(UGoKartAssetPreloadSubsystem::ResolveAsset(AnimClassAsset.ToSoftObjectPath()));
+		if (AnimClass != nullptr)
+		{
+			GetMesh()->SetAnimInstanceClass(AnimClass);
+		}
+	}
+
+	UMaterialInterface* TextMaterial = Cast<UMaterialInterface>(UGoKartAssetPreloadSubsystem::ResolveAsset(TextMaterialAsset.ToSoftObjectPath()));
+	if (TextMaterial != nullptr)
+	{
+		InCarSpeed->SetTextMaterial(TextMaterial);
+		InCarGear->SetTextMaterial(TextMaterial);
+	}
+}
+
 void AKrazyKartsPawn::BeginPlay()
 {
 	Super::BeginPlay();
@@ -233,6 +380,147 @@ void AKrazyKartsPawn::BeginPlay()
 	bEnableInCar = UHeadMountedDisplayFunctionLibrary::IsHeadMountedDisplayEnabled();
 #endif // HMD_MODULE_INCLUDED
 	EnableIncarView(bEnableInCar,true);
+
+	GetMesh()->SetNotifyRigidBodyCollision(true);
+	GetMesh()->OnComponentHit.AddDynamic(this, &AKrazyKartsPawn::OnVehicleHit);
+
+	CultureChangedHandle = FInternationalization::Get().OnCultureChanged().AddUObject(this, &AKrazyKartsPawn::OnCultureChanged);
+}
+
+void AKrazyKartsPawn::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (bUsingLitePhysics == true)
+	{
+		DEC_DWORD_STAT(STAT_KartLitePhysicsVehicles);
+	}
+
+	FInternationalization::Get().OnCultureChanged().Remove(CultureChangedHandle);
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void AKrazyKartsPawn::OnCultureChanged()
+{
+	// Forget what is on display so the next update picks up strings in the new culture
+	DisplayedSpeed = INDEX_NONE;
+	DisplayedGear = MAX_int32;
+}
+
+void AKrazyKartsPawn::OnVehicleHit(UPrimitiveComponent* HitComponent, AActor* OtherActor, UPrimitiveComponent* OtherComp, FVector NormalImpulse, const FHitResult& Hit)
+{
+	// Ground contact is constant, only things we run into count
+	if (Hit.ImpactNormal.Z < 0.7f)
+	{
+		LastContactTime = GetWorld()->GetTimeSeconds();
+	}
+}
+
+void AKrazyKartsPawn::UpdatePhysicsLOD(float Delta)
+{
+	SCOPE_CYCLE_COUNTER(STAT_KartPhysicsLOD);
+
+	// Clients follow the replicated body, only the authority picks the model
+	if (HasAuthority() == false)
+	{
+		return;
+	}
+
+	// A contact while on the kinematic model needs the full simulation straight away
+	TimeUntilPhysicsLODCheck -= Delta;
+	const bool bContactWhileLite = bUsingLitePhysics && ((GetWorld()->GetTimeSeconds() - LastContactTime) < ContactHoldTime);
+	if ((TimeUntilPhysicsLODCheck > 0.f) && (bContactWhileLite == false))
+	{
+		return;
+	}
+	TimeUntilPhysicsLODCheck = PhysicsLODInterval;
+
+	const bool bWantsLite = !WantsFullPhysics();
+	if (bWantsLite != bUsingLitePhysics)
+	{
+		SetLitePhysics(bWantsLite);
+	}
+}
+
+bool AKrazyKartsPawn::WantsFullPhysics() const
+{
+	if (IsPlayerControlled() == true)
+	{
+		return true;
+	}
+
+	if ((GetWorld()->GetTimeSeconds() - LastContactTime) < ContactHoldTime)
+	{
+		return true;
+	}
+
+	// Hysteresis: switching up needs a closer player than staying up does
+	const float Distance = bUsingLitePhysics ? FullPhysicsDistance : LitePhysicsDistance;
+	const FVector Location = GetActorLocation();
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		const APawn* PlayerPawn = It->IsValid() ? (*It)->GetPawn() : nullptr;
+		if ((PlayerPawn != nullptr) && (PlayerPawn != this) && (FVector::DistSquared(PlayerPawn->GetActorLocation(), Location) < FMath::Square(Distance)))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void AKrazyKartsPawn::SetLitePhysics(const bool bLite)
+{
+	bUsingLitePhysics = bLite;
+	ApplyLitePhysics(bLite);
+}
+
+void AKrazyKartsPawn::OnRep_UsingLitePhysics()
+{
+	ApplyLitePhysics(bUsingLitePhysics);
+}
+
+void AKrazyKartsPawn::ApplyLitePhysics(const bool bLite)
+{
+	UWheeledVehicleMovementComponent* Vehicle = GetVehicleMovement();
+	USkeletalMeshComponent* Body = GetMesh();
+
+	if (bLite == true)
+	{
+		// Carry the body's motion and inputs over so the switch doesn't pop, the kinematic model works in m/s
+		LiteMovement->SetVelocity(Body->GetPhysicsLinearVelocity() / 100.f);
+		CopyInputsToLiteMovement();
+		Vehicle->SetComponentTickEnabled(false);
+		Body->SetSimulatePhysics(false);
+		LiteMovement->SetComponentTickEnabled(true);
+		INC_DWORD_STAT(STAT_KartLitePhysicsVehicles);
+	}
+	else
+	{
+		// Clients only follow the kinematic motion through replicated movement, so that is the velocity they know
+		const FVector Velocity = HasAuthority() ? LiteMovement->GetVelocity() * 100.f : GetReplicatedMovement().LinearVelocity;
+		LiteMovement->SetComponentTickEnabled(false);
+		Body->SetSimulatePhysics(true);
+		Body->SetPhysicsLinearVelocity(Velocity);
+		Body->SetPhysicsAngularVelocityInDegrees(FVector::ZeroVector);
+		Vehicle->SetComponentTickEnabled(true);
+		DEC_DWORD_STAT(STAT_KartLitePhysicsVehicles);
+	}
+}
+
+void AKrazyKartsPawn::CopyInputsToLiteMovement()
+{
+	const UKrazyKartsVehicleMovement* Vehicle = Cast<UKrazyKartsVehicleMovement>(GetVehicleMovement());
+	if (Vehicle == nullptr)
+	{
+		return;
+	}
+	LiteMovement->SetForce(Vehicle->GetRawThrottleInput());
+	LiteMovement->SetSteeringCrank(Vehicle->GetRawSteeringInput());
+}
+
+void AKrazyKartsPawn::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+	DOREPLIFETIME(AKrazyKartsPawn, bUsingLitePhysics);
 }
 
 void AKrazyKartsPawn::OnResetVR()
@@ -247,27 +535,41 @@ void AKrazyKartsPawn::OnResetVR()
 #endif // HMD_MODULE_INCLUDED
 }
 
-void AKrazyKartsPawn::UpdateHUDStrings()
+bool AKrazyKartsPawn::UpdateHUDStrings()
 {
 	float KPH = FMath::Abs(GetVehicleMovement()->GetForwardSpeed()) * 0.036f;
 	int32 KPH_int = FMath::FloorToInt(KPH);
+	int32 Gear = bInReverseGear ? -1 : GetVehicleMovement()->GetCurrentGear();
 
-	// Using FText because this is display text that should be localizable
-	SpeedDisplayString = FText::Format(LOCTEXT("SpeedFormat", "{0} km/h"), FText::AsNumber(KPH_int));
-	
-	if (bInReverseGear == true)
+	// Only swap the text when the displayed value actually changes
+	if ((KPH_int == DisplayedSpeed) && (Gear == DisplayedGear))
 	{
-		GearDisplayString = FText(LOCTEXT("ReverseGear", "R"));
+		return false;
 	}
-	else
+
+	if (KPH_int != DisplayedSpeed)
 	{
-		int32 Gear = GetVehicleMovement()->GetCurrentGear();
-		GearDisplayString = (Gear == 0) ? LOCTEXT("N", "N") : FText::AsNumber(Gear);
-	}	
+		SpeedDisplayString = GetSpeedText(KPH_int);
+		DisplayedSpeed = KPH_int;
+	}
+
+	if (Gear != DisplayedGear)
+	{
+		GearDisplayString = GetGearText(Gear);
+		DisplayedGear = Gear;
+	}
+
+	++HUDStringsRevision;
+	return true;
 }
 
 void AKrazyKartsPawn::SetupInCarHUD()
 {
+	if (bInCarHUDDirty == false)
+	{
+		return;
+	}
+
 	APlayerController* PlayerController = Cast<APlayerController>(GetController());
 	if ((PlayerController != nullptr) && (InCarSpeed != nullptr) && (InCarGear != nullptr) )
 	{
@@ -283,6 +585,8 @@ void AKrazyKartsPawn::SetupInCarHUD()
 		{
 			InCarGear->SetTextRenderColor(GearDisplayReverseColor);
 		}
+
+		bInCarHUDDirty = false;
 	}
 }
 
@@ -42,9 +42,13 @@ class AKrazyKartsPawn : public AWheeledVehicle
 	UPROPERTY(Category = Display, VisibleDefaultsOnly, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
 	UTextRenderComponent* InCarGear;
 
+	/** Cheap kinematic model that takes over while the full wheeled simulation is switched off */
+	UPROPERTY(Category = Vehicle, VisibleDefaultsOnly, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	class UGoKartMovementComponent* LiteMovement;
+
 	
 public:
-	AKrazyKartsPawn();
+	AKrazyKartsPawn(const FObjectInitializer& ObjectInitializer);
 
 	/** The current speed as a string eg 10 km/h */
 	UPROPERTY(Category = Display, VisibleDefaultsOnly, BlueprintReadOnly)
@@ -70,16 +74,57 @@ public:
 	UPROPERTY(Category = Camera, VisibleDefaultsOnly, BlueprintReadOnly)
 	bool bInReverseGear;
 
+	/** Within this distance of a player the full wheeled simulation runs */
+	UPROPERTY(Category = "Physics LOD", EditAnywhere, BlueprintReadOnly)
+	float FullPhysicsDistance;
+
+	/** Beyond this distance from every player the vehicle drops to the kinematic model, kept above FullPhysicsDistance so it doesn't flip flop */
+	UPROPERTY(Category = "Physics LOD", EditAnywhere, BlueprintReadOnly)
+	float LitePhysicsDistance;
+
+	/** Seconds the full simulation stays on after the vehicle touches something */
+	UPROPERTY(Category = "Physics LOD", EditAnywhere, BlueprintReadOnly)
+	float ContactHoldTime;
+
+	/** Seconds between physics LOD checks */
+	UPROPERTY(Category = "Physics LOD", EditAnywhere, BlueprintReadOnly)
+	float PhysicsLODInterval;
+
+	/** Is the kinematic model driving the vehicle, replicated so clients stop simulating the body the server moves kinematically */
+	UPROPERTY(Category = "Physics LOD", VisibleInstanceOnly, BlueprintReadOnly, ReplicatedUsing = OnRep_UsingLitePhysics)
+	bool bUsingLitePhysics;
+
+	/** Vehicle mesh, soft so it streams in with the asset preload rather than with the class */
+	UPROPERTY(Category = Vehicle, EditDefaultsOnly)
+	TSoftObjectPtr<class USkeletalMesh> CarMeshAsset;
+
+	/** Animation blueprint for the vehicle mesh */
+	UPROPERTY(Category = Vehicle, EditDefaultsOnly)
+	TSoftClassPtr<class UAnimInstance> AnimClassAsset;
+
+	/** Material for the in-car speed and gear text */
+	UPROPERTY(Category = Display, EditDefaultsOnly)
+	TSoftObjectPtr<class UMaterialInterface> TextMaterialAsset;
+
+	/** Add the soft referenced assets a vehicle needs when it spawns */
+	void GetPreloadAssets(TArray<FSoftObjectPath>& OutAssets) const;
+
 	/** Initial offset of incar camera */
 	FVector InternalCameraOrigin;
+
+	/** Bumped whenever the speed or gear strings change, so the hud knows when to rebuild its items */
+	uint32 HUDStringsRevision;
+
 	// Begin Pawn interface
 	virtual void SetupPlayerInputComponent(UInputComponent* InputComponent) override;
 	// End Pawn interface
 
 	// Begin Actor interface
 	virtual void Tick(float Delta) override;
+	virtual void PostInitializeComponents() override;
 protected:
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 public:
 	// End Actor interface
@@ -91,6 +136,8 @@ public:
 
 	/** Update the physics material used by the vehicle mesh */
 	void UpdatePhysicsMaterial();
+	/** Put the soft referenced mesh, animation and text material on the components */
+	void ApplyVehicleAssets();
 	/** Handle pressing right */
 	void MoveRight(float Val);
 	/** Handle handbrake pressed */
@@ -114,12 +161,50 @@ private:
 	 */
 	void EnableIncarView( const bool bState, const bool bForce = false );
 
-	/** Update the gear and speed strings */
-	void UpdateHUDStrings();
+	/** Update the gear and speed strings, returns true if either of them changed */
+	bool UpdateHUDStrings();
+
+	/** Culture changed, the gear and speed strings need rebuilding */
+	void OnCultureChanged();
+
+	FDelegateHandle CultureChangedHandle;
+
+	/** Speed in whole km/h that SpeedDisplayString currently shows */
+	int32 DisplayedSpeed;
+
+	/** Gear that GearDisplayString currently shows, -1 for reverse */
+	int32 DisplayedGear;
+
+	/** The in car text render components need the latest strings pushed to them */
+	bool bInCarHUDDirty;
 
 	/* Are we on a 'slippery' surface */
 	bool bIsLowFriction;
 
+	/** Switch between the wheeled simulation and the kinematic model when needed */
+	void UpdatePhysicsLOD(float Delta);
+
+	/** Should the full wheeled simulation be running */
+	bool WantsFullPhysics() const;
+
+	/** Pick the model on the authority, the choice replicates to clients */
+	void SetLitePhysics(const bool bLite);
+
+	/** Hand the vehicle's motion over to the other model */
+	void ApplyLitePhysics(const bool bLite);
+
+	UFUNCTION()
+	void OnRep_UsingLitePhysics();
+
+	/** The kinematic model drives with whatever the player or AI last gave the wheeled simulation */
+	void CopyInputsToLiteMovement();
+
+	UFUNCTION()
+	void OnVehicleHit(UPrimitiveComponent* HitComponent, AActor* OtherActor, UPrimitiveComponent* OtherComp, FVector NormalImpulse, const FHitResult& Hit);
+
+	float LastContactTime;
+	float TimeUntilPhysicsLODCheck;
+
 
 public:
 	/** Returns SpringArm subobject **/
@@ -0,0 +1,25 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "WheeledVehicleMovementComponent4W.h"
+#include "KrazyKartsVehicleMovement.generated.h"
+
+PRAGMA_DISABLE_DEPRECATION_WARNINGS
+
+/** The template's four wheel vehicle simulation, with the inputs it is being driven with readable so the kinematic model can take them over */
+UCLASS()
+class UKrazyKartsVehicleMovement : public UWheeledVehicleMovementComponent4W
+{
+	GENERATED_BODY()
+
+public:
+	/** Throttle as last set by the player or an AI controller, -1 to 1 */
+	float GetRawThrottleInput() const { return RawThrottleInput; }
+
+	/** Steering as last set by the player or an AI controller, -1 to 1 */
+	float GetRawSteeringInput() const { return RawSteeringInput; }
+};
+
+PRAGMA_ENABLE_DEPRECATION_WARNINGS